@@ -36,6 +36,8 @@ android {
         versionCode = 109
         versionName = "5.0-SNAPSHOT"
 
+        testInstrumentationRunner = "androidx.test.runner.AndroidJUnitRunner"
+
         ndk.abiFilters += listOf("armeabi-v7a", "arm64-v8a", "x86", "x86_64")
         externalNativeBuild.cmake.arguments += listOf(
             "-DCMAKE_BUILD_TYPE=Release", // DEBUG
@@ -145,4 +147,8 @@ dependencies {
     implementation(libs.okhttp)
     implementation(libs.reorderable)
     implementation(libs.timber)
+
+    androidTestImplementation(libs.androidx.test.ext.junit)
+    androidTestImplementation(libs.androidx.test.runner)
+    androidTestImplementation(libs.junit)
 }
@@ -0,0 +1,52 @@
+package org.helllabs.android.xmp
+
+import android.util.Log
+import androidx.test.ext.junit.runners.AndroidJUnit4
+import org.junit.Assert.assertTrue
+import org.junit.Test
+import org.junit.runner.RunWith
+
+/**
+ * Cost of the player loop's state polling: the separate getters against the single
+ * packed [Xmp.playState]. Run with ./gradlew connectedAndroidTest, results are in logcat
+ * under PlayStateBenchmark.
+ */
+@RunWith(AndroidJUnit4::class)
+class PlayStateBenchmark {
+
+    companion object {
+        private const val WARMUP = 10_000
+        private const val CALLS = 200_000
+    }
+
+    private inline fun nanosPerCall(block: () -> Unit): Double {
+        repeat(WARMUP) { block() }
+
+        val start = System.nanoTime()
+        repeat(CALLS) { block() }
+
+        return (System.nanoTime() - start).toDouble() / CALLS
+    }
+
+    @Test
+    fun separateGettersAgainstPackedState() {
+        var sink = 0L
+
+        val separate = nanosPerCall {
+            sink += Xmp.time() + Xmp.getLoopCount() + if (Xmp.hasFreeBuffer()) 1 else 0
+        }
+        val packed = nanosPerCall {
+            val state = Xmp.playState
+            sink += state.time + state.loopCount + if (state.hasFreeBuffer) 1 else 0
+        }
+
+        // No Timber tree is planted under the test runner
+        Log.i(
+            "PlayStateBenchmark",
+            "time + getLoopCount + hasFreeBuffer: %.1f ns, getPlayState: %.1f ns (%d)"
+                .format(separate, packed, sink)
+        )
+
+        assertTrue(separate > 0 && packed > 0)
+    }
+}
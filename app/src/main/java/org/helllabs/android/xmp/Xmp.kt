@@ -3,11 +3,27 @@
 package org.helllabs.android.xmp
 
 import android.net.Uri
+import dalvik.annotation.optimization.CriticalNative
+import dalvik.annotation.optimization.FastNative
+import java.io.File
+import org.helllabs.android.xmp.core.ZipArchive
 import org.helllabs.android.xmp.model.ChannelInfo
+import org.helllabs.android.xmp.model.DowngradeReport
 import org.helllabs.android.xmp.model.FrameInfo
+import org.helllabs.android.xmp.model.LoadPhase
+import org.helllabs.android.xmp.model.LoadReport
 import org.helllabs.android.xmp.model.ModInfo
 import org.helllabs.android.xmp.model.ModVars
+import org.helllabs.android.xmp.model.NoteEvent
+import org.helllabs.android.xmp.model.PlayState
+import org.helllabs.android.xmp.model.ProbeStat
+import org.helllabs.android.xmp.model.ProbeStats
+import org.helllabs.android.xmp.model.QualityState
+import org.helllabs.android.xmp.model.QualityStep
+import org.helllabs.android.xmp.model.RenderEvent
+import org.helllabs.android.xmp.model.RenderStats
 import org.helllabs.android.xmp.model.SequenceVars
+import org.helllabs.android.xmp.model.TickState
 import timber.log.Timber
 
 object Xmp {
@@ -16,6 +32,9 @@ object Xmp {
 
     const val MAX_BUFFER_MS = 1000
 
+    // Most memory kept locked for playback, the rest is only paged in
+    const val MEMORY_LOCK_BUDGET = 64L * 1024 * 1024
+
     const val DUCK_VOLUME = 0x500
 
     // Return codes
@@ -49,10 +68,55 @@ object Xmp {
 
     const val MAX_BUFFERS = 256
 
+    // Async load results, from modload.h
+    const val LOAD_PENDING = 1
+    const val LOAD_CANCELLED = -100
+
+    // GOVERNOR_HISTORY from governor.h
+    const val QUALITY_HISTORY = 32
+
+    // Playback change events, from events.h
+    const val EVENT_POSITION = 0 // a = position, b = pattern
+    const val EVENT_ROW = 1 // a = row, b = rows in the pattern
+    const val EVENT_TEMPO = 2 // a = speed, b = bpm
+    const val EVENT_LOOP = 3 // b = loop count
+    const val EVENT_TIME = 4 // b = time in ms
+    const val EVENT_END = 5 // End of the sequence
+    const val EVENT_OVERFLOW = 6 // Events were dropped, read the state with getInfo
+
+    // Render thread scheduling, from rtsched.h
+    const val RENDER_DEFAULT = 0
+    const val RENDER_NICE = 1 // Raised nice value
+    const val RENDER_FIFO = 2 // Real-time, SCHED_FIFO
+
+    // Loudness of a silent module, from loudness.h
+    const val LOUDNESS_SILENCE = -70f
+
     // MAX_SEQUENCES from common.h
     val maxSeqFromHeader: Int
         get() = getMaxSequences()
 
+    // Load phases in native order, from loadreport.h
+    private val LOAD_PHASES = listOf(
+        "probe",
+        "open",
+        "cache",
+        "depack",
+        "parse",
+        "downgrade",
+        "metadata",
+        "timeline"
+    )
+
+    // Content provider time of the module being loaded, see [getLoadReport]
+    private var providerNanos = 0L
+
+    // Packed events for the single consumer of [awaitEvents]
+    private val eventBuffer = LongArray(128)
+
+    // Natives are registered in JNI_OnLoad, the scalar getters polled every buffer and
+    // every frame are @CriticalNative from Android 8 and the per frame copies @FastNative,
+    // which only hold the player lock briefly.
     init {
         System.loadLibrary("xmp-jni")
     }
@@ -61,7 +125,45 @@ object Xmp {
 
     // external fun testModule(name: String?, info: ModInfo?): Boolean
 
-    external fun loadModuleFd(fd: Int): Int
+    /**
+     * Load a module, or zip [member] of it if not negative, reducing sample quality
+     * if it takes more than [budget] bytes. 0 is unlimited.
+     */
+    external fun loadModuleFd(fd: Int, member: Int, budget: Long): Int
+
+    /**
+     * Load like [loadModuleFd] on the native loader thread, testing the format first.
+     * Supersedes any earlier request. Returns the generation to pass to [awaitModule].
+     */
+    external fun requestModuleFd(fd: Int, member: Int, budget: Long): Int
+
+    /**
+     * Wait up to [timeout] ms for load [gen] and make it the current module. Returns the
+     * load result, [LOAD_PENDING] if it isn't done yet or [LOAD_CANCELLED] if superseded.
+     */
+    external fun awaitModule(gen: Int, timeout: Int): Int
+
+    /**
+     * Drop every requested load, loads in progress stop at their next phase
+     */
+    external fun cancelLoad()
+
+    /**
+     * Index the zip archive in [fd], which the native side owns. Returns a handle or 0.
+     */
+    external fun openArchiveFd(fd: Int): Long
+
+    external fun closeArchive(handle: Long)
+
+    /**
+     * Names of the archive members that may be modules, in member index order
+     */
+    external fun getArchiveEntries(handle: Long): Array<String>?
+
+    /**
+     * Test an archive member, inflating only the start of it
+     */
+    external fun testArchiveEntry(handle: Long, index: Int, modInfo: ModInfo): Boolean
 
     external fun deinit(): Int
 
@@ -71,16 +173,134 @@ object Xmp {
 
     external fun fillBuffer(loop: Boolean): Int
 
+    @FastNative
     external fun getInfo(values: FrameInfo)
 
+    private external fun waitEvents(events: LongArray, timeout: Int): Int
+
+    /**
+     * Wake the thread blocked in [awaitEvents]
+     */
+    external fun wakeEvents()
+
+    /**
+     * Block up to [timeout] ms for playback changes. Events are in render order, each
+     * carries the [System.nanoTime] it becomes audible at. Only one thread may wait.
+     */
+    fun awaitEvents(timeout: Int): List<RenderEvent> {
+        val num = waitEvents(eventBuffer, timeout)
+
+        return (0 until num).map { i ->
+            val packed = eventBuffer[i * 2 + 1]
+            RenderEvent(
+                pts = eventBuffer[i * 2],
+                type = (packed ushr 48).toInt(),
+                a = (packed ushr 32).toInt() and 0xffff,
+                b = packed.toInt()
+            )
+        }
+    }
+
+    @JvmStatic
+    @CriticalNative
     external fun getPlayer(parm: Int): Int
 
+    @JvmStatic
+    @CriticalNative
     external fun hasFreeBuffer(): Boolean
 
-    external fun init(rate: Int, ms: Int): Boolean
+    /**
+     * Block up to [timeout] ms until the output has a free buffer, returns whether it has
+     */
+    external fun waitFreeBuffer(timeout: Int): Boolean
+
+    /**
+     * Give the calling thread real-time or urgent audio scheduling, as far as allowed, on
+     * the fast cores. Call from the thread that fills buffers, returns a RENDER_ constant.
+     */
+    external fun setRenderThread(): Int
+
+    private external fun getRenderStats(stats: LongArray): Boolean
+
+    /**
+     * Page in the output buffers and the samples of each module played from the next
+     * [startPlayer] on, locking up to [budget] bytes of them in memory. 0 turns it off.
+     */
+    external fun setMemoryLock(budget: Long)
+
+    /**
+     * Scheduling of the render thread and its wakeup and preemption latency for the module
+     * playing
+     */
+    fun getRenderStats(): RenderStats {
+        val s = LongArray(15)
+        if (!getRenderStats(s)) {
+            return RenderStats()
+        }
+
+        return RenderStats(
+            policy = s[0].toInt(),
+            priority = s[1].toInt(),
+            cpus = s[2].toInt(),
+            buffers = s[3],
+            wakeups = s[4],
+            wakeNanos = s[5],
+            wakeMaxNanos = s[6],
+            preemptNanos = s[7],
+            preemptMaxNanos = s[8],
+            switches = s[9],
+            minorFaults = s[10],
+            majorFaults = s[11],
+            faultBuffers = s[12],
+            lockedBytes = s[13],
+            prefaultedBytes = s[14]
+        )
+    }
+
+    /**
+     * Open the output at [rate] with about [ms] of buffering, buffers are whole multiples
+     * of [burst] frames unless it is 0. Modules are mixed at the rate given to [startPlayer]
+     * and converted natively when it differs.
+     */
+    external fun init(rate: Int, ms: Int, burst: Int): Boolean
 
     external fun mute(chn: Int, status: Int): Int
 
+    private external fun getTickState(
+        time: Long,
+        info: IntArray,
+        keys: IntArray,
+        volumes: IntArray
+    ): Int
+
+    /**
+     * Player state of the tick heard at [time] on the [System.nanoTime] clock. Ticks are
+     * recorded as they are rendered, so rows and notes shorter than a buffer are all seen.
+     * Null until the player has rendered something.
+     */
+    fun getTickState(time: Long = System.nanoTime()): TickState? {
+        val info = IntArray(8)
+        val keys = IntArray(64)
+        val volumes = IntArray(64)
+
+        val chn = getTickState(time, info, keys, volumes)
+        if (chn < 0) {
+            return null
+        }
+
+        return TickState(
+            pos = info[0],
+            row = info[1],
+            frame = info[2],
+            speed = info[3],
+            bpm = info[4],
+            offset = info[5],
+            triggers = (info[6].toLong() and 0xffffffffL) or (info[7].toLong() shl 32),
+            keys = keys.copyOf(chn),
+            volumes = volumes.copyOf(chn)
+        )
+    }
+
     external fun playAudio(): Int
 
     external fun releaseModule(): Int
@@ -99,8 +319,21 @@ object Xmp {
 
     external fun testModuleFd(fd: Int, modInfo: ModInfo): Boolean
 
+    @JvmStatic
+    @CriticalNative
     external fun time(): Int
 
+    @JvmStatic
+    @CriticalNative
+    private external fun getPlayState(): Long
+
+    /**
+     * Time, position, row, loop count and free buffer in one call, for the player loop
+     */
+    val playState: PlayState
+        get() = PlayState(getPlayState())
+
+    @FastNative
     external fun getChannelData(ci: ChannelInfo)
 
     external fun getComment(): ByteArray
@@ -109,12 +342,235 @@ object Xmp {
 
     external fun getInstruments(): Array<String>?
 
+    @JvmStatic
+    @CriticalNative
     external fun getLoopCount(): Int
 
     private external fun getMaxSequences(): Int
 
+    /**
+     * Packed metadata blob built at load time, decode with
+     * [org.helllabs.android.xmp.model.ModMetadata.parse].
+     * Returns a copy, safe to keep across module loads.
+     */
+    external fun getModMetadata(): ByteArray?
+
     external fun getModName(): String
 
+    /**
+     * Number of note-ons in sequence [seq], scanned at load time, or -1 if there is no such
+     * sequence.
+     */
+    external fun getTimelineSize(seq: Int): Int
+
+    private external fun getTimeline(seq: Int, start: Int, end: Int, events: IntArray): Int
+
+    /**
+     * Note-ons of sequence [seq] from [start] up to [end] ms, in time order, for piano-roll
+     * and channel activity views. Empty until a module is loaded.
+     */
+    fun getNoteEvents(seq: Int, start: Int, end: Int): List<NoteEvent> {
+        val num = getTimeline(seq, start, end, IntArray(0))
+        if (num <= 0) {
+            return emptyList()
+        }
+
+        val events = IntArray(num * 2)
+        val count = minOf(num, getTimeline(seq, start, end, events))
+
+        return (0 until count).map { i ->
+            val packed = events[i * 2 + 1]
+            NoteEvent(
+                time = events[i * 2],
+                channel = packed ushr 24,
+                key = (packed ushr 16) and 0xff,
+                instrument = (packed ushr 8) and 0xff,
+                volume = packed and 0xff
+            )
+        }
+    }
+
+    /**
+     * Min/max waveform of sample [smp] over frames [start, end), one pair per pixel column.
+     * [loop] receives the columns of the loop start and end, or -1 when outside the view.
+     * Returns the number of columns written, 0 while the pyramid is still being built,
+     * or -1 on error.
+     */
+    external fun getWaveform(
+        smp: Int,
+        start: Int,
+        end: Int,
+        width: Int,
+        min: ShortArray,
+        max: ShortArray,
+        loop: IntArray
+    ): Int
+
+    /**
+     * Percentage of samples whose waveform pyramid is ready.
+     */
+    external fun getWaveformProgress(): Int
+
+    /**
+     * Fills [report] with mono, 8-bit and halved sample counts, then bytes before and after
+     */
+    private external fun getDowngradeReport(report: LongArray): Boolean
+
+    fun getDowngradeReport(): DowngradeReport {
+        val r = LongArray(5)
+        if (!getDowngradeReport(r)) {
+            return DowngradeReport()
+        }
+
+        return DowngradeReport(r[0].toInt(), r[1].toInt(), r[2].toInt(), r[3], r[4])
+    }
+
+    /**
+     * Bytes the current module actually holds in memory
+     */
+    external fun getModuleResidentBytes(): Long
+
+    /**
+     * Directory and byte budget for depacked copies of gzip and zip modules, null disables it
+     */
+    external fun setDepackCache(dir: String?, bytes: Long)
+
+    /**
+     * Byte budget for recently played modules kept loaded, see [trimModuleCache]
+     */
+    external fun setModuleCacheBudget(bytes: Long)
+
+    /**
+     * Evict modules not in use until at most [bytes] remain loaded
+     */
+    external fun trimModuleCache(bytes: Long)
+
+    external fun getModuleCacheSize(): Long
+
+    private external fun getProbeLoaders(): Array<String>?
+
+    /**
+     * Fills [stats] with the full scan count and nanoseconds, then tries, hits,
+     * nanoseconds and full scan hits of each loader from [getProbeLoaders]
+     */
+    private external fun getProbeStats(stats: LongArray): Boolean
+
+    /**
+     * Cost of module probing per loader since startup, to tune the magic table
+     */
+    fun getProbeStats(): ProbeStats {
+        val names = getProbeLoaders() ?: return ProbeStats()
+        val s = LongArray(2 + names.size * 4)
+        if (!getProbeStats(s)) {
+            return ProbeStats()
+        }
+
+        val loaders = names.mapIndexed { i, name ->
+            ProbeStat(name, s[2 + i * 4], s[3 + i * 4], s[4 + i * 4], s[5 + i * 4])
+        }
+
+        return ProbeStats(fullScans = s[0], fullScanNanos = s[1], loaders = loaders)
+    }
+
+    private external fun getLoadReport(report: LongArray): Boolean
+
+    /**
+     * Per-phase cost of the last module load
+     */
+    fun getLoadReport(): LoadReport {
+        val r = LongArray(2 + LOAD_PHASES.size * 4)
+        if (!getLoadReport(r)) {
+            return LoadReport()
+        }
+
+        val phases = LOAD_PHASES.mapIndexed { i, name ->
+            LoadPhase(name, r[2 + i * 4], r[3 + i * 4], r[4 + i * 4], r[5 + i * 4])
+        }
+
+        return LoadReport(r[0].toInt(), r[1] != 0L, providerNanos, phases)
+    }
+
+    /**
+     * Step interpolation and DSP quality down while rendering can't keep up, and back up
+     * once it can
+     */
+    external fun setQualityGovernor(enabled: Boolean)
+
+    private external fun getQualitySteps(steps: LongArray): Int
+
+    /**
+     * Current render quality level and load, with the latest quality steps
+     */
+    fun getQualityState(): QualityState {
+        val s = LongArray(3 + QUALITY_HISTORY * 3)
+        val num = getQualitySteps(s)
+        if (num < 0) {
+            return QualityState()
+        }
+
+        val steps = (0 until num).map { i ->
+            QualityStep(s[3 + i * 3], s[4 + i * 3].toInt(), s[5 + i * 3] / 1000f)
+        }
+
+        return QualityState(s[1].toInt(), s[2] / 1000f, s[0], steps)
+    }
+
+    /**
+     * Apply [db] of gain in the output stage, with a peak limiter. 0 disables the stage.
+     */
+    external fun setOutputGain(db: Float)
+
+    /**
+     * Render a sequence offline and measure its loudness into [result]: integrated LUFS
+     * and true peak dBTP. [md5] receives the module MD5. Blocks, the native side owns [fd].
+     */
+    private external fun scanLoudness(
+        fd: Int,
+        member: Int,
+        seq: Int,
+        result: FloatArray,
+        md5: ByteArray
+    ): Int
+
+    external fun cancelLoudnessScan()
+
+    /**
+     * Hash the depacked module file and its loaded content into [result]. Blocks,
+     * the native side owns [fd].
+     */
+    private external fun fingerprintFd(fd: Int, member: Int, result: LongArray): Boolean
+
+    /**
+     * Start the background envelope analysis of [seq] on a private context.
+     * The native side owns [fd] from here on.
+     */
+    private external fun startEnvelope(fd: Int, member: Int, seq: Int, buckets: Int): Int
+
+    external fun stopEnvelope()
+
+    /**
+     * Copy the envelope buckets computed so far. Returns how many are ready,
+     * which reaches the array size when done, or -1 if the analysis failed.
+     */
+    external fun getEnvelope(rms: ShortArray, peak: ShortArray): Int
+
+    /**
+     * Start writing one WAV file per channel of [seq], as 01.wav, 02.wav and so on in
+     * [dir], rendered at [rate] by a pool of private contexts, loaded with the default pan
+     * set by [PLAYER_DEFPAN]. The native side owns [fd] from here on.
+     */
+    private external fun startStems(fd: Int, member: Int, seq: Int, dir: String, rate: Int): Int
+
+    /**
+     * Cancel the stem export in progress, the stems not finished yet are removed
+     */
+    external fun stopStems()
+
+    /**
+     * Percentage of the stem export done, 100 once every file is written, or -1 if it failed
+     */
+    external fun getStemsProgress(): Int
+
     external fun getModType(): String
 
     external fun getModVars(vars: ModVars)
@@ -128,6 +584,19 @@ object Xmp {
         rowFxParm: ByteArray
     )
 
+    /**
+     * Record per-channel scopes of [width] points from the mixer voices while playing,
+     * 0 turns them off. See [getChannelScope].
+     */
+    external fun setChannelScopes(width: Int)
+
+    /**
+     * Scope of channel [chn] as mixed, latency compensated like [getChannelData], into [buffer].
+     * Returns the channel peak from 0 to 32767, or -1 when scopes are off.
+     */
+    @FastNative
+    external fun getChannelScope(chn: Int, buffer: ByteArray): Int
+
     external fun getSampleData(
         trigger: Boolean,
         ins: Int,
@@ -142,6 +611,8 @@ object Xmp {
 
     external fun getVersion(): String
 
+    @JvmStatic
+    @CriticalNative
     external fun getVolume(): Int
 
     external fun nextPosition(): Int
@@ -166,11 +637,18 @@ object Xmp {
      * Test module from File Descriptor
      */
     fun testFromFd(uri: Uri, modInfo: ModInfo = ModInfo()): Boolean {
+        val member = ZipArchive.member(uri)
+        if (member >= 0) {
+            return ZipArchive.open(uri)?.use { it.test(member, modInfo) } ?: false
+        }
+
         val context = XmpApplication.instance!!.applicationContext
+        val start = System.nanoTime()
         val pfd = context.contentResolver.openFileDescriptor(uri, "r")
         val res = if (pfd != null) {
             val fd = pfd.detachFd()
             pfd.close()
+            providerNanos += System.nanoTime() - start
 
             testModuleFd(fd, modInfo)
         } else {
@@ -184,19 +662,22 @@ object Xmp {
     /**
      * Load module from File Descriptor
      */
-    fun loadFromFd(uri: Uri): Int {
+    fun loadFromFd(uri: Uri, budget: Long = 0): Int {
+        providerNanos = 0
         if (!testFromFd(uri)) {
             Timber.d("Load Module: $uri, Result failed")
             return -1
         }
 
         val context = XmpApplication.instance!!.applicationContext
-        val pfd = context.contentResolver.openFileDescriptor(uri, "r")
+        val start = System.nanoTime()
+        val pfd = context.contentResolver.openFileDescriptor(ZipArchive.fileUri(uri), "r")
         val res = if (pfd != null) {
             val fd = pfd.detachFd()
             pfd.close()
+            providerNanos += System.nanoTime() - start
 
-            loadModuleFd(fd)
+            loadModuleFd(fd, ZipArchive.member(uri), budget)
         } else {
             -1
         }
@@ -204,4 +685,77 @@ object Xmp {
         Timber.d("Load Module: Result $res")
         return res
     }
+
+    /**
+     * Request a load of [uri], see [requestModuleFd]. Returns -1 if it can't be opened.
+     */
+    fun requestLoad(uri: Uri, budget: Long = 0): Int {
+        val context = XmpApplication.instance!!.applicationContext
+        val start = System.nanoTime()
+        val pfd = context.contentResolver.openFileDescriptor(ZipArchive.fileUri(uri), "r")
+            ?: return -1
+
+        val fd = pfd.detachFd()
+        pfd.close()
+        providerNanos = System.nanoTime() - start
+
+        return requestModuleFd(fd, ZipArchive.member(uri), budget)
+    }
+
+    /**
+     * Measure the loudness of a module sequence, see [scanLoudness]
+     */
+    fun loudnessFromFd(uri: Uri, seq: Int, result: FloatArray, md5: ByteArray): Boolean {
+        val context = XmpApplication.instance!!.applicationContext
+        val pfd = context.contentResolver.openFileDescriptor(ZipArchive.fileUri(uri), "r")
+            ?: return false
+        val fd = pfd.detachFd()
+        pfd.close()
+
+        return scanLoudness(fd, ZipArchive.member(uri), seq, result, md5) == 0
+    }
+
+    /**
+     * Payload and content hashes of a module, see [fingerprintFd]
+     */
+    fun fingerprintFromFd(uri: Uri, result: LongArray): Boolean {
+        val context = XmpApplication.instance!!.applicationContext
+        val pfd = context.contentResolver.openFileDescriptor(ZipArchive.fileUri(uri), "r")
+            ?: return false
+        val fd = pfd.detachFd()
+        pfd.close()
+
+        return fingerprintFd(fd, ZipArchive.member(uri), result)
+    }
+
+    /**
+     * Analyze the amplitude envelope of a module sequence in the background
+     */
+    fun envelopeFromFd(uri: Uri, seq: Int, buckets: Int): Boolean {
+        val context = XmpApplication.instance!!.applicationContext
+        val pfd = context.contentResolver.openFileDescriptor(ZipArchive.fileUri(uri), "r")
+            ?: return false
+        val fd = pfd.detachFd()
+        pfd.close()
+
+        return startEnvelope(fd, ZipArchive.member(uri), seq, buckets) == 0
+    }
+
+    /**
+     * Export the channels of a module sequence to [dir] in the background, follow it with
+     * [getStemsProgress]
+     */
+    fun stemsFromFd(uri: Uri, seq: Int, dir: File, rate: Int): Boolean {
+        if (!dir.isDirectory && !dir.mkdirs()) {
+            return false
+        }
+
+        val context = XmpApplication.instance!!.applicationContext
+        val pfd = context.contentResolver.openFileDescriptor(ZipArchive.fileUri(uri), "r")
+            ?: return false
+        val fd = pfd.detachFd()
+        pfd.close()
+
+        return startStems(fd, ZipArchive.member(uri), seq, dir.path, rate) == 0
+    }
 }
@@ -3,6 +3,7 @@ package org.helllabs.android.xmp
 import android.app.Application
 import android.net.Uri
 import android.util.Log
+import java.io.File
 import org.helllabs.android.xmp.core.PrefManager
 import org.helllabs.android.xmp.di.ModArchiveModule
 import org.helllabs.android.xmp.di.ModArchiveModuleImpl
@@ -26,6 +27,8 @@ class XmpApplication : Application() {
         }
 
         PrefManager.init(applicationContext)
+
+        Xmp.setDepackCache(File(cacheDir, "depacked").path, DEPACK_CACHE_BYTES)
     }
 
     fun clearFileList() {
@@ -33,6 +36,8 @@ class XmpApplication : Application() {
     }
 
     companion object {
+        private const val DEPACK_CACHE_BYTES = 64L * 1024 * 1024
+
         lateinit var modArchiveModule: ModArchiveModule
 
         @get:Synchronized
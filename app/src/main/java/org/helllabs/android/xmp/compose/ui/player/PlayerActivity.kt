@@ -182,7 +182,10 @@ class PlayerActivity : ComponentActivity() {
                         }
 
                         PlayerSheetEvent.OnMessage -> {
-                            val comment = String(Xmp.getComment(), StandardCharsets.UTF_8)
+                            val comment = String(
+                                viewModel.metadata.value.comment,
+                                StandardCharsets.UTF_8
+                            )
                             if (comment.isEmpty()) {
                                 lifecycleScope.launch {
                                     val msg = "No comment to display"
@@ -260,11 +263,6 @@ class PlayerActivity : ComponentActivity() {
                     viewModel.resetPlayTime()
 
                     while (true) {
-                        if (viewModel.activityState.value.playTime < 0) {
-                            Timber.i("Stop update")
-                            break
-                        }
-
                         if ((!viewModel.uiState.value.screenOn || !viewModel.isPlaying) ||
                             modPlayer == null
                         ) {
@@ -278,26 +276,27 @@ class PlayerActivity : ComponentActivity() {
                             continue
                         }
 
-                        // Update ViewerInfo()
+                        // Update ViewerInfo(), channel data changes every frame
                         viewModel.updateViewInfo()
 
-                        // Get the current playback time
-                        viewModel.setPlayTime(Xmp.time().div(100F))
-
-                        // Update the seekbar for the current time
-                        viewModel.updateSeekBar()
-
-                        // Update playback and total-playback time
-                        viewModel.updateInfoTime()
-
-                        // Update Speed, Bpm, Pos, Pat
-                        viewModel.updateInfoState()
+                        if (Xmp.time() < 0) {
+                            Timber.i("Stop update")
+                            break
+                        }
 
                         delay(33.milliseconds)
                     }
                 }
             }
 
+            // Time, position, row and tempo only change the screen when the player reports a
+            // change, applied when it is heard rather than when it was rendered
+            LaunchedEffect(uiState.infoTitle, uiState.infoType) {
+                launch(Dispatchers.IO) {
+                    viewModel.consumeEvents { viewModel.uiState.value.screenOn && modPlayer != null }
+                }
+            }
+
             XmpTheme {
                 // Hoisted here because of native jni call.
                 MessageDialog(
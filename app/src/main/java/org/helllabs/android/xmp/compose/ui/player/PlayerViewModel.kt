@@ -3,15 +3,28 @@ package org.helllabs.android.xmp.compose.ui.player
 import android.net.Uri
 import androidx.compose.runtime.*
 import androidx.lifecycle.ViewModel
-import java.util.Collections
+import androidx.lifecycle.viewModelScope
+import kotlinx.coroutines.Dispatchers
+import kotlinx.coroutines.Job
+import kotlin.time.Duration.Companion.nanoseconds
+import kotlinx.coroutines.cancelAndJoin
+import kotlinx.coroutines.currentCoroutineContext
+import kotlinx.coroutines.delay
 import kotlinx.coroutines.flow.MutableStateFlow
 import kotlinx.coroutines.flow.asStateFlow
 import kotlinx.coroutines.flow.update
+import kotlinx.coroutines.isActive
+import kotlinx.coroutines.launch
+import kotlinx.coroutines.sync.Mutex
+import kotlinx.coroutines.sync.withLock
 import org.helllabs.android.xmp.Xmp
+import org.helllabs.android.xmp.core.MetadataCache
 import org.helllabs.android.xmp.model.ChannelInfo
 import org.helllabs.android.xmp.model.FrameInfo
+import org.helllabs.android.xmp.model.ModMetadata
 import org.helllabs.android.xmp.model.ModVars
-import org.helllabs.android.xmp.model.SequenceVars
+import org.helllabs.android.xmp.model.RenderEvent
+import org.helllabs.android.xmp.model.SongEnvelope
 import org.helllabs.android.xmp.service.PlayerService
 import timber.log.Timber
 
@@ -47,7 +60,8 @@ data class PlayerTimeState(
     val seekPos: Float = 0f,
     val seekMax: Float = 1f,
     val isVisible: Boolean = true,
-    val isSeeking: Boolean = false
+    val isSeeking: Boolean = false,
+    val envelope: SongEnvelope = SongEnvelope()
 )
 
 @Stable
@@ -86,6 +100,17 @@ data class ChannelMuteState(val isMuted: BooleanArray = BooleanArray(Xmp.MAX_CHA
 @Stable
 class PlayerViewModel : ViewModel() {
 
+    companion object {
+        private const val ENVELOPE_BUCKETS = 256
+        private const val ENVELOPE_POLL_MS = 250L
+
+        // Longest wait for playback events before checking the screen state again
+        private const val EVENT_WAIT_MS = 500
+
+        // Xmp.awaitEvents has a single consumer, whatever the activity or module
+        private val eventsMutex = Mutex()
+    }
+
     private val _activityState = MutableStateFlow(PlayerActivityState())
     val activityState = _activityState.asStateFlow()
 
@@ -109,7 +134,7 @@ class PlayerViewModel : ViewModel() {
         get() = _buttonState.value.isPlaying
 
     /** Viewer Variables **/
-    private val seqVars = MutableStateFlow(SequenceVars())
+    val metadata = MutableStateFlow(ModMetadata())
 
     val insName = MutableStateFlow(arrayOf(""))
 
@@ -122,6 +147,9 @@ class PlayerViewModel : ViewModel() {
 
     val channelInfo = MutableStateFlow(ChannelInfo())
 
+    private var envelopeJob: Job? = null
+    private var envelopeUri: Uri = Uri.EMPTY
+
     /** Player Functions **/
 
     fun onConnected(value: Boolean) {
@@ -187,32 +215,86 @@ class PlayerViewModel : ViewModel() {
             it.copy(currentSequence = modVars.value.currentSequence)
         }
 
+        loadEnvelope(modVars.value.currentSequence)
+
         showSnack(time)
     }
 
+    /**
+     * Seek bar envelope for a sequence, from the metadata cache or analyzed in the background
+     */
+    private fun loadEnvelope(sequence: Int) {
+        val uri = envelopeUri
+        val md5 = metadata.value.md5
+        val previous = envelopeJob
+
+        _timeState.update { it.copy(envelope = SongEnvelope()) }
+
+        envelopeJob = viewModelScope.launch(Dispatchers.IO) {
+            previous?.cancelAndJoin()
+
+            val name = "envelope-$sequence"
+            val cached = MetadataCache.read(md5, name)?.let { SongEnvelope.fromBytes(it) }
+            if (cached != null) {
+                _timeState.update { it.copy(envelope = cached) }
+                return@launch
+            }
+
+            if (uri == Uri.EMPTY || !Xmp.envelopeFromFd(uri, sequence, ENVELOPE_BUCKETS)) {
+                return@launch
+            }
+
+            val rms = ShortArray(ENVELOPE_BUCKETS)
+            val peak = ShortArray(ENVELOPE_BUCKETS)
+            try {
+                while (isActive) {
+                    val ready = Xmp.getEnvelope(rms, peak)
+                    if (ready < 0) {
+                        Timber.w("Envelope analysis failed")
+                        break
+                    }
+
+                    val envelope = SongEnvelope(rms.copyOf(), peak.copyOf(), ready)
+                    _timeState.update { it.copy(envelope = envelope) }
+
+                    if (envelope.isComplete) {
+                        MetadataCache.write(md5, name, envelope.toBytes())
+                        break
+                    }
+
+                    delay(ENVELOPE_POLL_MS)
+                }
+            } finally {
+                Xmp.stopEnvelope()
+            }
+        }
+    }
+
     fun showNewMod(modPlayer: PlayerService, skipToPrevious: Boolean) {
         Timber.i("Show new module | Previous: $skipToPrevious")
 
-        val mVars = ModVars()
-        Xmp.getModVars(mVars)
+        // One native call for everything the player screen shows about the module
+        val meta = ModMetadata.parse(Xmp.getModMetadata()) ?: ModMetadata()
+        metadata.update { meta }
+
+        val mVars = meta.toModVars()
         modVars.update { mVars }
 
-        val sVars = SequenceVars()
-        Xmp.getSeqVars(sVars)
-        seqVars.update { sVars }
+        envelopeUri = modPlayer.getFileUri()
+        loadEnvelope(0)
 
         _drawerState.update {
             it.copy(
                 moduleInfo = listOf(
-                    modVars.value.numPatterns,
-                    modVars.value.numInstruments,
-                    modVars.value.numSamples,
-                    modVars.value.numChannels,
-                    modVars.value.lengthInPatterns
+                    mVars.numPatterns,
+                    mVars.numInstruments,
+                    mVars.numSamples,
+                    mVars.numChannels,
+                    mVars.lengthInPatterns
                 ),
                 isPlayAllSequences = modPlayer.playAllSequences,
                 currentSequence = 0,
-                numOfSequences = seqVars.value.sequence.toList()
+                numOfSequences = meta.sequences.map { it.duration }
             )
         }
 
@@ -232,26 +314,19 @@ class PlayerViewModel : ViewModel() {
 
         toggleLoop(modPlayer.isRepeating)
 
-        val name: String = Xmp.getModName().trim().ifEmpty { modPlayer.getFileName() }
-        val type: String = Xmp.getModType()
+        val name: String = meta.name.trim().ifEmpty { modPlayer.getFileName() }
         _uiState.update {
             it.copy(
                 infoTitle = name,
-                infoType = type,
+                infoType = meta.type,
                 skipToPrevious = skipToPrevious
             )
         }
 
         if (_uiState.value.serviceConnected) {
-            Xmp.getModVars(modVars.value)
-            Xmp.getSeqVars(seqVars.value)
+            insName.update { meta.instrumentNames() }
 
-            insName.update {
-                Xmp.getInstruments()
-                    ?: Collections.nCopies(modVars.value.numInstruments, "").toTypedArray()
-            }
-
-            val muteArray = BooleanArray(modVars.value.numChannels) { i ->
+            val muteArray = BooleanArray(mVars.numChannels) { i ->
                 Xmp.mute(i, -1) == 1
             }
             _isMuted.update { it.copy(isMuted = muteArray) }
@@ -300,8 +375,8 @@ class PlayerViewModel : ViewModel() {
         }
     }
 
-    fun updateInfoTime() {
-        val time = Xmp.time() / 1000
+    fun updateInfoTime(timeMs: Int = Xmp.time()) {
+        val time = timeMs / 1000
 
         _timeState.update {
             it.copy(
@@ -322,6 +397,76 @@ class PlayerViewModel : ViewModel() {
         }
     }
 
+    /**
+     * Read the frame info and time again, when starting to follow events or after missing some
+     */
+    fun syncFrameInfo() {
+        val fi = FrameInfo()
+        Xmp.getInfo(fi)
+        frameInfo.update { fi }
+
+        val time = Xmp.time()
+        if (time >= 0) {
+            setPlayTime(time / 100F)
+            updateSeekBar()
+            updateInfoTime(time)
+        }
+
+        updateInfoState()
+    }
+
+    /**
+     * Apply playback changes as they are heard until cancelled, while [isShown]. A loop
+     * started before, for the previous module or activity, is woken from its wait and
+     * finishes first.
+     */
+    suspend fun consumeEvents(isShown: () -> Boolean) {
+        Xmp.wakeEvents()
+
+        eventsMutex.withLock {
+            syncFrameInfo()
+
+            while (currentCoroutineContext().isActive) {
+                if (!isShown()) {
+                    delay(EVENT_WAIT_MS.toLong())
+                    continue
+                }
+
+                Xmp.awaitEvents(EVENT_WAIT_MS).forEach { event ->
+                    val wait = event.pts - System.nanoTime()
+                    if (wait > 0) {
+                        delay(wait.nanoseconds)
+                    }
+                    onRenderEvent(event)
+                }
+            }
+        }
+    }
+
+    /**
+     * Apply a playback change from [Xmp.awaitEvents], once it is heard
+     */
+    private fun onRenderEvent(event: RenderEvent) {
+        when (event.type) {
+            Xmp.EVENT_POSITION -> frameInfo.update { it.copy(pos = event.a, pattern = event.b) }
+            Xmp.EVENT_ROW -> frameInfo.update { it.copy(row = event.a, numRows = event.b) }
+            Xmp.EVENT_TEMPO -> frameInfo.update { it.copy(speed = event.a, bpm = event.b) }
+            Xmp.EVENT_TIME -> {
+                setPlayTime(event.b / 100F)
+                updateSeekBar()
+                updateInfoTime(event.b)
+                return
+            }
+            Xmp.EVENT_OVERFLOW -> {
+                syncFrameInfo()
+                return
+            }
+            else -> return
+        }
+
+        updateInfoState()
+    }
+
     private val lock = Any() // Meh
     fun updateViewInfo() {
         synchronized(lock) {
@@ -331,12 +476,6 @@ class PlayerViewModel : ViewModel() {
                 ci
             }
 
-            val fi = FrameInfo()
-            Xmp.getInfo(fi)
-            frameInfo.update {
-                fi
-            }
-
             val muteArray = BooleanArray(modVars.value.numChannels) {
                 Xmp.mute(it, -1) == 1
             }
@@ -4,17 +4,53 @@ import androidx.compose.foundation.layout.*
 import androidx.compose.material3.*
 import androidx.compose.runtime.*
 import androidx.compose.ui.*
+import androidx.compose.ui.draw.*
+import androidx.compose.ui.geometry.*
+import androidx.compose.ui.graphics.*
 import androidx.compose.ui.text.font.*
 import androidx.compose.ui.tooling.preview.*
 import androidx.compose.ui.unit.*
 import org.helllabs.android.xmp.compose.theme.XmpTheme
 import org.helllabs.android.xmp.compose.ui.player.PlayerTimeState
+import org.helllabs.android.xmp.model.SongEnvelope
 
 @Stable
 sealed class SeekEvent {
     data class OnSeek(val isSeeking: Boolean, val value: Float) : SeekEvent()
 }
 
+/**
+ * Draw the song envelope as mirrored bars, peak faint and RMS on top
+ */
+private fun Modifier.envelope(envelope: SongEnvelope, color: Color): Modifier = drawBehind {
+    if (envelope.size == 0) {
+        return@drawBehind
+    }
+
+    // Keep in line with the slider track, which is inset by the thumb
+    val inset = 10.dp.toPx()
+    val width = size.width - inset * 2
+    val barWidth = width / envelope.size
+    val mid = size.height / 2
+
+    for (i in 0 until envelope.ready) {
+        val x = inset + i * barWidth
+        val peak = envelope.peak[i] / 32768f * mid
+        val rms = envelope.rms[i] / 32768f * mid
+
+        drawRect(
+            color = color.copy(alpha = 0.25f),
+            topLeft = Offset(x, mid - peak),
+            size = Size(barWidth, peak * 2)
+        )
+        drawRect(
+            color = color.copy(alpha = 0.5f),
+            topLeft = Offset(x, mid - rms),
+            size = Size(barWidth, rms * 2)
+        )
+    }
+}
+
 @Composable
 fun PlayerSeekBar(
     state: PlayerTimeState,
@@ -36,7 +72,8 @@ fun PlayerSeekBar(
         Slider(
             modifier = Modifier
                 .fillMaxWidth(.8f)
-                .height(20.dp),
+                .height(20.dp)
+                .envelope(state.envelope, MaterialTheme.colorScheme.primary),
             value = if (state.isSeeking) newPosition.floatValue else state.seekPos,
             valueRange = 0f..state.seekMax,
             onValueChange = {
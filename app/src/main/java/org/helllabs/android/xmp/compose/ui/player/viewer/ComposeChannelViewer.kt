@@ -22,6 +22,7 @@ import org.helllabs.android.xmp.compose.theme.XmpTheme
 import org.helllabs.android.xmp.compose.theme.michromaFontFamily
 import org.helllabs.android.xmp.compose.theme.seed
 import org.helllabs.android.xmp.compose.ui.player.ChannelMuteState
+import org.helllabs.android.xmp.core.PrefManager
 import org.helllabs.android.xmp.model.ChannelInfo
 import org.helllabs.android.xmp.model.FrameInfo
 import org.helllabs.android.xmp.model.ModVars
@@ -75,6 +76,9 @@ fun ComposeChannelViewer(
     val buffer = remember {
         ByteArray(Xmp.MAX_BUFFERS)
     }
+    val useScopes = remember {
+        !view.isInEditMode && PrefManager.channelScopes
+    }
     val isChnMuted = remember(isMuted) {
         // Need this to keep pointerInput updated for any changes.
         isMuted.isMuted
@@ -193,6 +197,13 @@ fun ComposeChannelViewer(
                 }
             }
 
+            // Mixer scopes already carry the final volume, peak is -1 without them
+            val peak = if (useScopes && !isChnMuted[chn] && PlayerService.isAlive.value) {
+                Xmp.getChannelScope(chn, buffer)
+            } else {
+                -1
+            }
+
             /***** Channel Number *****/
             val chnText = textMeasurer.measure(
                 text = AnnotatedString(channelNumber[chn]),
@@ -255,7 +266,11 @@ fun ComposeChannelViewer(
                 size = Size((barWidth * (vol.toFloat() / 64)), 16f)
             )
 
-            val fVol = if (isChnMuted[chn]) 0 else channelInfo.finalVols[chn]
+            val fVol = when {
+                isChnMuted[chn] -> 0
+                peak >= 0 -> peak * 64 / 32767
+                else -> channelInfo.finalVols[chn]
+            }
             drawRect(
                 color = seed,
                 topLeft = Offset(
@@ -324,7 +339,7 @@ fun ComposeChannelViewer(
                     )
                 )
             } else {
-                if (PlayerService.isAlive.value) {
+                if (peak < 0 && PlayerService.isAlive.value) {
                     // Be very careful here!
                     // Our variables are latency-compensated but sample data is current
                     // so caution is needed to avoid retrieving data using old variables
@@ -386,12 +401,18 @@ fun ComposeChannelViewer(
                 val maxVal = buffer.maxOrNull()?.toFloat() ?: 127f
                 val minVal = buffer.minOrNull()?.toFloat() ?: -128f
                 val range = maxVal - minVal
-                val volumeScale = channelInfo.finalVols[chn].coerceIn(0, 64) / 64f
+                val volumeScale = if (peak >= 0) {
+                    1f
+                } else {
+                    channelInfo.finalVols[chn].coerceIn(0, 64) / 64f
+                }
                 val widthScale = scopeWidth / buffer.size
                 val xValues = FloatArray(buffer.size) { index -> scopeXOffset + widthScale * index }
                 buffer.forEachIndexed { index, byteValue ->
                     val x = xValues[index]
-                    val normalizedValue = if (byteValue == 0.toByte()) {
+                    val normalizedValue = if (peak >= 0) {
+                        byteValue / 128f
+                    } else if (byteValue == 0.toByte()) {
                         0f
                     } else {
                         ((byteValue - minVal) / range - 0.5f) * 2f
@@ -6,6 +6,7 @@ import androidx.compose.ui.res.stringResource
 import com.alorma.compose.settings.ui.SettingsGroup
 import com.alorma.compose.settings.ui.SettingsSwitch
 import org.helllabs.android.xmp.R
+import org.helllabs.android.xmp.Xmp
 import org.helllabs.android.xmp.core.PrefManager
 
 @Composable
@@ -33,6 +34,17 @@ fun SettingsGroupInterface() {
                 PrefManager.keepScreenOn = it
             }
         )
+        var channelScopes by remember { mutableStateOf(PrefManager.channelScopes) }
+        SettingsSwitch(
+            title = { Text(text = stringResource(id = R.string.pref_channel_scopes_title)) },
+            subtitle = { Text(text = stringResource(id = R.string.pref_channel_scopes_summary)) },
+            state = channelScopes,
+            onCheckedChange = {
+                channelScopes = it
+                PrefManager.channelScopes = it
+                Xmp.setChannelScopes(if (it) Xmp.MAX_BUFFERS else 0)
+            }
+        )
         var showHex by remember { mutableStateOf(PrefManager.showHex) }
         SettingsSwitch(
             title = { Text(text = "Show hex values") },
@@ -89,6 +89,17 @@ fun SettingsGroupPlaylist(
             }
         )
 
+        var skipDuplicates by remember { mutableStateOf(PrefManager.skipDuplicates) }
+        SettingsSwitch(
+            title = { Text(text = stringResource(id = R.string.pref_skip_duplicates_title)) },
+            subtitle = { Text(text = stringResource(id = R.string.pref_skip_duplicates_summary)) },
+            state = skipDuplicates,
+            onCheckedChange = {
+                PrefManager.skipDuplicates = it
+                skipDuplicates = it
+            }
+        )
+
         var backButton by remember { mutableStateOf(PrefManager.backButtonNavigation) }
         SettingsSwitch(
             title = {
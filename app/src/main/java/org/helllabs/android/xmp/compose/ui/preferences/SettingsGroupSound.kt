@@ -11,6 +11,7 @@ import com.alorma.compose.settings.ui.SettingsMenuLink
 import com.alorma.compose.settings.ui.SettingsSlider
 import com.alorma.compose.settings.ui.SettingsSwitch
 import org.helllabs.android.xmp.R
+import org.helllabs.android.xmp.Xmp
 import org.helllabs.android.xmp.compose.components.SingleChoiceListDialog
 import org.helllabs.android.xmp.core.PrefManager
 import org.helllabs.android.xmp.service.PlayerService
@@ -128,6 +129,55 @@ fun SettingsGroupSound() {
             }
         )
 
+        var normalizeLoudness by remember { mutableStateOf(PrefManager.normalizeLoudness) }
+        SettingsSwitch(
+            title = { Text(text = stringResource(id = R.string.pref_normalize_loudness_title)) },
+            subtitle = {
+                Text(text = stringResource(id = R.string.pref_normalize_loudness_summary))
+            },
+            state = normalizeLoudness,
+            onCheckedChange = {
+                PrefManager.normalizeLoudness = it
+                normalizeLoudness = it
+            }
+        )
+
+        var limitMemory by remember { mutableStateOf(PrefManager.limitModuleMemory) }
+        SettingsSwitch(
+            title = { Text(text = stringResource(id = R.string.pref_limit_memory_title)) },
+            subtitle = { Text(text = stringResource(id = R.string.pref_limit_memory_summary)) },
+            state = limitMemory,
+            onCheckedChange = {
+                PrefManager.limitModuleMemory = it
+                limitMemory = it
+            }
+        )
+
+        var lockMemory by remember { mutableStateOf(PrefManager.lockAudioMemory) }
+        SettingsSwitch(
+            title = { Text(text = stringResource(id = R.string.pref_lock_memory_title)) },
+            subtitle = { Text(text = stringResource(id = R.string.pref_lock_memory_summary)) },
+            state = lockMemory,
+            onCheckedChange = {
+                PrefManager.lockAudioMemory = it
+                lockMemory = it
+            }
+        )
+
+        var adaptiveQuality by remember { mutableStateOf(PrefManager.adaptiveQuality) }
+        SettingsSwitch(
+            title = { Text(text = stringResource(id = R.string.pref_adaptive_quality_title)) },
+            subtitle = {
+                Text(text = stringResource(id = R.string.pref_adaptive_quality_summary))
+            },
+            state = adaptiveQuality,
+            onCheckedChange = {
+                PrefManager.adaptiveQuality = it
+                adaptiveQuality = it
+                Xmp.setQualityGovernor(it)
+            }
+        )
+
         var interpolate by remember { mutableStateOf(PrefManager.interpolate) }
         SettingsSwitch(
             title = { Text(text = stringResource(id = R.string.pref_interpolate_title)) },
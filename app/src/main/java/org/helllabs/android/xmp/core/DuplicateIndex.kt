@@ -0,0 +1,82 @@
+package org.helllabs.android.xmp.core
+
+import android.net.Uri
+import kotlinx.coroutines.Dispatchers
+import kotlinx.coroutines.channels.Channel
+import kotlinx.coroutines.coroutineScope
+import kotlinx.coroutines.ensureActive
+import kotlinx.coroutines.launch
+import org.helllabs.android.xmp.Xmp
+import org.helllabs.android.xmp.model.Fingerprint
+import timber.log.Timber
+
+/**
+ * Content hashes of module files, kept per file in the [MetadataCache] to find duplicates
+ * under other names and packings
+ */
+object DuplicateIndex {
+
+    private const val FINGERPRINT = "fingerprint"
+
+    fun cached(uri: Uri): Fingerprint? =
+        MetadataCache.read(MetadataCache.uriKey(uri), FINGERPRINT)?.let { Fingerprint.fromBytes(it) }
+
+    /**
+     * Hash one file on the calling thread
+     */
+    fun scan(uri: Uri): Fingerprint? {
+        val result = LongArray(2)
+        if (!Xmp.fingerprintFromFd(uri, result)) {
+            return null
+        }
+
+        val fingerprint = Fingerprint(uri, payload = result[0], content = result[1])
+        MetadataCache.write(MetadataCache.uriKey(uri), FINGERPRINT, fingerprint.toBytes())
+
+        Timber.d("Fingerprint $uri: %016x %016x", result[0], result[1])
+        return fingerprint
+    }
+
+    /**
+     * Hash every file not hashed yet, one worker per core. Each native job works on
+     * its own context, so workers share nothing.
+     */
+    suspend fun scanAll(uris: List<Uri>) = coroutineScope {
+        val queue = Channel<Uri>(Channel.UNLIMITED)
+        uris.filter { cached(it) == null }.forEach { queue.trySend(it) }
+        queue.close()
+
+        repeat(Runtime.getRuntime().availableProcessors()) {
+            launch(Dispatchers.Default) {
+                for (uri in queue) {
+                    ensureActive()
+                    scan(uri)
+                }
+            }
+        }
+    }
+
+    /**
+     * Groups of files holding the same song, among every file hashed so far
+     */
+    fun duplicates(): List<List<Uri>> =
+        MetadataCache.entries(FINGERPRINT)
+            .mapNotNull { Fingerprint.fromBytes(it) }
+            .groupBy { if (it.content != 0L) it.content else it.payload }
+            .values
+            .filter { it.size > 1 }
+            .map { group -> group.map { it.uri } }
+
+    /**
+     * Drop files whose song is already earlier in the list. Files not hashed yet are kept.
+     */
+    fun <T> distinct(list: List<T>, uri: (T) -> Uri?): List<T> {
+        val seen = mutableSetOf<Long>()
+
+        return list.filter { item ->
+            val fingerprint = uri(item)?.let { cached(it) } ?: return@filter true
+            val key = if (fingerprint.content != 0L) fingerprint.content else fingerprint.payload
+            seen.add(key)
+        }
+    }
+}
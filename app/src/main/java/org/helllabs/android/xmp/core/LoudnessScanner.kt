@@ -0,0 +1,89 @@
+package org.helllabs.android.xmp.core
+
+import android.net.Uri
+import kotlinx.coroutines.Dispatchers
+import kotlinx.coroutines.channels.Channel
+import kotlinx.coroutines.coroutineScope
+import kotlinx.coroutines.ensureActive
+import kotlinx.coroutines.launch
+import org.helllabs.android.xmp.Xmp
+import org.helllabs.android.xmp.model.Loudness
+import timber.log.Timber
+
+/**
+ * Per-module loudness, scanned natively on private contexts and kept in the [MetadataCache]
+ */
+object LoudnessScanner {
+
+    // ReplayGain 2.0 reference level
+    private const val TARGET_LUFS = -18f
+    private const val MAX_GAIN_DB = 12f
+
+    // Maps a file to its module MD5, so a library scan can skip known files without loading them
+    private const val MODULE = "module"
+
+    private fun name(sequence: Int) = "loudness-$sequence"
+
+    private fun ByteArray.toHex(): String = joinToString("") { "%02x".format(it) }
+
+    fun cached(md5: String, sequence: Int): Loudness? =
+        MetadataCache.read(md5, name(sequence))?.let { Loudness.fromBytes(it) }
+
+    /**
+     * Output gain in dB that brings a module to the target loudness
+     */
+    fun gain(loudness: Loudness): Float {
+        if (loudness.integrated <= Xmp.LOUDNESS_SILENCE) {
+            return 0f
+        }
+
+        return (TARGET_LUFS - loudness.integrated).coerceIn(-MAX_GAIN_DB, MAX_GAIN_DB)
+    }
+
+    /**
+     * Scan one sequence on the calling thread. Returns the module MD5 and its loudness.
+     */
+    fun scan(uri: Uri, sequence: Int): Pair<String, Loudness>? {
+        val result = FloatArray(2)
+        val md5 = ByteArray(16)
+
+        if (!Xmp.loudnessFromFd(uri, sequence, result, md5)) {
+            return null
+        }
+
+        val key = md5.toHex()
+        val loudness = Loudness(integrated = result[0], truePeak = result[1])
+
+        MetadataCache.write(key, name(sequence), loudness.toBytes())
+        MetadataCache.write(MetadataCache.uriKey(uri), MODULE, key.toByteArray())
+
+        Timber.d("Loudness $uri: ${loudness.integrated} LUFS, ${loudness.truePeak} dBTP")
+        return key to loudness
+    }
+
+    /**
+     * Scan the first sequence of every file not scanned yet, one worker per core.
+     * Each native scan loads its own context, so workers share nothing.
+     * Native scans don't see coroutine cancellation, pair it with [cancelAll].
+     */
+    suspend fun scanAll(uris: List<Uri>) = coroutineScope {
+        val queue = Channel<Uri>(Channel.UNLIMITED)
+        uris.filter { MetadataCache.read(MetadataCache.uriKey(it), MODULE) == null }
+            .forEach { queue.trySend(it) }
+        queue.close()
+
+        repeat(Runtime.getRuntime().availableProcessors()) {
+            launch(Dispatchers.Default) {
+                for (uri in queue) {
+                    ensureActive()
+                    scan(uri, 0)
+                }
+            }
+        }
+    }
+
+    /**
+     * Abort every scan in progress
+     */
+    fun cancelAll() = Xmp.cancelLoudnessScan()
+}
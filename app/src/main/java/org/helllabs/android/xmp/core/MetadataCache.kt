@@ -0,0 +1,119 @@
+package org.helllabs.android.xmp.core
+
+import android.net.Uri
+import java.io.File
+import java.security.MessageDigest
+import org.helllabs.android.xmp.XmpApplication
+import timber.log.Timber
+
+/**
+ * On-disk cache of things computed once per module, keyed by the module MD5.
+ * Lives under the cache dir, so the system may clear it at any time. Kept
+ * under [MAX_BYTES] by dropping the least recently used keys on write.
+ */
+object MetadataCache {
+
+    private const val MAX_BYTES = 16L * 1024 * 1024
+
+    // Bytes on disk, counted on the first write and kept up to date after
+    private var total = -1L
+
+    private val cacheDir: File?
+        get() = XmpApplication.instance?.cacheDir?.let { File(it, "metadata") }
+
+    private fun file(md5: String, name: String): File? {
+        if (md5.isEmpty()) {
+            return null
+        }
+
+        return cacheDir?.let { File(File(it, md5), name) }
+    }
+
+    /**
+     * Key for things stored per file rather than per module
+     */
+    fun uriKey(uri: Uri): String =
+        "uri-" + MessageDigest.getInstance("MD5").digest(uri.toString().toByteArray())
+            .joinToString("") { "%02x".format(it) }
+
+    /**
+     * Every entry called [name], whatever its key
+     */
+    fun entries(name: String): List<ByteArray> {
+        val dirs = cacheDir?.listFiles() ?: return listOf()
+
+        return dirs.mapNotNull { dir -> read(dir.name, name) }
+    }
+
+    fun read(md5: String, name: String): ByteArray? {
+        val file = file(md5, name) ?: return null
+
+        return try {
+            if (file.exists()) {
+                // The key's mtime orders keys for eviction
+                file.parentFile?.setLastModified(System.currentTimeMillis())
+                file.readBytes()
+            } else {
+                null
+            }
+        } catch (e: Exception) {
+            Timber.w("Metadata cache: can't read $name: ${e.message}")
+            null
+        }
+    }
+
+    fun write(md5: String, name: String, data: ByteArray) {
+        val file = file(md5, name) ?: return
+
+        try {
+            file.parentFile?.mkdirs()
+
+            // Write aside and rename, a reader never sees a partial entry. Each writer
+            // gets its own temp file, so two writes of a key can't interleave in one.
+            val tmp = File.createTempFile("$name.", ".tmp", file.parentFile)
+            val old = file.length()
+            try {
+                tmp.writeBytes(data)
+                tmp.renameTo(file)
+            } finally {
+                tmp.delete()
+            }
+            file.parentFile?.setLastModified(System.currentTimeMillis())
+
+            trim(data.size - old)
+        } catch (e: Exception) {
+            Timber.w("Metadata cache: can't write $name: ${e.message}")
+        }
+    }
+
+    /**
+     * Account for [growth] bytes written and drop the oldest keys while over the cap
+     */
+    @Synchronized
+    private fun trim(growth: Long) {
+        if (total < 0) {
+            total = cacheDir?.listFiles()?.sumOf { size(it) } ?: return
+        } else {
+            total += growth
+        }
+
+        if (total <= MAX_BYTES) {
+            return
+        }
+
+        // Recount, the system may have cleared entries behind our back
+        val dirs = cacheDir?.listFiles() ?: return
+        total = dirs.sumOf { size(it) }
+
+        dirs.sortedBy { it.lastModified() }.forEach { dir ->
+            if (total <= MAX_BYTES) {
+                return
+            }
+
+            total -= size(dir)
+            dir.deleteRecursively()
+        }
+    }
+
+    private fun size(dir: File): Long = dir.listFiles()?.sumOf { it.length() } ?: 0L
+}
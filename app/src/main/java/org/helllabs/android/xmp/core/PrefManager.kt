@@ -212,6 +212,48 @@ object PrefManager {
             setPref(AMIGA_MIXER, value)
         }
 
+    private val LIMIT_MODULE_MEMORY = booleanPreferencesKey("limit_module_memory")
+    var limitModuleMemory: Boolean
+        get() = getPref(LIMIT_MODULE_MEMORY, true)
+        set(value) {
+            setPref(LIMIT_MODULE_MEMORY, value)
+        }
+
+    private val LOCK_AUDIO_MEMORY = booleanPreferencesKey("lock_audio_memory")
+    var lockAudioMemory: Boolean
+        get() = getPref(LOCK_AUDIO_MEMORY, false)
+        set(value) {
+            setPref(LOCK_AUDIO_MEMORY, value)
+        }
+
+    private val ADAPTIVE_QUALITY = booleanPreferencesKey("adaptive_quality")
+    var adaptiveQuality: Boolean
+        get() = getPref(ADAPTIVE_QUALITY, true)
+        set(value) {
+            setPref(ADAPTIVE_QUALITY, value)
+        }
+
+    private val NORMALIZE_LOUDNESS = booleanPreferencesKey("normalize_loudness")
+    var normalizeLoudness: Boolean
+        get() = getPref(NORMALIZE_LOUDNESS, false)
+        set(value) {
+            setPref(NORMALIZE_LOUDNESS, value)
+        }
+
+    private val SKIP_DUPLICATES = booleanPreferencesKey("skip_duplicates")
+    var skipDuplicates: Boolean
+        get() = getPref(SKIP_DUPLICATES, false)
+        set(value) {
+            setPref(SKIP_DUPLICATES, value)
+        }
+
+    private val CHANNEL_SCOPES = booleanPreferencesKey("channel_scopes")
+    var channelScopes: Boolean
+        get() = getPref(CHANNEL_SCOPES, false)
+        set(value) {
+            setPref(CHANNEL_SCOPES, value)
+        }
+
     private val SEARCH_HISTORY = stringPreferencesKey("search_history")
     var searchHistory: List<Module>
         get() {
@@ -0,0 +1,70 @@
+package org.helllabs.android.xmp.core
+
+import android.net.Uri
+import java.io.Closeable
+import org.helllabs.android.xmp.Xmp
+import org.helllabs.android.xmp.XmpApplication
+import org.helllabs.android.xmp.model.ModInfo
+
+/**
+ * A zip archive of modules, indexed natively without extracting it. Members are addressed
+ * as the archive [Uri] with an `entry=<index>` fragment, which [Xmp] opens like a module file.
+ */
+class ZipArchive private constructor(private var handle: Long) : Closeable {
+
+    val entries: List<String> = Xmp.getArchiveEntries(handle)?.toList().orEmpty()
+
+    fun test(index: Int, modInfo: ModInfo = ModInfo()): Boolean =
+        handle != 0L && Xmp.testArchiveEntry(handle, index, modInfo)
+
+    /**
+     * Every member that is a module, as member uris of [uri]
+     */
+    fun modules(uri: Uri): List<Pair<Uri, ModInfo>> = entries.indices.mapNotNull { i ->
+        val modInfo = ModInfo()
+        if (!test(i, modInfo)) {
+            return@mapNotNull null
+        }
+
+        val info = modInfo.copy(name = modInfo.name.ifEmpty { entries[i].substringAfterLast('/') })
+        memberUri(uri, i) to info
+    }
+
+    override fun close() {
+        if (handle != 0L) {
+            Xmp.closeArchive(handle)
+            handle = 0L
+        }
+    }
+
+    companion object {
+        private const val ENTRY = "entry="
+
+        fun isArchive(uri: Uri): Boolean =
+            member(uri) < 0 && uri.lastPathSegment.orEmpty().endsWith(".zip", ignoreCase = true)
+
+        fun memberUri(uri: Uri, index: Int): Uri = uri.buildUpon().fragment("$ENTRY$index").build()
+
+        /**
+         * Member index of a member uri, -1 for anything else
+         */
+        fun member(uri: Uri): Int =
+            uri.fragment?.takeIf { it.startsWith(ENTRY) }?.removePrefix(ENTRY)?.toIntOrNull() ?: -1
+
+        /**
+         * The file a uri refers to, the archive itself for member uris
+         */
+        fun fileUri(uri: Uri): Uri =
+            if (member(uri) >= 0) uri.buildUpon().fragment(null).build() else uri
+
+        fun open(uri: Uri): ZipArchive? {
+            val context = XmpApplication.instance!!.applicationContext
+            val pfd = context.contentResolver.openFileDescriptor(fileUri(uri), "r") ?: return null
+            val fd = pfd.detachFd()
+            pfd.close()
+
+            val handle = Xmp.openArchiveFd(fd)
+            return if (handle != 0L) ZipArchive(handle) else null
+        }
+    }
+}
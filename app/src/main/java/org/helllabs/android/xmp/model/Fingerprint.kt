@@ -0,0 +1,42 @@
+package org.helllabs.android.xmp.model
+
+import android.net.Uri
+import androidx.compose.runtime.*
+import java.nio.ByteBuffer
+import java.nio.ByteOrder
+
+/**
+ * Hashes of one module file: [payload] of the depacked file, [content] of the loaded song,
+ * 0 if it didn't load.
+ *
+ * @see [org.helllabs.android.xmp.core.DuplicateIndex]
+ */
+@Stable
+data class Fingerprint(val uri: Uri, val payload: Long, val content: Long) {
+
+    fun toBytes(): ByteArray {
+        val name = uri.toString().toByteArray()
+
+        return ByteBuffer.allocate(16 + name.size)
+            .order(ByteOrder.LITTLE_ENDIAN)
+            .putLong(payload)
+            .putLong(content)
+            .put(name)
+            .array()
+    }
+
+    companion object {
+        fun fromBytes(bytes: ByteArray): Fingerprint? {
+            if (bytes.size <= 16) {
+                return null
+            }
+
+            val b = ByteBuffer.wrap(bytes).order(ByteOrder.LITTLE_ENDIAN)
+            val payload = b.getLong()
+            val content = b.getLong()
+            val uri = Uri.parse(String(bytes, 16, bytes.size - 16))
+
+            return Fingerprint(uri, payload, content)
+        }
+    }
+}
@@ -0,0 +1,31 @@
+package org.helllabs.android.xmp.model
+
+import androidx.compose.runtime.*
+import java.nio.ByteBuffer
+import java.nio.ByteOrder
+
+/**
+ * BS.1770 loudness of one module sequence
+ *
+ * @see [org.helllabs.android.xmp.core.LoudnessScanner]
+ */
+@Stable
+data class Loudness(val integrated: Float, val truePeak: Float) {
+
+    fun toBytes(): ByteArray = ByteBuffer.allocate(8)
+        .order(ByteOrder.LITTLE_ENDIAN)
+        .putFloat(integrated)
+        .putFloat(truePeak)
+        .array()
+
+    companion object {
+        fun fromBytes(bytes: ByteArray): Loudness? {
+            if (bytes.size != 8) {
+                return null
+            }
+
+            val b = ByteBuffer.wrap(bytes).order(ByteOrder.LITTLE_ENDIAN)
+            return Loudness(b.getFloat(), b.getFloat())
+        }
+    }
+}
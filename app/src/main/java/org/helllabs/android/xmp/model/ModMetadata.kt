@@ -0,0 +1,179 @@
+package org.helllabs.android.xmp.model
+
+import androidx.compose.runtime.*
+import java.nio.ByteBuffer
+import java.nio.ByteOrder
+import timber.log.Timber
+
+@Stable
+data class InstrumentInfo(val name: String, val numSamples: Int, val volume: Int)
+
+@Stable
+data class SampleInfo(
+    val name: String,
+    val length: Int,
+    val loopStart: Int,
+    val loopEnd: Int,
+    val flags: Int
+)
+
+@Stable
+data class SequenceInfo(val entryPoint: Int, val duration: Int)
+
+/**
+ * Immutable module metadata, decoded from the packed blob built once in loadModuleFd.
+ * Layout must match metadata.h
+ *
+ * @see [org.helllabs.android.xmp.Xmp.getModMetadata]
+ */
+@Stable
+class ModMetadata(
+    val name: String = "",
+    val type: String = "",
+    val numChannels: Int = 0,
+    val numPatterns: Int = 0,
+    val lengthInPatterns: Int = 0,
+    val restartPosition: Int = 0,
+    val initialSpeed: Int = 0,
+    val initialBpm: Int = 0,
+    val globalVolume: Int = 0,
+    val volumeBase: Int = 0,
+    val instruments: List<InstrumentInfo> = listOf(),
+    val samples: List<SampleInfo> = listOf(),
+    val sequences: List<SequenceInfo> = listOf(),
+    val patternRows: IntArray = intArrayOf(),
+    val orders: IntArray = intArrayOf(),
+    val comment: ByteArray = byteArrayOf(),
+    val md5: String = ""
+) {
+    val numInstruments: Int
+        get() = instruments.size
+
+    val numSamples: Int
+        get() = samples.size
+
+    /**
+     * Instrument names as shown by the viewers, ie: "01 Bassdrum"
+     */
+    fun instrumentNames(): Array<String> = Array(instruments.size) {
+        "%02X %s".format(it + 1, instruments[it].name)
+    }
+
+    fun toModVars(sequence: Int = 0): ModVars = ModVars(
+        seqDuration = sequences.getOrNull(sequence)?.duration ?: 0,
+        lengthInPatterns = lengthInPatterns,
+        numPatterns = numPatterns,
+        numChannels = numChannels,
+        numInstruments = numInstruments,
+        numSamples = numSamples,
+        numSequence = sequences.size,
+        currentSequence = sequence
+    )
+
+    companion object {
+        private const val MAGIC = 0x4d504d58 // "XMPM"
+        private const val VERSION = 2
+
+        private const val NAME_SIZE = 64
+        private const val INS_NAME_SIZE = 32
+        private const val SMP_NAME_SIZE = 32
+
+        /**
+         * Decode a metadata blob.
+         */
+        fun parse(blob: ByteArray?): ModMetadata? {
+            if (blob == null) {
+                return null
+            }
+
+            val b = ByteBuffer.wrap(blob).order(ByteOrder.LITTLE_ENDIAN)
+            if (b.getInt(0) != MAGIC) {
+                Timber.w("Metadata: bad magic")
+                return null
+            }
+
+            val version = b.getShort(4).toInt()
+            if (version != VERSION) {
+                Timber.w("Metadata: unsupported version $version")
+                return null
+            }
+
+            // Header fields, see struct metadata_header
+            var p = 12
+            fun next(): Int = b.getInt(p).also { p += 4 }
+
+            val chn = next()
+            val pat = next()
+            val ins = next()
+            val smp = next()
+            val len = next()
+            val rst = next()
+            val spd = next()
+            val bpm = next()
+            val gvl = next()
+            val volBase = next()
+            val numSeq = next()
+            val nameOff = next()
+            val typeOff = next()
+            val insOff = next()
+            val smpOff = next()
+            val seqOff = next()
+            val rowsOff = next()
+            val ordOff = next()
+            val commentOff = next()
+            val commentLen = next()
+            val md5 = (0 until 16).joinToString("") { "%02x".format(b.get(p + it)) }
+
+            return ModMetadata(
+                name = b.string(nameOff, NAME_SIZE),
+                type = b.string(typeOff, NAME_SIZE),
+                numChannels = chn,
+                numPatterns = pat,
+                lengthInPatterns = len,
+                restartPosition = rst,
+                initialSpeed = spd,
+                initialBpm = bpm,
+                globalVolume = gvl,
+                volumeBase = volBase,
+                instruments = List(ins) {
+                    val off = insOff + it * (INS_NAME_SIZE + 8)
+                    InstrumentInfo(
+                        name = b.string(off, INS_NAME_SIZE),
+                        numSamples = b.getInt(off + INS_NAME_SIZE),
+                        volume = b.getInt(off + INS_NAME_SIZE + 4)
+                    )
+                },
+                samples = List(smp) {
+                    val off = smpOff + it * (SMP_NAME_SIZE + 16)
+                    SampleInfo(
+                        name = b.string(off, SMP_NAME_SIZE),
+                        length = b.getInt(off + SMP_NAME_SIZE),
+                        loopStart = b.getInt(off + SMP_NAME_SIZE + 4),
+                        loopEnd = b.getInt(off + SMP_NAME_SIZE + 8),
+                        flags = b.getInt(off + SMP_NAME_SIZE + 12)
+                    )
+                },
+                sequences = List(numSeq) {
+                    SequenceInfo(
+                        entryPoint = b.getInt(seqOff + it * 8),
+                        duration = b.getInt(seqOff + it * 8 + 4)
+                    )
+                },
+                patternRows = IntArray(pat) { b.getInt(rowsOff + it * 4) },
+                orders = IntArray(len) { b.get(ordOff + it).toInt() and 0xff },
+                comment = ByteArray(commentLen) { b.get(commentOff + it) },
+                md5 = md5
+            )
+        }
+
+        private fun ByteBuffer.string(offset: Int, size: Int): String {
+            var end = 0
+            while (end < size && get(offset + end) != 0.toByte()) {
+                end++
+            }
+
+            val bytes = ByteArray(end) { get(offset + it) }
+            return String(bytes, Charsets.ISO_8859_1)
+        }
+    }
+}
@@ -9,6 +9,23 @@ import androidx.compose.runtime.*
 @Stable
 data class ModInfo(val name: String = "", val type: String = "")
 
+/**
+ * What loading had to give up to fit the memory budget, bytes are the module footprint.
+ *
+ * @see [org.helllabs.android.xmp.Xmp.getDowngradeReport]
+ */
+@Stable
+data class DowngradeReport(
+    val monoSamples: Int = 0,
+    val eightBitSamples: Int = 0,
+    val halvedSamples: Int = 0,
+    val bytesBefore: Long = 0,
+    val bytesAfter: Long = 0
+) {
+    val isDowngraded: Boolean
+        get() = monoSamples + eightBitSamples + halvedSamples > 0
+}
+
 /**
  * @see [org.helllabs.android.xmp.Xmp.getChannelData]
  */
@@ -51,6 +68,59 @@ data class ChannelInfo(
     }
 }
 
+/**
+ * A tick as heard, starting at output frame [offset] of its buffer. [triggers] has a bit
+ * set for each channel with a note-on at this tick.
+ *
+ * @see [org.helllabs.android.xmp.Xmp.getTickState]
+ */
+@Stable
+data class TickState(
+    val pos: Int = 0,
+    val row: Int = 0,
+    val frame: Int = 0,
+    val speed: Int = 0,
+    val bpm: Int = 0,
+    val offset: Int = 0,
+    val triggers: Long = 0,
+    val keys: IntArray = IntArray(0),
+    val volumes: IntArray = IntArray(0)
+) {
+    fun isTriggered(chn: Int): Boolean = triggers and (1L shl chn) != 0L
+
+    override fun equals(other: Any?): Boolean {
+        if (this === other) return true
+        if (javaClass != other?.javaClass) return false
+
+        other as TickState
+
+        if (pos != other.pos) return false
+        if (row != other.row) return false
+        if (frame != other.frame) return false
+        if (speed != other.speed) return false
+        if (bpm != other.bpm) return false
+        if (offset != other.offset) return false
+        if (triggers != other.triggers) return false
+        if (!keys.contentEquals(other.keys)) return false
+        if (!volumes.contentEquals(other.volumes)) return false
+
+        return true
+    }
+
+    override fun hashCode(): Int {
+        var result = pos
+        result = 31 * result + row
+        result = 31 * result + frame
+        result = 31 * result + speed
+        result = 31 * result + bpm
+        result = 31 * result + offset
+        result = 31 * result + triggers.hashCode()
+        result = 31 * result + keys.contentHashCode()
+        result = 31 * result + volumes.contentHashCode()
+        return result
+    }
+}
+
 /**
  * @see [org.helllabs.android.xmp.Xmp.getModVars]
  */
@@ -79,6 +149,35 @@ data class FrameInfo(
     val bpm: Int = 0
 )
 
+/**
+ * A note-on at [time] ms into the sequence, with its zero based [key] and the channel
+ * [volume] when it was triggered.
+ *
+ * @see [org.helllabs.android.xmp.Xmp.getNoteEvents]
+ */
+@Stable
+data class NoteEvent(
+    val time: Int,
+    val channel: Int,
+    val key: Int,
+    val instrument: Int,
+    val volume: Int
+)
+
+/**
+ * A playback change, heard at [pts] on the [System.nanoTime] clock. [a] and [b] depend
+ * on the [type], one of the EVENT_ constants in [org.helllabs.android.xmp.Xmp].
+ *
+ * @see [org.helllabs.android.xmp.Xmp.awaitEvents]
+ */
+@Stable
+data class RenderEvent(
+    val pts: Long,
+    val type: Int,
+    val a: Int = 0,
+    val b: Int = 0
+)
+
 /**
  * @see [org.helllabs.android.xmp.Xmp.getSeqVars]
  */
@@ -95,3 +194,131 @@ data class SequenceVars(val sequence: IntArray = intArrayOf()) {
 
     override fun hashCode(): Int = sequence.contentHashCode()
 }
+
+/**
+ * Probe cost of one loader: tests as a candidate, accepted ones, time spent,
+ * and files only the full scan found for it.
+ *
+ * @see [org.helllabs.android.xmp.Xmp.getProbeStats]
+ */
+@Stable
+data class ProbeStat(
+    val name: String,
+    val tries: Long,
+    val hits: Long,
+    val nanos: Long,
+    val missed: Long
+)
+
+/**
+ * @see [org.helllabs.android.xmp.Xmp.getProbeStats]
+ */
+@Stable
+data class ProbeStats(
+    val fullScans: Long = 0,
+    val fullScanNanos: Long = 0,
+    val loaders: List<ProbeStat> = listOf()
+)
+
+/**
+ * A render quality change, [level] 0 is the configured quality. [timeMs] is in
+ * [android.os.SystemClock.uptimeMillis] time, [load] the render time over buffer time.
+ *
+ * @see [org.helllabs.android.xmp.Xmp.getQualityState]
+ */
+@Stable
+data class QualityStep(
+    val timeMs: Long,
+    val level: Int,
+    val load: Float
+)
+
+/**
+ * @see [org.helllabs.android.xmp.Xmp.getQualityState]
+ */
+@Stable
+data class QualityState(
+    val level: Int = 0,
+    val load: Float = 0f,
+    val totalSteps: Long = 0,
+    val steps: List<QualityStep> = listOf()
+)
+
+/**
+ * How the render thread is scheduled, one of the RENDER_ constants in
+ * [org.helllabs.android.xmp.Xmp] with its priority or nice value, and on how many
+ * cores, 0 for any. The counts cover the module playing, with the page faults taken
+ * while rendering and the memory kept resident for it.
+ *
+ * @see [org.helllabs.android.xmp.Xmp.getRenderStats]
+ */
+@Stable
+data class RenderStats(
+    val policy: Int = 0,
+    val priority: Int = 0,
+    val cpus: Int = 0,
+    val buffers: Long = 0,
+    val wakeups: Long = 0,
+    val wakeNanos: Long = 0,
+    val wakeMaxNanos: Long = 0,
+    val preemptNanos: Long = 0,
+    val preemptMaxNanos: Long = 0,
+    val switches: Long = 0,
+    val minorFaults: Long = 0,
+    val majorFaults: Long = 0,
+    val faultBuffers: Long = 0,
+    val lockedBytes: Long = 0,
+    val prefaultedBytes: Long = 0
+)
+
+/**
+ * Cost of one load phase: time, bytes read, major page faults and heap growth
+ *
+ * @see [org.helllabs.android.xmp.Xmp.getLoadReport]
+ */
+@Stable
+data class LoadPhase(
+    val name: String,
+    val nanos: Long = 0,
+    val bytes: Long = 0,
+    val faults: Long = 0,
+    val alloc: Long = 0
+)
+
+/**
+ * Where the last module load spent its time. [providerNanos] is the time spent opening
+ * the file through the content provider, the phases are measured natively.
+ *
+ * @see [org.helllabs.android.xmp.Xmp.getLoadReport]
+ */
+@Stable
+data class LoadReport(
+    val result: Int = 0,
+    val cached: Boolean = false,
+    val providerNanos: Long = 0,
+    val phases: List<LoadPhase> = listOf()
+) {
+    val totalNanos: Long
+        get() = providerNanos + phases.sumOf { it.nanos }
+}
+
+/**
+ * Player state packed in a single native call, decoded without allocating
+ *
+ * @see [org.helllabs.android.xmp.Xmp.getPlayState]
+ */
+@JvmInline
+value class PlayState(private val packed: Long) {
+    val time: Int
+        get() = packed.toInt()
+    val pos: Int
+        get() = (packed ushr 32).toInt() and 0xff
+    val row: Int
+        get() = (packed ushr 40).toInt() and 0xfff
+    val loopCount: Int
+        get() = (packed ushr 52).toInt() and 0xff
+    val isPlaying: Boolean
+        get() = packed and (1L shl 60) != 0L
+    val hasFreeBuffer: Boolean
+        get() = packed and (1L shl 61) != 0L
+}
@@ -0,0 +1,44 @@
+package org.helllabs.android.xmp.model
+
+import androidx.compose.runtime.*
+import java.nio.ByteBuffer
+import java.nio.ByteOrder
+
+/**
+ * Whole-song amplitude overview, [ready] of the buckets are filled in.
+ *
+ * @see [org.helllabs.android.xmp.Xmp.getEnvelope]
+ */
+@Stable
+class SongEnvelope(
+    val rms: ShortArray = shortArrayOf(),
+    val peak: ShortArray = shortArrayOf(),
+    val ready: Int = 0
+) {
+    val size: Int
+        get() = rms.size
+
+    val isComplete: Boolean
+        get() = size > 0 && ready == size
+
+    fun toBytes(): ByteArray {
+        val b = ByteBuffer.allocate(size * 4).order(ByteOrder.LITTLE_ENDIAN)
+        rms.forEach { b.putShort(it) }
+        peak.forEach { b.putShort(it) }
+        return b.array()
+    }
+
+    companion object {
+        fun fromBytes(bytes: ByteArray): SongEnvelope? {
+            if (bytes.isEmpty() || bytes.size % 4 != 0) {
+                return null
+            }
+
+            val num = bytes.size / 4
+            val b = ByteBuffer.wrap(bytes).order(ByteOrder.LITTLE_ENDIAN)
+            val rms = ShortArray(num) { b.getShort() }
+            val peak = ShortArray(num) { b.getShort() }
+            return SongEnvelope(rms, peak, num)
+        }
+    }
+}
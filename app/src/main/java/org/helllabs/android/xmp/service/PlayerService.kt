@@ -1,9 +1,11 @@
 package org.helllabs.android.xmp.service
 
+import android.app.ActivityManager
 import android.app.NotificationChannel
 import android.app.NotificationManager
 import android.app.PendingIntent
 import android.app.Service
+import android.content.ComponentCallbacks2
 import android.content.Intent
 import android.graphics.Bitmap
 import android.graphics.BitmapFactory
@@ -12,6 +14,7 @@ import android.net.Uri
 import android.os.Binder
 import android.os.Build
 import android.os.IBinder
+import android.os.PowerManager
 import android.support.v4.media.MediaDescriptionCompat
 import android.support.v4.media.MediaMetadataCompat
 import android.support.v4.media.session.MediaControllerCompat
@@ -25,6 +28,7 @@ import androidx.media.AudioManagerCompat
 import androidx.media.session.MediaButtonReceiver
 import java.lang.ref.WeakReference
 import java.util.LinkedList
+import java.util.concurrent.atomic.AtomicInteger
 import kotlinx.coroutines.CoroutineScope
 import kotlinx.coroutines.Dispatchers
 import kotlinx.coroutines.Job
@@ -35,10 +39,14 @@ import kotlinx.coroutines.launch
 import org.helllabs.android.xmp.R
 import org.helllabs.android.xmp.Xmp
 import org.helllabs.android.xmp.compose.ui.player.PlayerActivity
+import org.helllabs.android.xmp.core.DuplicateIndex
+import org.helllabs.android.xmp.core.LoudnessScanner
 import org.helllabs.android.xmp.core.PrefManager
 import org.helllabs.android.xmp.core.StorageManager
-import org.helllabs.android.xmp.model.FrameInfo
+import org.helllabs.android.xmp.core.ZipArchive
+import org.helllabs.android.xmp.model.LoadReport
 import org.helllabs.android.xmp.model.ModInfo
+import org.helllabs.android.xmp.model.ModMetadata
 import org.helllabs.android.xmp.model.ModVars
 import timber.log.Timber
 
@@ -81,6 +89,14 @@ class PlayerService :
         private const val CMD_PREV = 2
         private const val CMD_STOP = 3
 
+        // Load phases this many times their recent median, and slower than the floor, are logged
+        private const val LOAD_HISTORY = 32
+        private const val LOAD_OUTLIER_FACTOR = 4
+        private const val LOAD_OUTLIER_NANOS = 50_000_000L
+
+        // How often a load in progress checks for skips and stop
+        private const val LOAD_POLL_MS = 20
+
         val isAlive = MutableStateFlow(false)
         val isPlaying = MutableStateFlow(false)
     }
@@ -110,11 +126,27 @@ class PlayerService :
     private var playlistPosition: Int = 0
     private var currentFileUri: Uri = Uri.EMPTY
 
+    // Skips requested while a module loads, coalesced into a single load
+    private val pendingSkips = AtomicInteger(0)
+
+    @Volatile
+    private var isLoading = false
+
     var isRepeating: Boolean = false
         private set
     var playAllSequences: Boolean = false
         private set
 
+    private val loadHistory: ArrayDeque<LoadReport> = ArrayDeque()
+    private var qualitySteps: Long = 0
+
+    private var moduleCacheBudget: Long = 0
+    private var moduleMemoryBudget: Long = 0
+
+    private var loudnessJob: Job? = null
+    private var duplicateJob: Job? = null
+    private var gainJob: Job? = null
+
     private var cmd: Int = 0
     private var discardBuffer: Boolean = false
 
@@ -145,6 +177,11 @@ class PlayerService :
 
         watchdog.stop()
 
+        loudnessJob?.cancel()
+        duplicateJob?.cancel()
+        gainJob?.cancel()
+        LoudnessScanner.cancelAll()
+
         mediaSession.isActive = false
         mediaSession.release()
 
@@ -153,6 +190,23 @@ class PlayerService :
 
     override fun onBind(intent: Intent?): IBinder = binder
 
+    @Suppress("DEPRECATION")
+    override fun onTrimMemory(level: Int) {
+        super.onTrimMemory(level)
+
+        val keep = when {
+            level >= ComponentCallbacks2.TRIM_MEMORY_COMPLETE -> 0L
+            level == ComponentCallbacks2.TRIM_MEMORY_RUNNING_CRITICAL -> 0L
+            level >= ComponentCallbacks2.TRIM_MEMORY_BACKGROUND -> moduleCacheBudget / 4
+            level == ComponentCallbacks2.TRIM_MEMORY_RUNNING_LOW -> moduleCacheBudget / 4
+            level == ComponentCallbacks2.TRIM_MEMORY_RUNNING_MODERATE -> moduleCacheBudget / 2
+            else -> return
+        }
+
+        Timber.d("Trim memory level $level, module cache to $keep bytes")
+        Xmp.trimModuleCache(keep)
+    }
+
     override fun onStartCommand(intent: Intent?, flags: Int, startId: Int): Int {
         when (intent?.action) {
             "ACTION_PLAY" -> mediaSession.controller.transportControls.play()
@@ -267,6 +321,10 @@ class PlayerService :
 
                 override fun onSkipToNext() {
                     Timber.d("MediaSessionCompat onSkipToNext")
+                    if (isLoading) {
+                        pendingSkips.incrementAndGet()
+                        return
+                    }
                     Xmp.stopModule()
                     cmd = CMD_NEXT
                     discardBuffer = true
@@ -277,6 +335,10 @@ class PlayerService :
 
                 override fun onSkipToPrevious() {
                     Timber.d("MediaSessionCompat onSkipToPrevious")
+                    if (isLoading) {
+                        pendingSkips.decrementAndGet()
+                        return
+                    }
                     if (Xmp.time() > 3000) {
                         Xmp.seek(0)
                     } else {
@@ -310,7 +372,16 @@ class PlayerService :
     private fun initializeXmpPlayer() {
         val bufferMs = PrefManager.bufferMs.coerceIn(Xmp.MIN_BUFFER_MS, Xmp.MAX_BUFFER_MS)
 
-        if (!Xmp.init(PrefManager.samplingRate, bufferMs)) {
+        // Output at the rate and burst of the device mixer keeps it off the system resampler
+        val deviceRate = audioManager.getProperty(AudioManager.PROPERTY_OUTPUT_SAMPLE_RATE)
+            ?.toIntOrNull() ?: PrefManager.samplingRate
+        val burst = audioManager.getProperty(AudioManager.PROPERTY_OUTPUT_FRAMES_PER_BUFFER)
+            ?.toIntOrNull() ?: 0
+        Timber.i("Output at $deviceRate Hz, $burst frame bursts")
+
+        if (!Xmp.init(deviceRate, bufferMs, burst) &&
+            !Xmp.init(PrefManager.samplingRate, bufferMs, 0)
+        ) {
             Timber.e("Unable to init Xmp audio (OpenSLES)")
 
             serviceScope.launch {
@@ -321,6 +392,16 @@ class PlayerService :
             return
         }
 
+        // A quarter of the app heap for recently played modules
+        val activityManager = getSystemService(ActivityManager::class.java)
+        moduleCacheBudget = activityManager.memoryClass * 1024L * 1024L / 4
+        Xmp.setModuleCacheBudget(moduleCacheBudget)
+
+        // An eighth of device RAM for a single module, 256 MB on a 2 GB device
+        val memInfo = ActivityManager.MemoryInfo()
+        activityManager.getMemoryInfo(memInfo)
+        moduleMemoryBudget = memInfo.totalMem / 8
+
         playerVolume = Xmp.getVolume()
         playAllSequences = PrefManager.allSequences
 
@@ -444,6 +525,7 @@ class PlayerService :
         val ret = Xmp.setSequence(sequence)
         if (ret) {
             playerSequence = sequence
+            applyLoudness(sequence)
             serviceScope.launch {
                 _playerEvent.emit(PlayerEvent.NewSequence)
             }
@@ -453,6 +535,66 @@ class PlayerService :
 
     fun getFileName(): String = StorageManager.getFileName(currentFileUri) ?: "<Unknown Title>"
 
+    fun getFileUri(): Uri = currentFileUri
+
+    /**
+     * Set the output gain for the current module sequence, scanning it first if needed
+     */
+    private fun applyLoudness(sequence: Int) {
+        gainJob?.cancel()
+        Xmp.setOutputGain(0f)
+
+        if (!PrefManager.normalizeLoudness) {
+            return
+        }
+
+        val md5 = ModMetadata.parse(Xmp.getModMetadata())?.md5 ?: return
+        val cached = LoudnessScanner.cached(md5, sequence)
+        if (cached != null) {
+            Xmp.setOutputGain(LoudnessScanner.gain(cached))
+            return
+        }
+
+        val uri = currentFileUri
+        gainJob = serviceScope.launch(Dispatchers.IO) {
+            val (key, loudness) = LoudnessScanner.scan(uri, sequence) ?: return@launch
+            if (key == md5 && uri == currentFileUri && sequence == playerSequence) {
+                Xmp.setOutputGain(LoudnessScanner.gain(loudness))
+            }
+        }
+    }
+
+    /**
+     * Scan the whole queue in the background, so gains are ready before each module plays
+     */
+    private fun scanLoudness(list: List<Uri>) {
+        loudnessJob?.cancel()
+        LoudnessScanner.cancelAll()
+
+        if (!PrefManager.normalizeLoudness) {
+            return
+        }
+
+        loudnessJob = serviceScope.launch(Dispatchers.IO) {
+            LoudnessScanner.scanAll(list)
+        }
+    }
+
+    /**
+     * Hash the queue in the background, so duplicates are known the next time it's queued
+     */
+    private fun scanDuplicates(list: List<Uri>) {
+        duplicateJob?.cancel()
+
+        if (!PrefManager.skipDuplicates) {
+            return
+        }
+
+        duplicateJob = serviceScope.launch(Dispatchers.IO) {
+            DuplicateIndex.scanAll(list)
+        }
+    }
+
     fun play(
         fileList: List<Uri>,
         start: Int,
@@ -466,6 +608,8 @@ class PlayerService :
 
         playlist.clear()
         add(fileList)
+        scanLoudness(playlist.mapNotNull { it.description.mediaUri })
+        scanDuplicates(playlist.mapNotNull { it.description.mediaUri })
 
         if (shuffle) {
             if (keepFirst) {
@@ -506,23 +650,138 @@ class PlayerService :
             return
         }
 
-        val items = list.mapNotNull { item ->
+        // Zip archives are queued as the modules they hold
+        val modules = list.flatMap { item ->
+            if (ZipArchive.isArchive(item)) {
+                return@flatMap ZipArchive.open(item)?.use { it.modules(item) }.orEmpty()
+            }
+
             val modInfo = ModInfo()
             if (Xmp.testFromFd(item, modInfo)) {
-                val desc = MediaDescriptionCompat.Builder()
-                    .setTitle(modInfo.name.ifEmpty { item.lastPathSegment })
-                    .setMediaUri(item)
-                    .setSubtitle(modInfo.type)
-                    .build()
-
-                MediaSessionCompat.QueueItem(desc, desc.hashCode().toLong())
+                listOf(item to modInfo)
             } else {
                 Timber.w("Item: $item was not a valid module")
-                null
+                listOf()
+            }
+        }
+
+        val items = modules.map { (item, modInfo) ->
+            val desc = MediaDescriptionCompat.Builder()
+                .setTitle(modInfo.name.ifEmpty { item.lastPathSegment })
+                .setMediaUri(item)
+                .setSubtitle(modInfo.type)
+                .build()
+
+            MediaSessionCompat.QueueItem(desc, desc.hashCode().toLong())
+        }
+
+        if (PrefManager.skipDuplicates) {
+            playlist.addAll(DuplicateIndex.distinct(items) { it.description.mediaUri })
+        } else {
+            playlist.addAll(items)
+        }
+        logProbeStats()
+    }
+
+    private fun logProbeStats() {
+        val stats = Xmp.getProbeStats()
+        Timber.d("Probe: ${stats.fullScans} full scans, ${stats.fullScanNanos / 1000} us")
+        stats.loaders.filter { it.tries > 0 || it.missed > 0 }.forEach {
+            Timber.d(
+                "Probe ${it.name}: ${it.hits}/${it.tries} hits, ${it.nanos / 1000} us, " +
+                    "${it.missed} missed"
+            )
+        }
+    }
+
+    /**
+     * Log where the last load spent its time, flagging phases that were much slower
+     * than usual across the recent loads
+     */
+    private fun logLoadReport(uri: Uri) {
+        val report = Xmp.getLoadReport()
+        Timber.d(
+            "Load: ${report.totalNanos / 1000} us, provider ${report.providerNanos / 1000} us" +
+                if (report.cached) ", cached" else ""
+        )
+        report.phases.filter { it.nanos > 0 }.forEach {
+            Timber.d(
+                "Load ${it.name}: ${it.nanos / 1000} us, ${it.bytes} bytes read, " +
+                    "${it.faults} faults, ${it.alloc} bytes allocated"
+            )
+        }
+
+        if (!report.cached && loadHistory.size >= LOAD_HISTORY / 4) {
+            report.phases.forEachIndexed { i, phase ->
+                val median = loadHistory.map { it.phases[i].nanos }.sorted()[loadHistory.size / 2]
+                if (phase.nanos > LOAD_OUTLIER_NANOS &&
+                    phase.nanos > median * LOAD_OUTLIER_FACTOR
+                ) {
+                    Timber.w(
+                        "Slow load ${phase.name} of $uri: ${phase.nanos / 1000} us, " +
+                            "median ${median / 1000} us"
+                    )
+                }
             }
         }
 
-        playlist.addAll(items)
+        if (!report.cached && report.phases.isNotEmpty()) {
+            loadHistory.addLast(report)
+            if (loadHistory.size > LOAD_HISTORY) {
+                loadHistory.removeFirst()
+            }
+        }
+    }
+
+    /**
+     * Log render quality steps taken since the last call with the thermal status,
+     * to correlate them with device throttling
+     */
+    private fun logRenderStats() {
+        val stats = Xmp.getRenderStats()
+        if (stats.buffers == 0L) {
+            return
+        }
+
+        val wakeAvg = if (stats.wakeups > 0) stats.wakeNanos / stats.wakeups / 1000 else 0
+        Timber.i(
+            "Render policy ${stats.policy} priority ${stats.priority} cores ${stats.cpus}, " +
+                "${stats.buffers} buffers, wakeup avg $wakeAvg us max " +
+                "${stats.wakeMaxNanos / 1000} us, preempted avg " +
+                "${stats.preemptNanos / stats.buffers / 1000} us max " +
+                "${stats.preemptMaxNanos / 1000} us, ${stats.switches} switches"
+        )
+        Timber.i(
+            "Render faults ${stats.minorFaults} minor ${stats.majorFaults} major in " +
+                "${stats.faultBuffers} buffers, ${stats.lockedBytes / 1024} KiB locked " +
+                "${stats.prefaultedBytes / 1024} KiB prefaulted"
+        )
+    }
+
+    private fun logQualitySteps() {
+        val state = Xmp.getQualityState()
+        if (state.totalSteps < qualitySteps) {
+            // Steps are counted per module
+            qualitySteps = 0
+        }
+        if (state.totalSteps == qualitySteps) {
+            return
+        }
+
+        val thermal = if (Build.VERSION.SDK_INT >= Build.VERSION_CODES.Q) {
+            (getSystemService(POWER_SERVICE) as PowerManager).currentThermalStatus
+        } else {
+            -1
+        }
+
+        val new = (state.totalSteps - qualitySteps).coerceAtMost(state.steps.size.toLong())
+        state.steps.takeLast(new.toInt()).forEach {
+            Timber.i(
+                "Render quality level ${it.level} at ${it.timeMs} ms, " +
+                    "load ${"%.2f".format(it.load)}, thermal status $thermal"
+            )
+        }
+        qualitySteps = state.totalSteps
     }
 
     private fun <T> MutableList<T>.shuffleWithFirst(index: Int) {
@@ -534,25 +793,76 @@ class PlayerService :
     }
 
     private inner class PlayRunnable : Runnable {
+        private var skipToPrevious = false
+
+        /**
+         * Load the module at [playlistPosition] on the native loader thread. Skips that
+         * arrive meanwhile move the position and supersede the load, so only the last
+         * module asked for is parsed and reaches the player.
+         */
+        private fun loadCoalesced(budget: Long): Int {
+            isLoading = true
+
+            var gen = Xmp.requestLoad(currentFileUri, budget)
+            var res: Int
+            do {
+                res = if (gen < 0) -1 else Xmp.awaitModule(gen, LOAD_POLL_MS)
+
+                if (cmd == CMD_STOP) {
+                    Xmp.cancelLoad()
+                    res = Xmp.LOAD_CANCELLED
+                    break
+                }
+
+                val skips = pendingSkips.getAndSet(0)
+                if (skips != 0) {
+                    playlistPosition = (playlistPosition + skips).coerceIn(0, playlist.size - 1)
+                    currentFileUri = playlist[playlistPosition].description.mediaUri!!
+                    skipToPrevious = skips < 0
+                    Timber.i("Skip to $currentFileUri")
+                    gen = Xmp.requestLoad(currentFileUri, budget)
+                    res = Xmp.LOAD_PENDING
+                }
+            } while (res == Xmp.LOAD_PENDING)
+
+            isLoading = false
+
+            return res
+        }
+
         override fun run() {
             cmd = CMD_NONE
 
+            // The native side raises and places this thread, as far as it is allowed to
+            val policy = Xmp.setRenderThread()
+            Timber.i("Render thread scheduling $policy")
+
             var lastRecognized = 0
             var oldPos = -1
-            var skipToPrevious = false
 
             isPlaying.value = true
 
             do {
-                val queueItem = playlist[playlistPosition]
+                currentFileUri = playlist[playlistPosition].description.mediaUri!!
 
-                currentFileUri = queueItem.description.mediaUri!!
+                // Set default pan before we load the module
+                val defpan = PrefManager.defaultPan
+                Timber.i("Set default pan to $defpan")
+                Xmp.setPlayer(Xmp.PLAYER_DEFPAN, defpan)
+
+                Timber.i("Load $currentFileUri")
+                val budget = if (PrefManager.limitModuleMemory) moduleMemoryBudget else 0L
+                val res = loadCoalesced(budget)
+                if (res == Xmp.LOAD_CANCELLED) {
+                    break
+                }
+
+                val queueItem = playlist[playlistPosition]
 
                 // If this file is unrecognized, and we're going backwards, go to previous
                 // If we're at the start of the list, go to the last recognized file
-                val isValid = queueItem.description.mediaUri?.let { Xmp.testFromFd(it) } ?: false
-                if (!isValid) {
-                    Timber.w("$currentFileUri: unrecognized format")
+                if (res < 0) {
+                    Timber.w("$currentFileUri: unrecognized format or load error $res")
                     serviceScope.launch {
                         val module = currentFileUri.lastPathSegment?.ifEmpty { "module was" }
                         _playerEvent.emit(
@@ -561,50 +871,66 @@ class PlayerService :
                             )
                         )
                     }
-                    if (cmd == CMD_PREV) {
+                    if (cmd == CMD_PREV || skipToPrevious) {
                         if (playlistPosition <= 0) {
-                            // -1 because we have queue.next() in the while condition
-                            playlistPosition = lastRecognized - 1
-                            continue
+                            playlistPosition = lastRecognized
+                            cmd = CMD_NONE
+                            skipToPrevious = false
+                        } else {
+                            playlistPosition--
                         }
-                        playlistPosition.minus(2).coerceAtLeast(0)
+                    } else {
+                        playlistPosition++
                     }
                     continue
                 }
 
-                // Set default pan before we load the module
-                val defpan = PrefManager.defaultPan
-                Timber.i("Set default pan to $defpan")
-                Xmp.setPlayer(Xmp.PLAYER_DEFPAN, defpan)
+                lastRecognized = playlistPosition
+                cmd = CMD_NONE
+                logLoadReport(currentFileUri)
 
-                // Ditto if we can't load the module
-                Timber.i("Load $currentFileUri")
-                if (Xmp.loadFromFd(currentFileUri) < 0) {
-                    Timber.e("Error loading $currentFileUri")
-                    if (cmd == CMD_PREV) {
-                        if (playlistPosition <= 0) {
-                            playlistPosition = lastRecognized - 1
-                            continue
-                        }
-                        playlistPosition.minus(2).coerceAtLeast(0)
-                    }
+                // Skips that came in as the load finished, load again where they all lead
+                val lateSkips = pendingSkips.getAndSet(0)
+                if (lateSkips != 0) {
+                    playlistPosition = (playlistPosition + lateSkips).coerceIn(0, playlist.size - 1)
+                    skipToPrevious = lateSkips < 0
                     continue
                 }
 
-                lastRecognized = playlistPosition
-                cmd = CMD_NONE
+                val report = Xmp.getDowngradeReport()
+                if (report.isDowngraded) {
+                    Timber.i("Module reduced to fit memory: $report")
+                    serviceScope.launch {
+                        _playerEvent.emit(
+                            PlayerEvent.ErrorMessage(
+                                "Sample quality reduced to fit memory " +
+                                    "(${report.bytesBefore shr 20} MB to ${report.bytesAfter shr 20} MB)"
+                            )
+                        )
+                    }
+                }
 
                 val volBoost = PrefManager.volumeBoost
 
-                val interp = intArrayOf(Xmp.INTERP_NEAREST, Xmp.INTERP_LINEAR, Xmp.INTERP_SPLINE)
-                    .getOrElse(PrefManager.interpType) {
-                        if (!PrefManager.interpolate) {
-                            Xmp.INTERP_NEAREST
-                        } else {
-                            Xmp.INTERP_LINEAR
-                        }
+                // 3 was a mix resampling mode, now gone, that mixed with spline
+                val interp = intArrayOf(
+                    Xmp.INTERP_NEAREST,
+                    Xmp.INTERP_LINEAR,
+                    Xmp.INTERP_SPLINE,
+                    Xmp.INTERP_SPLINE
+                ).getOrElse(PrefManager.interpType) {
+                    if (!PrefManager.interpolate) {
+                        Xmp.INTERP_NEAREST
+                    } else {
+                        Xmp.INTERP_LINEAR
                     }
+                }
 
+                // Interpolation is picked up by startPlayer
+                Xmp.setPlayer(Xmp.PLAYER_INTERP, interp)
+                Xmp.setChannelScopes(if (PrefManager.channelScopes) Xmp.MAX_BUFFERS else 0)
+                Xmp.setQualityGovernor(PrefManager.adaptiveQuality)
+                Xmp.setMemoryLock(if (PrefManager.lockAudioMemory) Xmp.MEMORY_LOCK_BUDGET else 0)
                 Xmp.startPlayer(PrefManager.samplingRate)
 
                 // Unmute all channels
@@ -621,7 +947,6 @@ class PlayerService :
                 Xmp.setPlayer(Xmp.PLAYER_AMP, volBoost)
                 Xmp.setPlayer(Xmp.PLAYER_CFLAGS, flags)
                 Xmp.setPlayer(Xmp.PLAYER_DSP, Xmp.DSP_LOWPASS)
-                Xmp.setPlayer(Xmp.PLAYER_INTERP, interp)
                 Xmp.setPlayer(Xmp.PLAYER_MIX, PrefManager.stereoMix)
                 Xmp.setPlayer(Xmp.PLAYER_VOLUME, 100)
 
@@ -630,6 +955,7 @@ class PlayerService :
                 var playNewSequence: Boolean
 
                 Xmp.setSequence(playerSequence)
+                applyLoudness(playerSequence)
                 Xmp.playAudio()
 
                 serviceScope.launch {
@@ -691,13 +1017,9 @@ class PlayerService :
                             break
                         }
 
-                        // Wait if no buffers available
+                        // Wait if no buffers available, woken by the output when one frees
                         while (!Xmp.hasFreeBuffer() && isPlaying.value && cmd == CMD_NONE) {
-                            try {
-                                Thread.sleep(40)
-                            } catch (e: InterruptedException) {
-                                // Nothing
-                            }
+                            Xmp.waitFreeBuffer(40)
                         }
 
                         // Fill a new buffer
@@ -708,11 +1030,11 @@ class PlayerService :
                         watchdog.refresh()
 
                         // Periodically update notification state
-                        val fi = FrameInfo()
-                        Xmp.getInfo(fi)
-                        if (fi.pos != oldPos) {
-                            oldPos = fi.pos
+                        val pos = Xmp.playState.pos
+                        if (pos != oldPos) {
+                            oldPos = pos
                             updatePlaybackState(PlaybackStateCompat.STATE_PLAYING)
+                            logQualitySteps()
                         }
                     }
 
@@ -725,6 +1047,7 @@ class PlayerService :
                         Timber.i("Play sequence $playerSequence")
                         if (Xmp.setSequence(playerSequence)) {
                             playNewSequence = true
+                            applyLoudness(playerSequence)
                             serviceScope.launch {
                                 _playerEvent.emit(PlayerEvent.NewSequence)
                             }
@@ -732,6 +1055,7 @@ class PlayerService :
                     }
                 } while (playNewSequence)
 
+                logRenderStats()
                 Xmp.endPlayer()
 
                 // notify end of module to our clients
@@ -0,0 +1,404 @@
+/*
+ * Modules inside zip archives, without extracting them
+ *
+ * Opening an archive reads the end of central directory record and maps
+ * the central directory, which is indexed in place: entry names stay in
+ * the mapping and only offsets and sizes are kept per member. Testing a
+ * member inflates just the start of it for the probe, loading one maps
+ * only its compressed bytes and depacks them in memory. Memory use stays
+ * bounded by the directory size whatever the archive size is.
+ */
+
+#include "archive.h"
+#include "probe.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/* Enough for the header of any format the probe knows */
+#define TEST_PREFIX (64 * 1024)
+
+/* Smaller members that fail on their prefix are tested in full */
+#define FULL_TEST_SIZE (4 * 1024 * 1024)
+
+#define EOCD_SIZE 22
+#define EOCD64_SIZE 56
+#define LOCATOR_SIZE 20
+#define CDH_SIZE 46
+#define LOCAL_SIZE 30
+#define MAX_COMMENT 65535
+
+struct archive_entry {
+    off_t header;           /* local header offset */
+    uint64_t csize;
+    uint64_t usize;
+    uint32_t name;          /* name offset in the central directory */
+    uint16_t name_len;
+    int format;
+};
+
+struct archive {
+    int fd;
+    off_t size;
+    void *map;
+    size_t map_len;
+    const uint8_t *cd;
+    int num;
+    struct archive_entry *entries;
+};
+
+struct member {
+    void *map;
+    size_t map_len;
+    const uint8_t *data;
+};
+
+static uint32_t read16l(const uint8_t *p) {
+    return p[0] | (p[1] << 8);
+}
+
+static uint32_t read32l(const uint8_t *p) {
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t) p[3] << 24);
+}
+
+static uint64_t read64l(const uint8_t *p) {
+    return read32l(p) | ((uint64_t) read32l(p + 4) << 32);
+}
+
+/* Zip64 directory location, from the locator right before the EOCD */
+static int read_eocd64(int fd, off_t eocd, uint64_t *num, uint64_t *cd_size, uint64_t *cd_off) {
+    uint8_t loc[LOCATOR_SIZE], rec[EOCD64_SIZE];
+
+    if (eocd < LOCATOR_SIZE || pread(fd, loc, LOCATOR_SIZE, eocd - LOCATOR_SIZE) != LOCATOR_SIZE ||
+        memcmp(loc, "PK\x06\x07", 4))
+        return -1;
+
+    if (pread(fd, rec, EOCD64_SIZE, read64l(loc + 8)) != EOCD64_SIZE ||
+        memcmp(rec, "PK\x06\x06", 4))
+        return -1;
+
+    *num = read64l(rec + 32);
+    *cd_size = read64l(rec + 40);
+    *cd_off = read64l(rec + 48);
+
+    return 0;
+}
+
+static int find_directory(int fd, off_t size, uint64_t *num, uint64_t *cd_size, uint64_t *cd_off) {
+    size_t tail = size < EOCD_SIZE + MAX_COMMENT ? size : EOCD_SIZE + MAX_COMMENT;
+    uint8_t *buf;
+    ssize_t i;
+    int res = -1;
+
+    buf = malloc(tail);
+    if (buf == NULL)
+        return -1;
+
+    if (pread(fd, buf, tail, size - tail) != (ssize_t) tail) {
+        free(buf);
+        return -1;
+    }
+
+    for (i = tail - EOCD_SIZE; i >= 0; i--) {
+        if (memcmp(buf + i, "PK\x05\x06", 4))
+            continue;
+
+        *num = read16l(buf + i + 10);
+        *cd_size = read32l(buf + i + 12);
+        *cd_off = read32l(buf + i + 16);
+
+        if (*num == 0xffff || *cd_size == 0xffffffff || *cd_off == 0xffffffff) {
+            res = read_eocd64(fd, size - tail + i, num, cd_size, cd_off);
+        } else {
+            res = 0;
+        }
+        break;
+    }
+
+    free(buf);
+
+    return res;
+}
+
+/* Sizes and offset that didn't fit in 32 bits are in the zip64 extra field */
+static void read_zip64(const uint8_t *extra, size_t len, struct archive_entry *e,
+                       int usize64, int csize64, int offset64) {
+    size_t i = 0;
+
+    while (i + 4 <= len) {
+        uint32_t id = read16l(extra + i);
+        uint32_t n = read16l(extra + i + 2);
+        const uint8_t *p = extra + i + 4;
+        const uint8_t *end = p + n;
+
+        if (i + 4 + n > len)
+            return;
+
+        if (id == 0x0001) {
+            if (usize64 && p + 8 <= end) {
+                e->usize = read64l(p);
+                p += 8;
+            }
+            if (csize64 && p + 8 <= end) {
+                e->csize = read64l(p);
+                p += 8;
+            }
+            if (offset64 && p + 8 <= end) {
+                e->header = (off_t) read64l(p);
+            }
+            return;
+        }
+
+        i += 4 + n;
+    }
+}
+
+/* Keep the members that could be modules, skip directories and encrypted files */
+static int index_entries(struct archive *a, size_t cd_size, uint64_t max) {
+    size_t pos = 0;
+
+    a->entries = malloc(max * sizeof(struct archive_entry));
+    if (a->entries == NULL)
+        return -1;
+
+    while (pos + CDH_SIZE <= cd_size && (uint64_t) a->num < max) {
+        const uint8_t *h = a->cd + pos;
+        struct archive_entry *e = &a->entries[a->num];
+        uint32_t flags, method, name_len, extra_len, comment_len;
+
+        if (memcmp(h, "PK\x01\x02", 4))
+            break;
+
+        flags = read16l(h + 8);
+        method = read16l(h + 10);
+        name_len = read16l(h + 28);
+        extra_len = read16l(h + 30);
+        comment_len = read16l(h + 32);
+
+        if (pos + CDH_SIZE + name_len + extra_len > cd_size)
+            break;
+
+        e->csize = read32l(h + 20);
+        e->usize = read32l(h + 24);
+        e->header = read32l(h + 42);
+        e->name = pos + CDH_SIZE;
+        e->name_len = name_len;
+        e->format = method == 0 ? DEPACK_STORED : DEPACK_DEFLATE;
+
+        read_zip64(h + CDH_SIZE + name_len, extra_len, e, e->usize == 0xffffffff,
+                   e->csize == 0xffffffff, e->header == 0xffffffff);
+
+        if (!(flags & 0x01) && (method == 0 || method == 8) && name_len > 0 &&
+            h[CDH_SIZE + name_len - 1] != '/' && e->csize > 0 && e->usize > 0 &&
+            e->usize <= DEPACK_MAX_SIZE && e->header + LOCAL_SIZE <= a->size) {
+            a->num++;
+        }
+
+        pos += CDH_SIZE + name_len + extra_len + comment_len;
+    }
+
+    return 0;
+}
+
+/*
+ * Index the zip archive in fd, which the archive then owns. Returns NULL,
+ * leaving fd open, if it isn't a readable zip file.
+ */
+struct archive *archive_open(int fd) {
+    uint64_t num, cd_size, cd_off;
+    struct archive *a;
+    struct stat st;
+    off_t base;
+    long page = sysconf(_SC_PAGESIZE);
+
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size < EOCD_SIZE)
+        return NULL;
+
+    if (find_directory(fd, st.st_size, &num, &cd_size, &cd_off) < 0 || cd_size == 0 ||
+        cd_off + cd_size > (uint64_t) st.st_size)
+        return NULL;
+
+    a = calloc(1, sizeof(struct archive));
+    if (a == NULL)
+        return NULL;
+
+    base = cd_off & ~((uint64_t) page - 1);
+    a->map_len = cd_off - base + cd_size;
+    a->map = mmap(NULL, a->map_len, PROT_READ, MAP_PRIVATE, fd, base);
+    if (a->map == MAP_FAILED) {
+        free(a);
+        return NULL;
+    }
+
+    a->fd = fd;
+    a->size = st.st_size;
+    a->cd = (const uint8_t *) a->map + (cd_off - base);
+
+    /* Don't trust the entry count further than the directory can hold */
+    if (num > cd_size / CDH_SIZE)
+        num = cd_size / CDH_SIZE;
+
+    madvise(a->map, a->map_len, MADV_SEQUENTIAL);
+
+    if (index_entries(a, cd_size, num) < 0) {
+        munmap(a->map, a->map_len);
+        free(a);
+        return NULL;
+    }
+
+    return a;
+}
+
+void archive_close(struct archive *a) {
+    if (a == NULL)
+        return;
+
+    munmap(a->map, a->map_len);
+    free(a->entries);
+    close(a->fd);
+    free(a);
+}
+
+int archive_count(const struct archive *a) {
+    return a->num;
+}
+
+int archive_name(const struct archive *a, int i, char *buf, size_t size) {
+    size_t len;
+
+    if (i < 0 || i >= a->num || size == 0)
+        return -1;
+
+    len = a->entries[i].name_len < size - 1 ? a->entries[i].name_len : size - 1;
+    memcpy(buf, a->cd + a->entries[i].name, len);
+    buf[len] = 0;
+
+    return 0;
+}
+
+/* Map the compressed bytes of a member */
+static int map_member(struct archive *a, int i, struct member *m) {
+    const struct archive_entry *e;
+    uint8_t lh[LOCAL_SIZE];
+    off_t data, base;
+    long page = sysconf(_SC_PAGESIZE);
+
+    if (i < 0 || i >= a->num)
+        return -1;
+
+    e = &a->entries[i];
+
+    if (pread(a->fd, lh, LOCAL_SIZE, e->header) != LOCAL_SIZE || memcmp(lh, "PK\x03\x04", 4))
+        return -1;
+
+    data = e->header + LOCAL_SIZE + read16l(lh + 26) + read16l(lh + 28);
+    if ((uint64_t) data + e->csize > (uint64_t) a->size)
+        return -1;
+
+    base = data & ~((off_t) page - 1);
+    m->map_len = data - base + e->csize;
+    m->map = mmap(NULL, m->map_len, PROT_READ, MAP_PRIVATE, a->fd, base);
+    if (m->map == MAP_FAILED)
+        return -1;
+
+    m->data = (const uint8_t *) m->map + (data - base);
+
+    return 0;
+}
+
+static void unmap_member(struct member *m) {
+    munmap(m->map, m->map_len);
+}
+
+/*
+ * Test member i, like xmp_test_module_from_memory on its contents. Only
+ * the start of it is inflated unless that isn't enough for the probe.
+ */
+int archive_test(struct archive *a, int i, struct xmp_test_info *ti) {
+    const struct archive_entry *e;
+    struct member m;
+    struct depacked d;
+    uint8_t *buf;
+    ssize_t n;
+    int res = -1;
+
+    if (map_member(a, i, &m) < 0)
+        return -1;
+
+    e = &a->entries[i];
+
+    buf = malloc(TEST_PREFIX);
+    if (buf != NULL) {
+        n = depack_prefix(m.data, e->csize, e->format, buf, TEST_PREFIX);
+        if (n > 0)
+            res = probe_memory(buf, n, ti);
+        free(buf);
+
+        if (res != 0 && n >= 0 && (uint64_t) n < e->usize && e->usize <= FULL_TEST_SIZE &&
+            depack_stream(m.data, e->csize, e->usize, e->format, &d) == 0) {
+            res = probe_memory(d.data, d.len, ti);
+            depack_free(&d);
+        }
+    }
+
+    unmap_member(&m);
+
+    return res;
+}
+
+/* Depack member i into memory, release it with depack_free */
+int archive_depack(struct archive *a, int i, struct depacked *out) {
+    const struct archive_entry *e;
+    struct member m;
+    int res;
+
+    if (map_member(a, i, &m) < 0)
+        return -1;
+
+    e = &a->entries[i];
+
+    madvise(m.map, m.map_len, MADV_SEQUENTIAL);
+    res = depack_stream(m.data, e->csize, e->usize, e->format, out);
+    unmap_member(&m);
+
+    return res;
+}
+
+/*
+ * Load a module file, or member of a zip archive file when member isn't
+ * negative. Phases are recorded in report unless it is NULL.
+ */
+int archive_load(xmp_context c, FILE *f, off_t size, int member, struct load_report *report) {
+    struct archive *a;
+    struct depacked d;
+    int fd, res;
+
+    if (member < 0)
+        return depack_load(c, f, size, report);
+
+    fd = dup(fileno(f));
+    if (fd < 0)
+        return -XMP_ERROR_SYSTEM;
+
+    a = archive_open(fd);
+    if (a == NULL) {
+        close(fd);
+        return -XMP_ERROR_FORMAT;
+    }
+
+    res = archive_depack(a, member, &d);
+    archive_close(a);
+    load_phase(report, LOAD_DEPACK);
+
+    if (res < 0)
+        return -XMP_ERROR_DEPACK;
+
+    res = xmp_load_module_from_memory(c, d.data, d.len);
+    depack_free(&d);
+    load_phase(report, LOAD_PARSE);
+
+    return res;
+}
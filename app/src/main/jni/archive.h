@@ -0,0 +1,27 @@
+#ifndef XMP_JNI_ARCHIVE_H
+#define XMP_JNI_ARCHIVE_H
+
+#include "depack.h"
+#include "loadreport.h"
+#include "xmp.h"
+#include <stddef.h>
+#include <stdio.h>
+#include <sys/types.h>
+
+struct archive;
+
+struct archive *archive_open(int);
+
+void archive_close(struct archive *);
+
+int archive_count(const struct archive *);
+
+int archive_name(const struct archive *, int, char *, size_t);
+
+int archive_test(struct archive *, int, struct xmp_test_info *);
+
+int archive_depack(struct archive *, int, struct depacked *);
+
+int archive_load(xmp_context, FILE *, off_t, int, struct load_report *);
+
+#endif
@@ -1,6 +1,12 @@
 #ifndef XMP_JNI_AUDIO_H
 #define XMP_JNI_AUDIO_H
 
+#include <stddef.h>
+#include <stdint.h>
+
+/* Duration of one output buffer in ms */
+#define BUFFER_TIME 40
+
 #define INC(x, max) do { \
     if (++(x) >= (max)) { (x) = 0; } \
 } while (0)
@@ -13,11 +19,17 @@ void drop_audio(void);
 
 int fill_buffer(int);
 
+void *get_audio_buffer(size_t *);
+
+int get_buffer_frames(void);
+
+int get_output_rate(void);
+
 int get_volume(void);
 
 int has_free_buffer(void);
 
-int open_audio(int, int);
+int open_audio(int, int, int);
 
 int play_audio(void);
 
@@ -31,4 +43,6 @@ int stop_audio(void);
 
 void close_audio(void);
 
+int wait_free_buffer(int, int64_t *);
+
 #endif
@@ -0,0 +1,472 @@
+/*
+ * In-memory depacking of gzip and zip modules, with a depacked file cache
+ *
+ * libxmp depacks compressed modules itself, through its own buffers, every
+ * time one is tested or loaded. Here the packed file is mapped, hashed and
+ * inflated with zlib into anonymous memory that goes straight to
+ * xmp_load_module_from_memory. The result is also kept in a size-bounded
+ * cache directory keyed by the content hash, so the next test or load of
+ * the same file only hashes it and maps the cached copy. Other packers
+ * are still left to libxmp.
+ */
+
+#include "depack.h"
+#include "hash.h"
+#include <dirent.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#define MIN_OUTPUT (64 * 1024)
+
+static char cache_dir[PATH_MAX];
+static size_t cache_max;
+static pthread_mutex_t cache_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static uint32_t read16l(const uint8_t *p) {
+    return p[0] | (p[1] << 8);
+}
+
+static uint32_t read32l(const uint8_t *p) {
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t) p[3] << 24);
+}
+
+/* Where depacked files are kept, and how many bytes of them. NULL disables. */
+void depack_set_cache(const char *dir, size_t max) {
+    pthread_mutex_lock(&cache_mutex);
+
+    if (dir != NULL && strlen(dir) < sizeof(cache_dir)) {
+        strcpy(cache_dir, dir);
+        mkdir(cache_dir, 0700);
+    } else {
+        cache_dir[0] = 0;
+    }
+    cache_max = max;
+
+    pthread_mutex_unlock(&cache_mutex);
+}
+
+static void cache_path(char *path, size_t size, uint64_t key, const char *suffix) {
+    snprintf(path, size, "%s/%016llx%s", cache_dir, (unsigned long long) key, suffix);
+}
+
+static int cache_open(uint64_t key, struct depacked *out) {
+    char path[PATH_MAX];
+    struct stat st;
+    void *data;
+    int fd;
+
+    pthread_mutex_lock(&cache_mutex);
+    if (cache_dir[0] == 0) {
+        pthread_mutex_unlock(&cache_mutex);
+        return -1;
+    }
+    cache_path(path, sizeof(path), key, "");
+    pthread_mutex_unlock(&cache_mutex);
+
+    fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return -1;
+
+    if (fstat(fd, &st) != 0 || st.st_size <= 0) {
+        close(fd);
+        return -1;
+    }
+
+    data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+    /* The mtime orders entries for eviction */
+    futimens(fd, NULL);
+    close(fd);
+
+    if (data == MAP_FAILED)
+        return -1;
+
+    out->data = data;
+    out->len = st.st_size;
+
+    return 0;
+}
+
+struct cache_entry {
+    char name[32];
+    off_t size;
+    time_t mtime;
+};
+
+static int by_mtime(const void *a, const void *b) {
+    time_t ta = ((const struct cache_entry *) a)->mtime;
+    time_t tb = ((const struct cache_entry *) b)->mtime;
+
+    return ta < tb ? -1 : ta > tb ? 1 : 0;
+}
+
+/* Evict least recently used entries until the cache fits, call locked */
+static void cache_trim(void) {
+    struct cache_entry *list = NULL;
+    int num = 0, cap = 0, i;
+    char path[PATH_MAX];
+    struct dirent *de;
+    struct stat st;
+    off_t total = 0;
+    DIR *dir;
+
+    dir = opendir(cache_dir);
+    if (dir == NULL)
+        return;
+
+    while ((de = readdir(dir)) != NULL) {
+        if (de->d_name[0] == '.' || strlen(de->d_name) >= sizeof(list->name) ||
+            strchr(de->d_name, '.') != NULL)
+            continue;
+
+        snprintf(path, sizeof(path), "%s/%s", cache_dir, de->d_name);
+        if (stat(path, &st) != 0)
+            continue;
+
+        if (num >= cap) {
+            struct cache_entry *l;
+
+            cap = cap > 0 ? cap * 2 : 32;
+            l = realloc(list, cap * sizeof(struct cache_entry));
+            if (l == NULL)
+                break;
+            list = l;
+        }
+
+        strcpy(list[num].name, de->d_name);
+        list[num].size = st.st_size;
+        list[num].mtime = st.st_mtime;
+        total += st.st_size;
+        num++;
+    }
+
+    closedir(dir);
+
+    qsort(list, num, sizeof(struct cache_entry), by_mtime);
+
+    for (i = 0; i < num && total > (off_t) cache_max; i++) {
+        snprintf(path, sizeof(path), "%s/%s", cache_dir, list[i].name);
+        if (unlink(path) == 0)
+            total -= list[i].size;
+    }
+
+    free(list);
+}
+
+static void cache_store(uint64_t key, const struct depacked *d) {
+    char path[PATH_MAX], tmp[PATH_MAX], suffix[24];
+    const uint8_t *p = d->data;
+    size_t left = d->len;
+    int fd, stored = 0;
+
+    pthread_mutex_lock(&cache_mutex);
+
+    if (cache_dir[0] == 0 || d->len > cache_max) {
+        pthread_mutex_unlock(&cache_mutex);
+        return;
+    }
+
+    /* Several threads may depack the same file, each writes its own tmp */
+    snprintf(suffix, sizeof(suffix), ".%d.tmp", gettid());
+    cache_path(tmp, sizeof(tmp), key, suffix);
+
+    pthread_mutex_unlock(&cache_mutex);
+
+    /* The payload is written unlocked, so cache lookups don't wait on it */
+    fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (fd < 0)
+        return;
+
+    while (left > 0) {
+        ssize_t n = write(fd, p, left);
+        if (n <= 0)
+            break;
+        p += n;
+        left -= n;
+    }
+
+    if (close(fd) == 0 && left == 0) {
+        pthread_mutex_lock(&cache_mutex);
+
+        /* The cache may have been moved or disabled meanwhile */
+        if (cache_dir[0] != 0) {
+            cache_path(path, sizeof(path), key, "");
+            if (rename(tmp, path) == 0) {
+                cache_trim();
+                stored = 1;
+            }
+        }
+
+        pthread_mutex_unlock(&cache_mutex);
+    }
+
+    if (!stored)
+        unlink(tmp);
+}
+
+/*
+ * Find the compressed stream of a packed file and the size it inflates
+ * to, 0 if unknown. Returns the stream format or -1.
+ */
+static int find_stream(const uint8_t *in, size_t len, const uint8_t **start,
+                       size_t *inlen, size_t *outlen) {
+    if (len >= 18 && in[0] == 0x1f && in[1] == 0x8b && in[2] == 8) {
+        *start = in;
+        *inlen = len;
+        *outlen = read32l(in + len - 4);
+        return DEPACK_GZIP;
+    }
+
+    if (len >= 30 && !memcmp(in, "PK\x03\x04", 4)) {
+        uint32_t flags = read16l(in + 6);
+        uint32_t method = read16l(in + 8);
+        size_t offset = 30 + read16l(in + 26) + read16l(in + 28);
+
+        /* Encrypted, or sizes only known from the data descriptor */
+        if ((flags & 0x09) || (method != 0 && method != 8) || offset > len)
+            return -1;
+
+        *start = in + offset;
+        *inlen = read32l(in + 18);
+        *outlen = read32l(in + 22);
+
+        if (*inlen > len - offset)
+            return -1;
+
+        return method == 0 ? DEPACK_STORED : DEPACK_DEFLATE;
+    }
+
+    return -1;
+}
+
+static void *grow(void *buf, size_t old, size_t size) {
+    void *p;
+
+    if (buf == NULL) {
+        p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    } else {
+        p = mremap(buf, old, size, MREMAP_MAYMOVE);
+    }
+
+    return p == MAP_FAILED ? NULL : p;
+}
+
+/* Inflate into anonymous memory, grown as needed */
+static int inflate_stream(const uint8_t *in, size_t inlen, size_t hint, int format,
+                          struct depacked *out) {
+    size_t cap = hint > MIN_OUTPUT ? hint : MIN_OUTPUT;
+    uint8_t *buf = NULL;
+    z_stream zs;
+    int res = Z_OK;
+
+    if (cap > DEPACK_MAX_SIZE)
+        cap = DEPACK_MAX_SIZE;
+
+    memset(&zs, 0, sizeof(zs));
+    if (inflateInit2(&zs, format == DEPACK_GZIP ? 16 + MAX_WBITS : -MAX_WBITS) != Z_OK)
+        return -1;
+
+    buf = grow(NULL, 0, cap);
+    if (buf == NULL) {
+        inflateEnd(&zs);
+        return -1;
+    }
+
+    zs.next_in = (Bytef *) in;
+    zs.avail_in = inlen;
+
+    while (res == Z_OK) {
+        if (zs.total_out >= cap) {
+            uint8_t *b;
+
+            if (cap >= DEPACK_MAX_SIZE)
+                break;
+
+            b = grow(buf, cap, cap * 2 < DEPACK_MAX_SIZE ? cap * 2 : DEPACK_MAX_SIZE);
+            if (b == NULL)
+                break;
+            cap = cap * 2 < DEPACK_MAX_SIZE ? cap * 2 : DEPACK_MAX_SIZE;
+            buf = b;
+        }
+
+        zs.next_out = buf + zs.total_out;
+        zs.avail_out = cap - zs.total_out;
+        res = inflate(&zs, Z_NO_FLUSH);
+    }
+
+    inflateEnd(&zs);
+
+    if (res != Z_STREAM_END || zs.total_out == 0) {
+        munmap(buf, cap);
+        return -1;
+    }
+
+    out->data = buf;
+    out->len = zs.total_out;
+
+    /* Give back the unused tail */
+    if (out->len < cap) {
+        uint8_t *b = mremap(buf, cap, out->len, 0);
+        if (b == MAP_FAILED) {
+            /* munmap takes whole pages, keep the one the data ends in */
+            size_t page = sysconf(_SC_PAGESIZE);
+            size_t keep = (out->len + page - 1) & ~(page - 1);
+
+            if (keep < cap)
+                munmap(buf + keep, cap - keep);
+        }
+    }
+
+    return 0;
+}
+
+static int copy_stored(const uint8_t *in, size_t len, struct depacked *out) {
+    out->data = grow(NULL, 0, len);
+    if (out->data == NULL)
+        return -1;
+
+    memcpy(out->data, in, len);
+    out->len = len;
+
+    return 0;
+}
+
+/*
+ * Depack a stream into memory, or map its depacked copy from the cache.
+ * Stored data is just copied, that's as fast as reading the cache.
+ */
+int depack_stream(const void *in, size_t inlen, size_t outlen, int format,
+                  struct depacked *out) {
+    uint64_t key;
+    int res;
+
+    if (inlen == 0)
+        return -1;
+
+    if (format == DEPACK_STORED)
+        return copy_stored(in, inlen, out);
+
+    key = hash64(in, inlen, format);
+
+    if (cache_open(key, out) == 0)
+        return 0;
+
+    res = inflate_stream(in, inlen, outlen, format, out);
+
+    if (res == 0)
+        cache_store(key, out);
+
+    return res;
+}
+
+/*
+ * Inflate at most len bytes from the start of a stream, enough to probe
+ * it without depacking all of it. Returns the number of bytes or -1.
+ */
+ssize_t depack_prefix(const void *in, size_t inlen, int format, void *buf, size_t len) {
+    z_stream zs;
+    int res;
+
+    if (format == DEPACK_STORED) {
+        len = inlen < len ? inlen : len;
+        memcpy(buf, in, len);
+        return len;
+    }
+
+    memset(&zs, 0, sizeof(zs));
+    if (inflateInit2(&zs, format == DEPACK_GZIP ? 16 + MAX_WBITS : -MAX_WBITS) != Z_OK)
+        return -1;
+
+    zs.next_in = (Bytef *) in;
+    zs.avail_in = inlen;
+    zs.next_out = buf;
+    zs.avail_out = len;
+
+    do {
+        res = inflate(&zs, Z_SYNC_FLUSH);
+    } while (res == Z_OK && zs.avail_out > 0);
+
+    inflateEnd(&zs);
+
+    if (res != Z_OK && res != Z_STREAM_END && res != Z_BUF_ERROR)
+        return -1;
+
+    return zs.total_out;
+}
+
+/*
+ * Depack a gzip or zip module file into memory. Fails for anything else,
+ * those go through libxmp. Release the result with depack_free.
+ */
+int depack_fd(int fd, struct depacked *out) {
+    const uint8_t *in, *start;
+    size_t inlen, outlen;
+    uint8_t magic[4];
+    struct stat st;
+    int format, res;
+
+    if (pread(fd, magic, 4, 0) != 4 || !(!memcmp(magic, "\x1f\x8b", 2) ||
+                                         !memcmp(magic, "PK\x03\x04", 4)))
+        return -1;
+
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size < 18 ||
+        st.st_size > DEPACK_MAX_SIZE)
+        return -1;
+
+    in = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (in == MAP_FAILED)
+        return -1;
+
+    format = find_stream(in, st.st_size, &start, &inlen, &outlen);
+    if (format < 0) {
+        munmap((void *) in, st.st_size);
+        return -1;
+    }
+
+    madvise((void *) in, st.st_size, MADV_SEQUENTIAL);
+    res = depack_stream(start, inlen, outlen, format, out);
+    munmap((void *) in, st.st_size);
+
+    return res;
+}
+
+void depack_free(struct depacked *d) {
+    if (d->data != NULL)
+        munmap(d->data, d->len);
+
+    d->data = NULL;
+    d->len = 0;
+}
+
+/*
+ * Load a module file, depacked in memory when it's compressed with a
+ * format handled here
+ */
+int depack_load(xmp_context c, FILE *f, off_t size, struct load_report *report) {
+    struct depacked d;
+    int res;
+
+    if (depack_fd(fileno(f), &d) == 0) {
+        load_phase(report, LOAD_DEPACK);
+        res = xmp_load_module_from_memory(c, d.data, d.len);
+        depack_free(&d);
+        load_phase(report, LOAD_PARSE);
+        return res;
+    }
+
+    rewind(f);
+    load_phase(report, LOAD_DEPACK);
+
+    res = xmp_load_module_from_file(c, f, size);
+    load_phase(report, LOAD_PARSE);
+
+    return res;
+}
@@ -0,0 +1,36 @@
+#ifndef XMP_JNI_DEPACK_H
+#define XMP_JNI_DEPACK_H
+
+#include "loadreport.h"
+#include "xmp.h"
+#include <stddef.h>
+#include <stdio.h>
+#include <sys/types.h>
+
+/* Refuse to inflate past this, compressed modules are never that large */
+#define DEPACK_MAX_SIZE (256 * 1024 * 1024)
+
+enum {
+    DEPACK_STORED,
+    DEPACK_DEFLATE,
+    DEPACK_GZIP
+};
+
+struct depacked {
+    void *data;
+    size_t len;
+};
+
+void depack_set_cache(const char *, size_t);
+
+int depack_stream(const void *, size_t, size_t, int, struct depacked *);
+
+ssize_t depack_prefix(const void *, size_t, int, void *, size_t);
+
+int depack_fd(int, struct depacked *);
+
+void depack_free(struct depacked *);
+
+int depack_load(xmp_context, FILE *, off_t, struct load_report *);
+
+#endif
@@ -0,0 +1,237 @@
+/*
+ * Fit huge modules into a memory budget by reducing sample quality
+ *
+ * Runs right after load. While the module is over budget the largest
+ * samples are mixed down from stereo to mono, then reduced from 16 to
+ * 8 bits, then resampled to half rate and transposed up an octave to
+ * keep their pitch. Each reduced sample is rebuilt through libxmp's own
+ * sample loader, so guard bytes and loop unrolling stay consistent with
+ * what the mixer expects.
+ */
+
+#include "downgrade.h"
+#include "common.h"
+#include "loader.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef XMP_SAMPLE_STEREO
+#define XMP_SAMPLE_STEREO 0
+#endif
+
+enum {
+    STEP_MONO,
+    STEP_8BIT,
+    STEP_HALVE,
+    NUM_STEPS
+};
+
+/* Halving shorter samples saves next to nothing and hurts the most */
+#define MIN_HALVE_FRAMES 4096
+
+/* Bytes of sample data, without libxmp's guard and unroll bytes */
+size_t sample_bytes(const struct xmp_sample *xxs) {
+    size_t frame = xxs->flg & XMP_SAMPLE_16BIT ? 2 : 1;
+
+    if (xxs->flg & XMP_SAMPLE_STEREO)
+        frame *= 2;
+
+    return (size_t) xxs->len * frame;
+}
+
+/* Approximate heap footprint of a loaded module */
+size_t module_footprint(const struct xmp_module *mod) {
+    size_t bytes = sizeof(struct xmp_module);
+    int i;
+
+    if (mod == NULL)
+        return 0;
+
+    for (i = 0; i < mod->smp; i++) {
+        bytes += sizeof(struct xmp_sample) + sample_bytes(&mod->xxs[i]);
+    }
+
+    for (i = 0; i < mod->trk; i++) {
+        if (mod->xxt[i] != NULL)
+            bytes += sizeof(struct xmp_track) + mod->xxt[i]->rows * sizeof(struct xmp_event);
+    }
+
+    bytes += (size_t) mod->pat * (sizeof(struct xmp_pattern) + mod->chn * sizeof(int));
+
+    for (i = 0; i < mod->ins; i++) {
+        bytes += sizeof(struct xmp_instrument) +
+                 mod->xxi[i].nsm * sizeof(struct xmp_subinstrument);
+    }
+
+    return bytes;
+}
+
+static int applies(const struct xmp_sample *xxs, int step) {
+    if (xxs->data == NULL || xxs->len <= 0 || (xxs->flg & XMP_SAMPLE_SYNTH))
+        return 0;
+
+    switch (step) {
+    case STEP_MONO:
+        return (xxs->flg & XMP_SAMPLE_STEREO) != 0;
+    case STEP_8BIT:
+        return (xxs->flg & XMP_SAMPLE_16BIT) != 0;
+    case STEP_HALVE:
+        return xxs->len >= MIN_HALVE_FRAMES;
+    }
+
+    return 0;
+}
+
+static int get_frame(const struct xmp_sample *xxs, int i, int ch) {
+    int chn = xxs->flg & XMP_SAMPLE_STEREO ? 2 : 1;
+
+    if (xxs->flg & XMP_SAMPLE_16BIT)
+        return ((const int16_t *) xxs->data)[i * chn + ch];
+
+    return ((const int8_t *) xxs->data)[i * chn + ch] << 8;
+}
+
+/* Convert a sample into a new format, as 16-bit values scaled on store */
+static int reduce(struct module_data *m, struct xmp_sample *xxs, int step) {
+    struct xmp_sample out = *xxs;
+    int chn, i, c;
+    void *buf;
+
+    switch (step) {
+    case STEP_MONO:
+        out.flg &= ~XMP_SAMPLE_STEREO;
+        break;
+    case STEP_8BIT:
+        out.flg &= ~XMP_SAMPLE_16BIT;
+        break;
+    case STEP_HALVE:
+        out.len = (xxs->len + 1) / 2;
+        out.lps = xxs->lps / 2;
+        out.lpe = xxs->lpe / 2;
+        break;
+    }
+
+    chn = out.flg & XMP_SAMPLE_STEREO ? 2 : 1;
+    buf = malloc(sample_bytes(&out));
+    if (buf == NULL)
+        return -1;
+
+    for (i = 0; i < out.len; i++) {
+        for (c = 0; c < chn; c++) {
+            int v;
+
+            if (step == STEP_MONO) {
+                v = (get_frame(xxs, i, 0) + get_frame(xxs, i, 1)) / 2;
+            } else if (step == STEP_HALVE) {
+                int j = i * 2 + 1 < xxs->len ? i * 2 + 1 : i * 2;
+                v = (get_frame(xxs, i * 2, c) + get_frame(xxs, j, c)) / 2;
+            } else {
+                v = get_frame(xxs, i, c);
+            }
+
+            if (out.flg & XMP_SAMPLE_16BIT)
+                ((int16_t *) buf)[i * chn + c] = (int16_t) v;
+            else
+                ((int8_t *) buf)[i * chn + c] = (int8_t) (v >> 8);
+        }
+    }
+
+    libxmp_free_sample(xxs);
+    out.data = NULL;
+    *xxs = out;
+
+    if (libxmp_load_sample(m, NULL, SAMPLE_FLAG_NOLOAD, xxs, buf) < 0) {
+        free(buf);
+        xxs->len = 0;
+        return -1;
+    }
+
+    free(buf);
+
+    return 0;
+}
+
+/* Keep the pitch of a half rate sample, everywhere it's used */
+static void transpose(struct xmp_module *mod, int smp) {
+    int i, j;
+
+    for (i = 0; i < mod->ins; i++) {
+        for (j = 0; j < mod->xxi[i].nsm; j++) {
+            if (mod->xxi[i].sub[j].sid == smp)
+                mod->xxi[i].sub[j].xpo += 12;
+        }
+    }
+}
+
+struct order {
+    int smp;
+    size_t bytes;
+};
+
+static int by_size(const void *a, const void *b) {
+    size_t sa = ((const struct order *) a)->bytes;
+    size_t sb = ((const struct order *) b)->bytes;
+
+    return sa < sb ? 1 : sa > sb ? -1 : 0;
+}
+
+/*
+ * Reduce samples until the module fits in budget bytes. Returns the number
+ * of samples changed, the report says which steps were needed.
+ */
+int downgrade_module(xmp_context ctx, size_t budget, struct downgrade_report *rep) {
+    struct context_data *cd = (struct context_data *) ctx;
+    struct module_data *m = &cd->m;
+    struct xmp_module *mod = &m->mod;
+    size_t total;
+    struct order *order;
+    int step, i, num = 0;
+
+    memset(rep, 0, sizeof(struct downgrade_report));
+    total = rep->before = rep->after = module_footprint(mod);
+
+    if (total <= budget || mod->smp <= 0)
+        return 0;
+
+    order = malloc(mod->smp * sizeof(struct order));
+    if (order == NULL)
+        return -1;
+
+    for (step = 0; step < NUM_STEPS && total > budget; step++) {
+        for (i = 0; i < mod->smp; i++) {
+            order[i].smp = i;
+            order[i].bytes = sample_bytes(&mod->xxs[i]);
+        }
+
+        qsort(order, mod->smp, sizeof(struct order), by_size);
+
+        for (i = 0; i < mod->smp && total > budget; i++) {
+            struct xmp_sample *xxs = &mod->xxs[order[i].smp];
+
+            if (!applies(xxs, step) || reduce(m, xxs, step) < 0)
+                continue;
+
+            total = total - order[i].bytes + sample_bytes(xxs);
+            num++;
+
+            switch (step) {
+            case STEP_MONO:
+                rep->mono++;
+                break;
+            case STEP_8BIT:
+                rep->eight_bit++;
+                break;
+            case STEP_HALVE:
+                transpose(mod, order[i].smp);
+                rep->halved++;
+                break;
+            }
+        }
+    }
+
+    free(order);
+    rep->after = module_footprint(mod);
+
+    return num;
+}
@@ -0,0 +1,21 @@
+#ifndef XMP_JNI_DOWNGRADE_H
+#define XMP_JNI_DOWNGRADE_H
+
+#include "xmp.h"
+#include <stddef.h>
+
+struct downgrade_report {
+    int mono;           /* stereo samples mixed down to mono */
+    int eight_bit;      /* 16-bit samples reduced to 8-bit */
+    int halved;         /* samples resampled to half rate */
+    size_t before;      /* module footprint in bytes before and after */
+    size_t after;
+};
+
+size_t sample_bytes(const struct xmp_sample *);
+
+size_t module_footprint(const struct xmp_module *);
+
+int downgrade_module(xmp_context, size_t, struct downgrade_report *);
+
+#endif
@@ -0,0 +1,256 @@
+/*
+ * Whole-song amplitude envelope for the seek bar
+ *
+ * The module is loaded a second time into a private context and rendered
+ * on a low priority thread at a low rate, in mono, without interpolation.
+ * Output is reduced to a fixed number of RMS/peak buckets. Nothing here
+ * touches the player context or its lock.
+ */
+
+#include "envelope.h"
+#include "archive.h"
+#include "xmp.h"
+#include <math.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/* Render rate of the analysis pass, only the envelope shape matters */
+#define ENVELOPE_RATE 8000
+#define ENVELOPE_FRAMES 1024
+
+/* Background thread niceness, keep well below the render thread */
+#define ENVELOPE_NICE 15
+
+static int env_fd = -1;
+static int env_member;
+static int env_sequence;
+static int env_buckets;
+static int env_running;
+static short *env_rms;
+static short *env_peak;
+static atomic_int env_done;
+static atomic_int env_failed;
+static atomic_int env_cancel;
+static pthread_t env_thread;
+static pthread_mutex_t env_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/* Serializes start and stop, called from the UI side and from deinit */
+static pthread_mutex_t env_control = PTHREAD_MUTEX_INITIALIZER;
+
+static void put_bucket(int b, int64_t sum, int n, int peak) {
+    env_rms[b] = n > 0 ? (short) sqrt((double) sum / n) : 0;
+    env_peak[b] = (short) (peak > 32767 ? 32767 : peak);
+    atomic_store(&env_done, b + 1);
+}
+
+static int analyze(xmp_context c) {
+    struct xmp_module_info info;
+    short buf[ENVELOPE_FRAMES];
+    int64_t total, bucket_len, pos, sum;
+    int b, n, peak, i;
+
+    xmp_get_module_info(c, &info);
+
+    if (env_sequence >= info.num_sequences)
+        return -1;
+
+    total = (int64_t) info.seq_data[env_sequence].duration * ENVELOPE_RATE / 1000;
+    if (total <= 0)
+        return -1;
+
+    bucket_len = (total + env_buckets - 1) / env_buckets;
+
+    if (xmp_start_player(c, ENVELOPE_RATE, XMP_FORMAT_MONO) != 0)
+        return -1;
+
+    xmp_set_player(c, XMP_PLAYER_INTERP, XMP_INTERP_NEAREST);
+    xmp_set_player(c, XMP_PLAYER_DSP, 0);
+    xmp_set_position(c, info.seq_data[env_sequence].entry_point);
+
+    b = 0;
+    pos = 0;
+    sum = 0;
+    n = 0;
+    peak = 0;
+
+    while (b < env_buckets && !atomic_load(&env_cancel)) {
+        if (xmp_play_buffer(c, buf, sizeof(buf), 1) < 0)
+            break;
+
+        for (i = 0; i < ENVELOPE_FRAMES; i++) {
+            int s = buf[i];
+            int a = s < 0 ? -s : s;
+
+            sum += s * s;
+            if (a > peak)
+                peak = a;
+
+            if (++n + pos >= bucket_len * (b + 1)) {
+                put_bucket(b, sum, n, peak);
+                pos += n;
+                sum = 0;
+                n = 0;
+                peak = 0;
+                if (++b >= env_buckets)
+                    break;
+            }
+        }
+    }
+
+    xmp_end_player(c);
+
+    if (atomic_load(&env_cancel))
+        return -1;
+
+    /* Song ended early, the remaining buckets stay silent */
+    if (b < env_buckets) {
+        put_bucket(b, sum, n, peak);
+        atomic_store(&env_done, env_buckets);
+    }
+
+    return 0;
+}
+
+static void *envelope_thread(void *arg) {
+    xmp_context c;
+    struct stat st;
+    FILE *f;
+    int res = -1;
+
+    (void) arg;
+
+    setpriority(PRIO_PROCESS, gettid(), ENVELOPE_NICE);
+
+    f = fdopen(env_fd, "r");
+    if (f == NULL) {
+        close(env_fd);
+        atomic_store(&env_failed, 1);
+        return NULL;
+    }
+
+    /* Loading can't be interrupted, but a cancel during it skips the scan */
+    c = atomic_load(&env_cancel) ? NULL : xmp_create_context();
+    if (c != NULL) {
+        if (fstat(env_fd, &st) == 0 && archive_load(c, f, st.st_size, env_member, NULL) == 0) {
+            if (!atomic_load(&env_cancel))
+                res = analyze(c);
+            xmp_release_module(c);
+        }
+        xmp_free_context(c);
+    }
+
+    fclose(f);
+
+    if (res < 0)
+        atomic_store(&env_failed, 1);
+
+    return NULL;
+}
+
+static void stop(void) {
+    if (env_running) {
+        atomic_store(&env_cancel, 1);
+        pthread_join(env_thread, NULL);
+        env_running = 0;
+    }
+
+    pthread_mutex_lock(&env_mutex);
+
+    free(env_rms);
+    free(env_peak);
+    env_rms = NULL;
+    env_peak = NULL;
+    env_buckets = 0;
+    env_fd = -1;
+    atomic_store(&env_done, 0);
+
+    pthread_mutex_unlock(&env_mutex);
+}
+
+/*
+ * Start analyzing the given sequence of the module in fd, or of a zip
+ * member if member isn't negative. The fd is owned by the analysis from
+ * here on, even on failure.
+ */
+int envelope_start(int fd, int member, int sequence, int buckets) {
+    pthread_mutex_lock(&env_control);
+
+    stop();
+
+    if (buckets <= 0 || buckets > ENVELOPE_MAX_BUCKETS) {
+        pthread_mutex_unlock(&env_control);
+        close(fd);
+        return -1;
+    }
+
+    pthread_mutex_lock(&env_mutex);
+    env_rms = calloc(buckets, sizeof(short));
+    env_peak = calloc(buckets, sizeof(short));
+    pthread_mutex_unlock(&env_mutex);
+
+    if (env_rms == NULL || env_peak == NULL) {
+        close(fd);
+        stop();
+        pthread_mutex_unlock(&env_control);
+        return -1;
+    }
+
+    env_fd = fd;
+    env_member = member;
+    env_sequence = sequence;
+    env_buckets = buckets;
+    atomic_store(&env_done, 0);
+    atomic_store(&env_failed, 0);
+    atomic_store(&env_cancel, 0);
+
+    if (pthread_create(&env_thread, NULL, envelope_thread, NULL) != 0) {
+        close(fd);
+        stop();
+        pthread_mutex_unlock(&env_control);
+        return -1;
+    }
+
+    env_running = 1;
+
+    pthread_mutex_unlock(&env_control);
+
+    return 0;
+}
+
+void envelope_stop(void) {
+    pthread_mutex_lock(&env_control);
+    stop();
+    pthread_mutex_unlock(&env_control);
+}
+
+/*
+ * Copy the buckets finished so far. Returns how many are ready, which
+ * reaches the bucket count when done, or -1 if the analysis failed.
+ */
+int envelope_get(short *rms, short *peak, int num) {
+    int done, i;
+
+    if (atomic_load(&env_failed))
+        return -1;
+
+    pthread_mutex_lock(&env_mutex);
+
+    done = atomic_load(&env_done);
+    if (done > num)
+        done = num;
+
+    for (i = 0; i < done; i++) {
+        rms[i] = env_rms[i];
+        peak[i] = env_peak[i];
+    }
+
+    pthread_mutex_unlock(&env_mutex);
+
+    return done;
+}
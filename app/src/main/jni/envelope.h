@@ -0,0 +1,13 @@
+#ifndef XMP_JNI_ENVELOPE_H
+#define XMP_JNI_ENVELOPE_H
+
+/* Most buckets a single envelope can have */
+#define ENVELOPE_MAX_BUCKETS 2048
+
+int envelope_start(int, int, int, int);
+
+void envelope_stop(void);
+
+int envelope_get(short *, short *, int);
+
+#endif
@@ -0,0 +1,182 @@
+/*
+ * Playback change events from the render thread to the UI
+ *
+ * Each frame info snapshot the render thread takes is compared with the
+ * previous one and what changed is pushed into a single producer, single
+ * consumer ring: position, row, tempo, loop count, time in tenths of a
+ * second and the end of the sequence. Events carry the monotonic time
+ * they become audible at, so the consumer can present them in step with
+ * the output instead of when they were rendered.
+ *
+ * The producer never blocks. It signals an eventfd once per snapshot that
+ * changed something and drops events when the ring is full, in which case
+ * the consumer gets an overflow event and reads the state again instead.
+ *
+ * Only the consumer may move the tail, so a new player can't empty the
+ * ring. Events carry the generation they were pushed in instead, and the
+ * consumer skips those left over from before the last reset.
+ */
+
+#include "events.h"
+#include <poll.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/eventfd.h>
+
+static struct event ring[EVENTS_SIZE];
+static atomic_uint head;                /* written by the producer */
+static atomic_uint tail;                /* written by the consumer */
+static atomic_int overflow;
+static atomic_uint generation;
+static int efd = -1;
+static pthread_once_t efd_once = PTHREAD_ONCE_INIT;
+
+/* Producer state, under the player lock */
+static struct xmp_frame_info last;
+static int have_last;
+static int ended;
+
+static void open_eventfd(void) {
+    efd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+}
+
+/* The eventfd lives as long as the process so a waiter never sees it closed */
+int events_init(void) {
+    pthread_once(&efd_once, open_eventfd);
+
+    return efd >= 0 ? 0 : -1;
+}
+
+/* Report everything again from the next snapshot, for a new player */
+void events_reset(void) {
+    have_last = 0;
+    ended = 0;
+    atomic_fetch_add_explicit(&generation, 1, memory_order_relaxed);
+    atomic_store_explicit(&overflow, 0, memory_order_relaxed);
+}
+
+static int push(int64_t pts, int type, int a, int b) {
+    unsigned int h = atomic_load_explicit(&head, memory_order_relaxed);
+    unsigned int t = atomic_load_explicit(&tail, memory_order_acquire);
+    struct event *e;
+
+    if (h - t >= EVENTS_SIZE) {
+        atomic_store_explicit(&overflow, 1, memory_order_relaxed);
+        return 0;
+    }
+
+    e = &ring[h % EVENTS_SIZE];
+    e->pts = pts;
+    e->type = type;
+    e->a = a;
+    e->b = b;
+    e->gen = atomic_load_explicit(&generation, memory_order_relaxed);
+    atomic_store_explicit(&head, h + 1, memory_order_release);
+
+    return 1;
+}
+
+/*
+ * Push what changed in snapshot f, audible at pts, and the end of the
+ * sequence once when end is set. Called from the render thread only.
+ */
+void events_track(const struct xmp_frame_info *f, int64_t pts, int end) {
+    int n = 0;
+
+    if (!have_last || f->pos != last.pos || f->pattern != last.pattern) {
+        n += push(pts, EVENT_POSITION, f->pos, f->pattern);
+    }
+
+    if (!have_last || f->pos != last.pos || f->row != last.row || f->num_rows != last.num_rows) {
+        n += push(pts, EVENT_ROW, f->row, f->num_rows);
+    }
+
+    if (!have_last || f->speed != last.speed || f->bpm != last.bpm) {
+        n += push(pts, EVENT_TEMPO, f->speed, f->bpm);
+    }
+
+    if (!have_last || f->loop_count != last.loop_count) {
+        n += push(pts, EVENT_LOOP, 0, f->loop_count);
+    }
+
+    if (!have_last || f->time / 100 != last.time / 100) {
+        n += push(pts, EVENT_TIME, 0, f->time);
+    }
+
+    if (end && !ended) {
+        n += push(pts, EVENT_END, 0, 0);
+        ended = 1;
+    }
+
+    last = *f;
+    have_last = 1;
+
+    if (n > 0 && efd >= 0) {
+        eventfd_write(efd, 1);
+    }
+}
+
+static int drain(struct event *out, int max) {
+    unsigned int t = atomic_load_explicit(&tail, memory_order_relaxed);
+    unsigned int h = atomic_load_explicit(&head, memory_order_acquire);
+    /* After head, so it is at least as new as any event up to it */
+    unsigned int gen = atomic_load_explicit(&generation, memory_order_relaxed);
+    int n = 0;
+
+    if (max > 0 && atomic_exchange_explicit(&overflow, 0, memory_order_relaxed)) {
+        out[n].pts = 0;
+        out[n].type = EVENT_OVERFLOW;
+        out[n].a = 0;
+        out[n].b = 0;
+        out[n].gen = gen;
+        n++;
+    }
+
+    while (t != h && n < max) {
+        if (ring[t % EVENTS_SIZE].gen == gen)
+            out[n++] = ring[t % EVENTS_SIZE];
+        t++;
+    }
+
+    atomic_store_explicit(&tail, t, memory_order_release);
+
+    return n;
+}
+
+/*
+ * Wait up to timeout ms for events and copy up to max of them to out.
+ * Returns how many, 0 on timeout or events_wake. Single consumer only.
+ */
+int events_wait(struct event *out, int max, int timeout) {
+    struct pollfd pfd;
+    eventfd_t count;
+    int n;
+
+    if (efd < 0)
+        return 0;
+
+    /* Clear the count first, a push after the drain signals it again */
+    eventfd_read(efd, &count);
+
+    n = drain(out, max);
+    if (n > 0)
+        return n;
+
+    pfd.fd = efd;
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+
+    if (poll(&pfd, 1, timeout) <= 0)
+        return 0;
+
+    eventfd_read(efd, &count);
+
+    return drain(out, max);
+}
+
+/* Return a waiting consumer early */
+void events_wake(void) {
+    if (efd >= 0) {
+        eventfd_write(efd, 1);
+    }
+}
@@ -0,0 +1,36 @@
+#ifndef XMP_JNI_EVENTS_H
+#define XMP_JNI_EVENTS_H
+
+#include "xmp.h"
+#include <stdint.h>
+
+/* Capacity of the ring, a power of two */
+#define EVENTS_SIZE 256
+
+#define EVENT_POSITION 0        /* a = position, b = pattern */
+#define EVENT_ROW 1             /* a = row, b = rows in the pattern */
+#define EVENT_TEMPO 2           /* a = speed, b = bpm */
+#define EVENT_LOOP 3            /* b = loop count */
+#define EVENT_TIME 4            /* b = time in ms, every tenth of a second */
+#define EVENT_END 5             /* end of the sequence */
+#define EVENT_OVERFLOW 6        /* events were dropped, read the state again */
+
+struct event {
+    int64_t pts;                /* CLOCK_MONOTONIC ns it becomes audible at */
+    int type;
+    int a;
+    int b;
+    unsigned int gen;           /* events_reset generation it was pushed in */
+};
+
+int events_init(void);
+
+void events_reset(void);
+
+void events_track(const struct xmp_frame_info *, int64_t, int);
+
+int events_wait(struct event *, int, int);
+
+void events_wake(void);
+
+#endif
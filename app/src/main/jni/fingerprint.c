@@ -0,0 +1,185 @@
+/*
+ * Content fingerprints for finding duplicate modules
+ *
+ * The payload hash covers the module file as the loaders see it, after
+ * depacking, so the same module packed with gzip, zip or nothing at all
+ * hashes the same. The content hash covers the loaded song instead: the
+ * events in play order, instrument mappings and sample data, leaving out
+ * titles, names and comments, so it also matches the same song saved
+ * again under another name. Each call works on a private context and
+ * can run on any thread.
+ */
+
+#include "fingerprint.h"
+#include "archive.h"
+#include "downgrade.h"
+#include "hash.h"
+#include "xmp.h"
+#include <stdio.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static void hash_int(struct hash64 *h, int v) {
+    int32_t x = v;
+
+    hash64_update(h, &x, sizeof(x));
+}
+
+/* The payload as loaders see it, released with depack_free */
+static int map_payload(int fd, int member, struct depacked *d) {
+    struct archive *a;
+    struct stat st;
+    int afd, res;
+
+    if (member >= 0) {
+        afd = dup(fd);
+        if (afd < 0)
+            return -1;
+
+        a = archive_open(afd);
+        if (a == NULL) {
+            close(afd);
+            return -1;
+        }
+
+        res = archive_depack(a, member, d);
+        archive_close(a);
+
+        return res;
+    }
+
+    if (depack_fd(fd, d) == 0)
+        return 0;
+
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size <= 0)
+        return -1;
+
+    d->data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (d->data == MAP_FAILED) {
+        d->data = NULL;
+        return -1;
+    }
+    d->len = st.st_size;
+
+    return 0;
+}
+
+static void hash_events(struct hash64 *h, const struct xmp_module *mod) {
+    int i, r, c;
+
+    hash_int(h, mod->chn);
+    hash_int(h, mod->spd);
+    hash_int(h, mod->bpm);
+    hash_int(h, mod->len);
+
+    /* Walk the order list, pattern numbering doesn't change the song */
+    for (i = 0; i < mod->len; i++) {
+        const struct xmp_pattern *xxp;
+
+        if (mod->xxo[i] >= mod->pat)
+            continue;
+
+        xxp = mod->xxp[mod->xxo[i]];
+        hash_int(h, xxp->rows);
+
+        for (r = 0; r < xxp->rows; r++) {
+            for (c = 0; c < mod->chn; c++) {
+                const struct xmp_track *xxt;
+                const struct xmp_event *e;
+                uint8_t ev[7];
+
+                if (xxp->index[c] >= mod->trk)
+                    continue;
+
+                xxt = mod->xxt[xxp->index[c]];
+                if (xxt == NULL || r >= xxt->rows)
+                    continue;
+
+                e = &xxt->event[r];
+                ev[0] = e->note;
+                ev[1] = e->ins;
+                ev[2] = e->vol;
+                ev[3] = e->fxt;
+                ev[4] = e->fxp;
+                ev[5] = e->f2t;
+                ev[6] = e->f2p;
+                hash64_update(h, ev, sizeof(ev));
+            }
+        }
+    }
+}
+
+static void hash_instruments(struct hash64 *h, const struct xmp_module *mod) {
+    int i, j;
+
+    for (i = 0; i < mod->ins; i++) {
+        const struct xmp_instrument *xxi = &mod->xxi[i];
+
+        hash_int(h, xxi->nsm);
+
+        for (j = 0; j < xxi->nsm; j++) {
+            hash_int(h, xxi->sub[j].sid);
+            hash_int(h, xxi->sub[j].vol);
+            hash_int(h, xxi->sub[j].xpo);
+            hash_int(h, xxi->sub[j].fin);
+        }
+    }
+
+    for (i = 0; i < mod->smp; i++) {
+        const struct xmp_sample *xxs = &mod->xxs[i];
+
+        hash_int(h, xxs->len);
+        hash_int(h, xxs->flg & XMP_SAMPLE_LOOP ? xxs->lps : 0);
+        hash_int(h, xxs->flg & XMP_SAMPLE_LOOP ? xxs->lpe : 0);
+
+        /* Samples are already converted to signed native order */
+        if (xxs->data != NULL && xxs->len > 0)
+            hash64_update(h, xxs->data, sample_bytes(xxs));
+    }
+}
+
+/*
+ * Fingerprint the module in fd, or a zip member of it if member isn't
+ * negative. The fd is closed when done. A file that doesn't load as a
+ * module gets a payload hash only, with a zero content hash.
+ */
+int fingerprint_fd(int fd, int member, struct fingerprint *fp) {
+    struct depacked d;
+    xmp_context c;
+
+    fp->payload = 0;
+    fp->content = 0;
+
+    if (map_payload(fd, member, &d) < 0) {
+        close(fd);
+        return -1;
+    }
+
+    close(fd);
+
+    madvise(d.data, d.len, MADV_SEQUENTIAL);
+    fp->payload = hash64(d.data, d.len, 0);
+
+    c = xmp_create_context();
+    if (c != NULL && xmp_load_module_from_memory(c, d.data, d.len) == 0) {
+        struct xmp_module_info mi;
+        struct hash64 h;
+
+        xmp_get_module_info(c, &mi);
+
+        hash64_init(&h, 0);
+        hash_events(&h, mi.mod);
+        hash_instruments(&h, mi.mod);
+        fp->content = hash64_final(&h);
+
+        xmp_release_module(c);
+    }
+
+    if (c != NULL)
+        xmp_free_context(c);
+
+    depack_free(&d);
+
+    return 0;
+}
@@ -0,0 +1,13 @@
+#ifndef XMP_JNI_FINGERPRINT_H
+#define XMP_JNI_FINGERPRINT_H
+
+#include <stdint.h>
+
+struct fingerprint {
+    uint64_t payload;       /* depacked module file */
+    uint64_t content;       /* loaded song: order, events and sample data */
+};
+
+int fingerprint_fd(int, int, struct fingerprint *);
+
+#endif
@@ -0,0 +1,156 @@
+/*
+ * Render quality governor
+ *
+ * Render time of each buffer is compared with the time the buffer plays
+ * for. When the smoothed ratio stays high the player steps down a ladder
+ * built from the configured settings: interpolation is lowered one step
+ * at a time to linear, then the DSP lowpass is dropped, then nearest
+ * neighbour is used. It steps back up only after a long quiet stretch,
+ * so it doesn't oscillate around a threshold. Changes take effect at the
+ * start of the next buffer, the mixer picks them up without a click.
+ */
+
+#include "governor.h"
+#include "xmp.h"
+#include <string.h>
+#include <time.h>
+
+/* Load is smoothed over roughly the last eight buffers */
+#define SMOOTHING 0.125f
+
+#define HIGH_LOAD 0.7f
+#define LOW_LOAD 0.3f
+
+/* Buffers the load has to stay past a mark before a step */
+#define DOWN_BUFFERS 3
+#define UP_BUFFERS 50
+
+/* Let the smoothed load follow a step before judging it again */
+#define SETTLE_BUFFERS 8
+
+/* Never step back up sooner than this after a step down */
+#define UP_HOLDOFF_MS 5000
+
+static uint64_t now_ms(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+void governor_init(struct governor *g, int enabled) {
+    memset(g, 0, sizeof(struct governor));
+    g->enabled = enabled;
+}
+
+/* Settings were changed from outside, they are the new full quality */
+void governor_reset(struct governor *g) {
+    g->num_levels = 0;
+    g->level = 0;
+    g->over = 0;
+    g->under = 0;
+    g->settle = 0;
+}
+
+static void add_level(struct governor *g, int interp, int dsp) {
+    if (g->num_levels < GOVERNOR_LEVELS) {
+        g->interp[g->num_levels] = interp;
+        g->dsp[g->num_levels] = dsp;
+        g->num_levels++;
+    }
+}
+
+static void build_levels(struct governor *g, int interp, int dsp) {
+    add_level(g, interp, dsp);
+
+    while (interp > XMP_INTERP_LINEAR) {
+        add_level(g, --interp, dsp);
+    }
+
+    if (dsp & XMP_DSP_LOWPASS) {
+        dsp &= ~XMP_DSP_LOWPASS;
+        add_level(g, interp, dsp);
+    }
+
+    if (interp > XMP_INTERP_NEAREST) {
+        add_level(g, XMP_INTERP_NEAREST, dsp);
+    }
+}
+
+static void record(struct governor *g, uint64_t ms) {
+    struct governor_step *s = &g->steps[g->num_steps % GOVERNOR_HISTORY];
+
+    s->time_ms = ms;
+    s->level = g->level;
+    s->load = g->load;
+    g->num_steps++;
+    g->last_step_ms = ms;
+    g->over = 0;
+    g->under = 0;
+    g->settle = SETTLE_BUFFERS;
+}
+
+/*
+ * Account a buffer that took render_ns to render and plays for
+ * buffer_ns, interp and dsp are the settings it was rendered with.
+ * Returns 1 if the quality level changed, see governor_settings.
+ */
+int governor_update(struct governor *g, uint64_t render_ns, uint64_t buffer_ns,
+                    int interp, int dsp) {
+    uint64_t ms;
+
+    if (!g->enabled || buffer_ns == 0)
+        return 0;
+
+    g->load += ((float) render_ns / buffer_ns - g->load) * SMOOTHING;
+
+    if (g->settle > 0) {
+        g->settle--;
+        return 0;
+    }
+
+    g->over = g->load > HIGH_LOAD ? g->over + 1 : 0;
+    g->under = g->load < LOW_LOAD ? g->under + 1 : 0;
+
+    if (g->over >= DOWN_BUFFERS) {
+        if (g->num_levels == 0)
+            build_levels(g, interp, dsp);
+
+        if (g->level + 1 < g->num_levels) {
+            g->level++;
+            record(g, now_ms());
+            return 1;
+        }
+    } else if (g->under >= UP_BUFFERS && g->level > 0) {
+        ms = now_ms();
+        if (ms - g->last_step_ms >= UP_HOLDOFF_MS) {
+            g->level--;
+            record(g, ms);
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+void governor_settings(const struct governor *g, int *interp, int *dsp) {
+    *interp = g->interp[g->level];
+    *dsp = g->dsp[g->level];
+}
+
+/* Copy up to max of the latest steps, oldest first. Returns the count. */
+int governor_get_steps(const struct governor *g, struct governor_step *out, int max) {
+    uint64_t first = g->num_steps > GOVERNOR_HISTORY ? g->num_steps - GOVERNOR_HISTORY : 0;
+    uint64_t i;
+    int n = 0;
+
+    if (g->num_steps - first > (uint64_t) max)
+        first = g->num_steps - max;
+
+    for (i = first; i < g->num_steps; i++) {
+        out[n++] = g->steps[i % GOVERNOR_HISTORY];
+    }
+
+    return n;
+}
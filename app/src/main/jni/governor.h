@@ -0,0 +1,41 @@
+#ifndef XMP_JNI_GOVERNOR_H
+#define XMP_JNI_GOVERNOR_H
+
+#include <stdint.h>
+
+#define GOVERNOR_LEVELS 4
+#define GOVERNOR_HISTORY 32
+
+/* A quality change, time is CLOCK_MONOTONIC like SystemClock.uptimeMillis */
+struct governor_step {
+    uint64_t time_ms;
+    int level;
+    float load;             /* smoothed render time over buffer time */
+};
+
+struct governor {
+    int enabled;
+    int num_levels;         /* 0 until the first step down */
+    int interp[GOVERNOR_LEVELS];
+    int dsp[GOVERNOR_LEVELS];
+    int level;              /* 0 is the configured quality */
+    float load;
+    int over;               /* consecutive buffers above the high mark */
+    int under;              /* consecutive buffers below the low mark */
+    int settle;             /* buffers left for the load to follow a step */
+    uint64_t last_step_ms;
+    uint64_t num_steps;
+    struct governor_step steps[GOVERNOR_HISTORY];
+};
+
+void governor_init(struct governor *, int);
+
+void governor_reset(struct governor *);
+
+int governor_update(struct governor *, uint64_t, uint64_t, int, int);
+
+void governor_settings(const struct governor *, int *, int *);
+
+int governor_get_steps(const struct governor *, struct governor_step *, int);
+
+#endif
@@ -0,0 +1,158 @@
+/*
+ * 64-bit content hash, the XXH64 algorithm
+ *
+ * Four independent lanes consume 32 bytes per round, so the loop runs
+ * at memory speed and is only used for cache keys, never for security.
+ */
+
+#include "hash.h"
+#include <string.h>
+
+#define P1 0x9e3779b185ebca87ULL
+#define P2 0xc2b2ae3d27d4eb4fULL
+#define P3 0x165667b19e3779f9ULL
+#define P4 0x85ebca77c2b2ae63ULL
+#define P5 0x27d4eb2f165667c5ULL
+
+static inline uint64_t rotl(uint64_t x, int r) {
+    return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64_t read64(const uint8_t *p) {
+    uint64_t v;
+
+    memcpy(&v, p, sizeof(v));
+
+    return v;
+}
+
+static inline uint32_t read32(const uint8_t *p) {
+    uint32_t v;
+
+    memcpy(&v, p, sizeof(v));
+
+    return v;
+}
+
+static inline uint64_t round64(uint64_t acc, uint64_t in) {
+    acc += in * P2;
+    acc = rotl(acc, 31);
+
+    return acc * P1;
+}
+
+static inline uint64_t merge(uint64_t acc, uint64_t v) {
+    acc ^= round64(0, v);
+
+    return acc * P1 + P4;
+}
+
+void hash64_init(struct hash64 *h, uint64_t seed) {
+    memset(h, 0, sizeof(struct hash64));
+    h->seed = seed;
+    h->v[0] = seed + P1 + P2;
+    h->v[1] = seed + P2;
+    h->v[2] = seed;
+    h->v[3] = seed - P1;
+}
+
+static const uint8_t *consume(struct hash64 *h, const uint8_t *p, const uint8_t *end) {
+    uint64_t v0 = h->v[0], v1 = h->v[1], v2 = h->v[2], v3 = h->v[3];
+
+    while (p + 32 <= end) {
+        v0 = round64(v0, read64(p));
+        v1 = round64(v1, read64(p + 8));
+        v2 = round64(v2, read64(p + 16));
+        v3 = round64(v3, read64(p + 24));
+        p += 32;
+    }
+
+    h->v[0] = v0;
+    h->v[1] = v1;
+    h->v[2] = v2;
+    h->v[3] = v3;
+
+    return p;
+}
+
+void hash64_update(struct hash64 *h, const void *data, size_t len) {
+    const uint8_t *p = data;
+    const uint8_t *end = p + len;
+
+    h->total += len;
+
+    if (h->used + len < 32) {
+        memcpy(h->buf + h->used, p, len);
+        h->used += len;
+        return;
+    }
+
+    if (h->used > 0) {
+        size_t n = 32 - h->used;
+
+        memcpy(h->buf + h->used, p, n);
+        consume(h, h->buf, h->buf + 32);
+        p += n;
+        h->used = 0;
+    }
+
+    p = consume(h, p, end);
+
+    if (p < end) {
+        h->used = end - p;
+        memcpy(h->buf, p, h->used);
+    }
+}
+
+uint64_t hash64_final(const struct hash64 *h) {
+    const uint8_t *p = h->buf;
+    const uint8_t *end = p + h->used;
+    uint64_t acc;
+
+    if (h->total >= 32) {
+        acc = rotl(h->v[0], 1) + rotl(h->v[1], 7) + rotl(h->v[2], 12) + rotl(h->v[3], 18);
+        acc = merge(acc, h->v[0]);
+        acc = merge(acc, h->v[1]);
+        acc = merge(acc, h->v[2]);
+        acc = merge(acc, h->v[3]);
+    } else {
+        acc = h->seed + P5;
+    }
+
+    acc += h->total;
+
+    while (p + 8 <= end) {
+        acc ^= round64(0, read64(p));
+        acc = rotl(acc, 27) * P1 + P4;
+        p += 8;
+    }
+
+    if (p + 4 <= end) {
+        acc ^= (uint64_t) read32(p) * P1;
+        acc = rotl(acc, 23) * P2 + P3;
+        p += 4;
+    }
+
+    while (p < end) {
+        acc ^= *p * P5;
+        acc = rotl(acc, 11) * P1;
+        p++;
+    }
+
+    acc ^= acc >> 33;
+    acc *= P2;
+    acc ^= acc >> 29;
+    acc *= P3;
+    acc ^= acc >> 32;
+
+    return acc;
+}
+
+uint64_t hash64(const void *data, size_t len, uint64_t seed) {
+    struct hash64 h;
+
+    hash64_init(&h, seed);
+    hash64_update(&h, data, len);
+
+    return hash64_final(&h);
+}
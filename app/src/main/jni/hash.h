@@ -0,0 +1,23 @@
+#ifndef XMP_JNI_HASH_H
+#define XMP_JNI_HASH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+struct hash64 {
+    uint64_t v[4];
+    uint64_t total;
+    uint8_t buf[32];
+    size_t used;
+    uint64_t seed;
+};
+
+void hash64_init(struct hash64 *, uint64_t);
+
+void hash64_update(struct hash64 *, const void *, size_t);
+
+uint64_t hash64_final(const struct hash64 *);
+
+uint64_t hash64(const void *, size_t, uint64_t);
+
+#endif
@@ -0,0 +1,133 @@
+/*
+ * Output stage gain with a cheap peak limiter
+ *
+ * Gain reduction is decided once per buffer from the buffer peak: attack
+ * is instant, release ramps linearly across the buffer. The per-sample
+ * work is a widen, multiply and saturating narrow.
+ */
+
+#include "limiter.h"
+#include "simd.h"
+#include <stdlib.h>
+
+/* -0.3 dBFS */
+#define CEILING 31654.0f
+
+/* Fraction of the remaining gain reduction released per buffer */
+#define RELEASE 0.1f
+
+static int buffer_peak(const short *b, int n) {
+    int peak = 0;
+    int i = 0;
+
+#if defined(HAVE_NEON)
+    int16x8_t vp = vdupq_n_s16(0);
+
+    for (; i + 8 <= n; i += 8) {
+        vp = vmaxq_s16(vp, vqabsq_s16(vld1q_s16(b + i)));
+    }
+#if defined(__aarch64__)
+    peak = vmaxvq_s16(vp);
+#else
+    {
+        int16x4_t p4 = vmax_s16(vget_low_s16(vp), vget_high_s16(vp));
+
+        p4 = vpmax_s16(p4, p4);
+        p4 = vpmax_s16(p4, p4);
+        peak = vget_lane_s16(p4, 0);
+    }
+#endif
+#elif defined(HAVE_SSE2)
+    __m128i vp = _mm_setzero_si128();
+
+    for (; i + 8 <= n; i += 8) {
+        __m128i v = _mm_loadu_si128((const __m128i *) (b + i));
+        vp = _mm_max_epi16(vp, _mm_max_epi16(v, _mm_subs_epi16(_mm_setzero_si128(), v)));
+    }
+
+    vp = _mm_max_epi16(vp, _mm_shuffle_epi32(vp, _MM_SHUFFLE(1, 0, 3, 2)));
+    vp = _mm_max_epi16(vp, _mm_shuffle_epi32(vp, _MM_SHUFFLE(2, 3, 0, 1)));
+    vp = _mm_max_epi16(vp, _mm_shufflelo_epi16(vp, _MM_SHUFFLE(2, 3, 0, 1)));
+    peak = (short) _mm_extract_epi16(vp, 0);
+#endif
+
+    for (; i < n; i++) {
+        int a = abs(b[i]);
+        if (a > peak)
+            peak = a;
+    }
+
+    return peak;
+}
+
+/* Scale n samples by a gain ramping from g by step every 8 samples */
+static void apply_gain(short *b, int n, float g, float step) {
+    int i = 0;
+
+#if defined(HAVE_NEON)
+    for (; i + 8 <= n; i += 8, g += step) {
+        float32x4_t vg = vdupq_n_f32(g);
+        int16x8_t v = vld1q_s16(b + i);
+        float32x4_t lo = vcvtq_f32_s32(vmovl_s16(vget_low_s16(v)));
+        float32x4_t hi = vcvtq_f32_s32(vmovl_s16(vget_high_s16(v)));
+        int32x4_t ilo = vcvtq_s32_f32(vmulq_f32(lo, vg));
+        int32x4_t ihi = vcvtq_s32_f32(vmulq_f32(hi, vg));
+
+        vst1q_s16(b + i, vcombine_s16(vqmovn_s32(ilo), vqmovn_s32(ihi)));
+    }
+#elif defined(HAVE_SSE2)
+    for (; i + 8 <= n; i += 8, g += step) {
+        __m128 vg = _mm_set1_ps(g);
+        __m128i v = _mm_loadu_si128((const __m128i *) (b + i));
+        __m128i lo = _mm_srai_epi32(_mm_unpacklo_epi16(v, v), 16);
+        __m128i hi = _mm_srai_epi32(_mm_unpackhi_epi16(v, v), 16);
+
+        lo = _mm_cvttps_epi32(_mm_mul_ps(_mm_cvtepi32_ps(lo), vg));
+        hi = _mm_cvttps_epi32(_mm_mul_ps(_mm_cvtepi32_ps(hi), vg));
+        _mm_storeu_si128((__m128i *) (b + i), _mm_packs_epi32(lo, hi));
+    }
+#endif
+
+    for (; i < n; i++) {
+        int s = (int) (b[i] * g);
+
+        if (s > 32767)
+            s = 32767;
+        else if (s < -32768)
+            s = -32768;
+        b[i] = (short) s;
+
+        /* Same ramp as the vector loops, for the tail and the NO_SIMD build */
+        if ((i & 7) == 7)
+            g += step;
+    }
+}
+
+void limiter_init(struct limiter *l, float gain) {
+    l->gain = gain;
+    l->env = 1.0f;
+}
+
+void limiter_process(struct limiter *l, short *b, int n) {
+    float target = 1.0f;
+    float env;
+    int peak;
+
+    if (n <= 0)
+        return;
+
+    peak = buffer_peak(b, n);
+    if (peak * l->gain > CEILING) {
+        target = CEILING / (peak * l->gain);
+    }
+
+    if (target < l->env) {
+        env = target;
+        apply_gain(b, n, l->gain * env, 0.0f);
+    } else {
+        env = l->env + (target - l->env) * RELEASE;
+        apply_gain(b, n, l->gain * l->env, l->gain * (env - l->env) * 8 / n);
+    }
+
+    l->env = env;
+}
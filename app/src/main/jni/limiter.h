@@ -0,0 +1,13 @@
+#ifndef XMP_JNI_LIMITER_H
+#define XMP_JNI_LIMITER_H
+
+struct limiter {
+    float gain;     /* makeup gain, linear */
+    float env;      /* current gain reduction, 1.0 is none */
+};
+
+void limiter_init(struct limiter *, float);
+
+void limiter_process(struct limiter *, short *, int);
+
+#endif
@@ -0,0 +1,96 @@
+/*
+ * Per-phase cost of loading a module
+ *
+ * Each phase of a load is closed by load_phase, which charges it the
+ * time, bytes read, major faults and heap growth since the previous one.
+ * Reads and faults are counted for the calling thread only, the heap is
+ * process wide so concurrent allocations show up in it. Format tests run
+ * before the load on the same thread are carried over into its report.
+ */
+
+#include "loadreport.h"
+#include <fcntl.h>
+#include <malloc.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <time.h>
+#include <unistd.h>
+
+static __thread struct load_phase t_probe;
+
+static uint64_t read_bytes(void) {
+    char buf[512], *p;
+    ssize_t n;
+    int fd;
+
+    fd = open("/proc/thread-self/io", O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return 0;
+
+    n = read(fd, buf, sizeof(buf) - 1);
+    close(fd);
+
+    if (n <= 0)
+        return 0;
+
+    buf[n] = 0;
+    p = strstr(buf, "rchar:");
+
+    return p != NULL ? strtoull(p + 6, NULL, 10) : 0;
+}
+
+void load_mark(struct load_mark *m) {
+    struct timespec ts;
+    struct rusage ru;
+#ifdef __BIONIC__
+    struct mallinfo mi = mallinfo();
+#else
+    /* mallinfo's int fields wrap past 2 GB and glibc deprecates it */
+    struct mallinfo2 mi = mallinfo2();
+#endif
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    m->ns = (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+    m->bytes = read_bytes();
+    m->faults = getrusage(RUSAGE_THREAD, &ru) == 0 ? (uint64_t) ru.ru_majflt : 0;
+#ifdef __BIONIC__
+    m->alloc = (int64_t) mi.uordblks;
+#else
+    /* glibc keeps large blocks mapped outside the arenas */
+    m->alloc = (int64_t) (mi.uordblks + mi.hblkhd);
+#endif
+}
+
+static void add_since(struct load_phase *p, const struct load_mark *from, struct load_mark *to) {
+    load_mark(to);
+    p->ns += to->ns - from->ns;
+    p->bytes += to->bytes - from->bytes;
+    p->faults += to->faults - from->faults;
+    p->alloc += to->alloc - from->alloc;
+}
+
+/* Charge a format test started at m to the next load on this thread */
+void load_probe_end(const struct load_mark *m) {
+    struct load_mark now;
+
+    add_since(&t_probe, m, &now);
+}
+
+void load_begin(struct load_report *r) {
+    memset(r, 0, sizeof(struct load_report));
+    r->phase[LOAD_PROBE] = t_probe;
+    memset(&t_probe, 0, sizeof(struct load_phase));
+    load_mark(&r->mark);
+}
+
+/* Close phase, which took everything since the last mark */
+void load_phase(struct load_report *r, int phase) {
+    struct load_mark now;
+
+    if (r == NULL)
+        return;
+
+    add_since(&r->phase[phase], &r->mark, &now);
+    r->mark = now;
+}
@@ -0,0 +1,48 @@
+#ifndef XMP_JNI_LOADREPORT_H
+#define XMP_JNI_LOADREPORT_H
+
+#include <stdint.h>
+
+enum {
+    LOAD_PROBE,             /* format tests on this thread since the last load */
+    LOAD_OPEN,
+    LOAD_CACHE,             /* module cache key and lookup */
+    LOAD_DEPACK,
+    LOAD_PARSE,             /* libxmp load, with sample conversion and sequence scan */
+    LOAD_DOWNGRADE,
+    LOAD_METADATA,
+    LOAD_TIMELINE,          /* note events of every sequence */
+    LOAD_PHASES
+};
+
+/* Cost of one load phase, alloc is the change in heap in use */
+struct load_phase {
+    uint64_t ns;
+    uint64_t bytes;         /* read through file descriptors */
+    uint64_t faults;        /* major page faults, reads of mapped files */
+    int64_t alloc;
+};
+
+struct load_mark {
+    uint64_t ns;
+    uint64_t bytes;
+    uint64_t faults;
+    int64_t alloc;
+};
+
+struct load_report {
+    struct load_phase phase[LOAD_PHASES];
+    int cached;
+    int res;
+    struct load_mark mark;
+};
+
+void load_mark(struct load_mark *);
+
+void load_probe_end(const struct load_mark *);
+
+void load_begin(struct load_report *);
+
+void load_phase(struct load_report *, int);
+
+#endif
@@ -0,0 +1,362 @@
+/*
+ * Offline loudness scan, ITU-R BS.1770 integrated loudness and true peak
+ *
+ * The module is rendered as fast as possible into a private context at
+ * 48 kHz, the rate the K-weighting coefficients are specified for. Scans
+ * share no state, so any number can run in parallel, one per worker.
+ *
+ * Both K-weighting stages of both channels run in one 4-lane vector:
+ * lanes 0-1 are the shelf filter for L/R, lanes 2-3 the high-pass fed
+ * with the shelf output of the previous sample. The one sample of skew
+ * doesn't matter for an energy measurement.
+ */
+
+#include "loudness.h"
+#include "archive.h"
+#include "simd.h"
+#include "xmp.h"
+#include <math.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define SCAN_RATE 48000
+
+/* 100 ms, a gating block is four of these with 75% overlap */
+#define SEGMENT_FRAMES (SCAN_RATE / 10)
+#define BLOCK_SEGMENTS 4
+
+#define ABSOLUTE_GATE -70.0
+#define RELATIVE_GATE -10.0
+
+/* 4x oversampling for the true peak, 12 taps per phase */
+#define TP_PHASES 4
+#define TP_TAPS 12
+
+/* Give up on modules that play well past their reported duration */
+#define OVERRUN_SECONDS 10
+
+#if defined(HAVE_NEON)
+typedef float32x4_t v4;
+#define v4_set(a, b, c, d) ((v4) {(a), (b), (c), (d)})
+#define v4_dup(a) vdupq_n_f32(a)
+#define v4_add(a, b) vaddq_f32(a, b)
+#define v4_sub(a, b) vsubq_f32(a, b)
+#define v4_mul(a, b) vmulq_f32(a, b)
+#define v4_max(a, b) vmaxq_f32(a, b)
+#define v4_abs(a) vabsq_f32(a)
+#define v4_store(p, a) vst1q_f32(p, a)
+/* Next filter input: new L/R in lanes 0-1, shelf output in lanes 2-3 */
+#define v4_feed(l, r, y) vcombine_f32((float32x2_t) {(l), (r)}, vget_low_f32(y))
+#elif defined(HAVE_SSE2)
+typedef __m128 v4;
+#define v4_set(a, b, c, d) _mm_setr_ps(a, b, c, d)
+#define v4_dup(a) _mm_set1_ps(a)
+#define v4_add(a, b) _mm_add_ps(a, b)
+#define v4_sub(a, b) _mm_sub_ps(a, b)
+#define v4_mul(a, b) _mm_mul_ps(a, b)
+#define v4_max(a, b) _mm_max_ps(a, b)
+#define v4_abs(a) _mm_andnot_ps(_mm_set1_ps(-0.0f), a)
+#define v4_store(p, a) _mm_storeu_ps(p, a)
+#define v4_feed(l, r, y) _mm_movelh_ps(_mm_setr_ps(l, r, 0.0f, 0.0f), y)
+#else
+typedef struct {
+    float f[4];
+} v4;
+
+static inline v4 v4_set(float a, float b, float c, float d) {
+    v4 v = {{a, b, c, d}};
+    return v;
+}
+
+#define V4_OP(name, expr) \
+    static inline v4 name(v4 a, v4 b) { \
+        v4 v; \
+        int i; \
+        for (i = 0; i < 4; i++) \
+            v.f[i] = expr; \
+        return v; \
+    }
+
+V4_OP(v4_add, a.f[i] + b.f[i])
+V4_OP(v4_sub, a.f[i] - b.f[i])
+V4_OP(v4_mul, a.f[i] * b.f[i])
+V4_OP(v4_max, a.f[i] > b.f[i] ? a.f[i] : b.f[i])
+
+#define v4_dup(a) v4_set(a, a, a, a)
+#define v4_abs(a) v4_max(a, v4_sub(v4_dup(0.0f), a))
+#define v4_store(p, a) memcpy(p, (a).f, sizeof(float) * 4)
+#define v4_feed(l, r, y) v4_set(l, r, (y).f[0], (y).f[1])
+#endif
+
+struct kweight {
+    v4 b0, b1, b2, a1, a2;
+    v4 z1, z2;
+    v4 y;
+};
+
+struct scan {
+    struct kweight k;
+    float chan[2][TP_TAPS - 1 + SEGMENT_FRAMES];
+    v4 tp_coef[TP_TAPS];
+    v4 tp_max;
+    double *seg;
+    int num_seg;
+    int max_seg;
+};
+
+static atomic_int scan_gen;
+
+static float tp_table[TP_TAPS][TP_PHASES];
+static pthread_once_t tp_once = PTHREAD_ONCE_INIT;
+
+/* Hann windowed sinc, cut off at the original Nyquist frequency */
+static void init_tp_table(void) {
+    const int len = TP_TAPS * TP_PHASES;
+    int t, k;
+
+    for (t = 0; t < TP_TAPS; t++) {
+        for (k = 0; k < TP_PHASES; k++) {
+            double n = t * TP_PHASES + k - (len - 1) / 2.0;
+            double x = M_PI * n / TP_PHASES;
+            double sinc = fabs(x) < 1e-9 ? 1.0 : sin(x) / x;
+            double w = 0.5 - 0.5 * cos(2.0 * M_PI * (t * TP_PHASES + k + 0.5) / len);
+
+            tp_table[t][k] = (float) (sinc * w);
+        }
+    }
+}
+
+/* BS.1770 K-weighting at 48 kHz, shelf stage then high-pass stage */
+static void init_kweight(struct kweight *k) {
+    const float s_b0 = 1.53512485958697f, s_b1 = -2.69169618940638f, s_b2 = 1.19839281085285f;
+    const float s_a1 = -1.69065929318241f, s_a2 = 0.73248077421585f;
+    const float h_b0 = 1.0f, h_b1 = -2.0f, h_b2 = 1.0f;
+    const float h_a1 = -1.99004745483398f, h_a2 = 0.99007225036621f;
+
+    k->b0 = v4_set(s_b0, s_b0, h_b0, h_b0);
+    k->b1 = v4_set(s_b1, s_b1, h_b1, h_b1);
+    k->b2 = v4_set(s_b2, s_b2, h_b2, h_b2);
+    k->a1 = v4_set(s_a1, s_a1, h_a1, h_a1);
+    k->a2 = v4_set(s_a2, s_a2, h_a2, h_a2);
+    k->z1 = v4_dup(0.0f);
+    k->z2 = v4_dup(0.0f);
+    k->y = v4_dup(0.0f);
+}
+
+/* K-weighted mean square of one segment, both channels summed */
+static double weigh_segment(struct kweight *k, const float *l, const float *r, int n) {
+    v4 acc = v4_dup(0.0f);
+    float out[4];
+    int i;
+
+    for (i = 0; i < n; i++) {
+        v4 x = v4_feed(l[i], r[i], k->y);
+        v4 y = v4_add(v4_mul(k->b0, x), k->z1);
+
+        k->z1 = v4_add(v4_sub(v4_mul(k->b1, x), v4_mul(k->a1, y)), k->z2);
+        k->z2 = v4_sub(v4_mul(k->b2, x), v4_mul(k->a2, y));
+        k->y = y;
+        acc = v4_add(acc, v4_mul(y, y));
+    }
+
+    v4_store(out, acc);
+
+    return ((double) out[2] + out[3]) / n;
+}
+
+/* Track the peak of the 4x oversampled signal, all phases at once */
+static void true_peak(struct scan *s, const float *x, int n) {
+    v4 peak = s->tp_max;
+    int i, t;
+
+    for (i = 0; i < n; i++) {
+        v4 acc = v4_dup(0.0f);
+
+        for (t = 0; t < TP_TAPS; t++) {
+            acc = v4_add(acc, v4_mul(v4_dup(x[i + t]), s->tp_coef[t]));
+        }
+        peak = v4_max(peak, v4_abs(acc));
+    }
+
+    s->tp_max = peak;
+}
+
+static int add_segment(struct scan *s, double ms) {
+    if (s->num_seg >= s->max_seg) {
+        int max = s->max_seg ? s->max_seg * 2 : 1024;
+        double *seg = realloc(s->seg, max * sizeof(double));
+
+        if (seg == NULL)
+            return -1;
+
+        s->seg = seg;
+        s->max_seg = max;
+    }
+
+    s->seg[s->num_seg++] = ms;
+
+    return 0;
+}
+
+static double to_lufs(double z) {
+    return -0.691 + 10.0 * log10(z);
+}
+
+/* Two-pass gating over 400 ms blocks with 75% overlap */
+static float integrate(const double *seg, int num_seg) {
+    int num_blk = num_seg >= BLOCK_SEGMENTS ? num_seg - BLOCK_SEGMENTS + 1 : num_seg > 0;
+    int blk_len = num_seg >= BLOCK_SEGMENTS ? BLOCK_SEGMENTS : num_seg;
+    double sum, gate, z;
+    int i, j, count, pass;
+
+    gate = ABSOLUTE_GATE;
+
+    for (pass = 0; pass < 2; pass++) {
+        sum = 0.0;
+        count = 0;
+
+        for (i = 0; i < num_blk; i++) {
+            z = 0.0;
+            for (j = 0; j < blk_len; j++) {
+                z += seg[i + j];
+            }
+            z /= blk_len;
+
+            if (z > 0.0 && to_lufs(z) > gate) {
+                sum += z;
+                count++;
+            }
+        }
+
+        if (count == 0)
+            return LOUDNESS_SILENCE;
+
+        /* Pass 2 keeps the absolute gate too, as BS.1770 gates on both */
+        gate = to_lufs(sum / count) + RELATIVE_GATE;
+        if (gate < ABSOLUTE_GATE)
+            gate = ABSOLUTE_GATE;
+    }
+
+    return (float) to_lufs(sum / count);
+}
+
+static int render(xmp_context c, int seq, struct scan *s, int gen) {
+    struct xmp_module_info info;
+    short buf[SEGMENT_FRAMES * 2];
+    long max_seg;
+    int i, t;
+
+    xmp_get_module_info(c, &info);
+
+    if (seq < 0 || seq >= info.num_sequences)
+        return -1;
+
+    max_seg = (info.seq_data[seq].duration / 1000L + OVERRUN_SECONDS) * 10;
+
+    if (xmp_start_player(c, SCAN_RATE, 0) != 0)
+        return -1;
+
+    xmp_set_position(c, info.seq_data[seq].entry_point);
+
+    for (t = 0; t < TP_TAPS; t++) {
+        const float *h = tp_table[TP_TAPS - 1 - t];
+        s->tp_coef[t] = v4_set(h[0], h[1], h[2], h[3]);
+    }
+
+    while (s->num_seg < max_seg) {
+        if (atomic_load(&scan_gen) != gen)
+            break;
+
+        if (xmp_play_buffer(c, buf, sizeof(buf), 1) < 0)
+            break;
+
+        for (i = 0; i < SEGMENT_FRAMES; i++) {
+            s->chan[0][TP_TAPS - 1 + i] = buf[i * 2] / 32768.0f;
+            s->chan[1][TP_TAPS - 1 + i] = buf[i * 2 + 1] / 32768.0f;
+        }
+
+        if (add_segment(s, weigh_segment(&s->k, s->chan[0] + TP_TAPS - 1,
+                                         s->chan[1] + TP_TAPS - 1, SEGMENT_FRAMES)) < 0)
+            break;
+
+        true_peak(s, s->chan[0], SEGMENT_FRAMES);
+        true_peak(s, s->chan[1], SEGMENT_FRAMES);
+
+        /* Carry the filter history over to the next segment */
+        for (i = 0; i < TP_TAPS - 1; i++) {
+            s->chan[0][i] = s->chan[0][SEGMENT_FRAMES + i];
+            s->chan[1][i] = s->chan[1][SEGMENT_FRAMES + i];
+        }
+    }
+
+    xmp_end_player(c);
+
+    return atomic_load(&scan_gen) == gen ? 0 : -1;
+}
+
+/*
+ * Scan one sequence of the module in fd, or of a zip member if member
+ * isn't negative. The fd is closed when done. Returns 0 on success, -1 on
+ * error or if cancelled.
+ */
+int loudness_scan(int fd, int member, int seq, struct loudness *res) {
+    struct scan *s;
+    struct stat st;
+    xmp_context c;
+    FILE *f;
+    float peak[4];
+    int gen = atomic_load(&scan_gen);
+    int ret = -1;
+
+    pthread_once(&tp_once, init_tp_table);
+
+    f = fdopen(fd, "r");
+    if (f == NULL) {
+        close(fd);
+        return -1;
+    }
+
+    s = calloc(1, sizeof(struct scan));
+    c = xmp_create_context();
+
+    if (s != NULL && c != NULL && fstat(fd, &st) == 0 &&
+        archive_load(c, f, st.st_size, member, NULL) == 0) {
+        struct xmp_module_info info;
+
+        xmp_get_module_info(c, &info);
+        memcpy(res->md5, info.md5, sizeof(res->md5));
+
+        init_kweight(&s->k);
+        s->tp_max = v4_dup(0.0f);
+
+        if (render(c, seq, s, gen) == 0) {
+            v4_store(peak, s->tp_max);
+            peak[0] = fmaxf(fmaxf(peak[0], peak[1]), fmaxf(peak[2], peak[3]));
+
+            res->integrated = integrate(s->seg, s->num_seg);
+            res->true_peak = peak[0] > 0.0f ? 20.0f * log10f(peak[0]) : LOUDNESS_SILENCE;
+            ret = 0;
+        }
+
+        xmp_release_module(c);
+    }
+
+    if (c != NULL)
+        xmp_free_context(c);
+    if (s != NULL)
+        free(s->seg);
+    free(s);
+    fclose(f);
+
+    return ret;
+}
+
+/* Abort every scan in progress, new scans are not affected */
+void loudness_cancel(void) {
+    atomic_fetch_add(&scan_gen, 1);
+}
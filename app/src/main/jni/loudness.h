@@ -0,0 +1,17 @@
+#ifndef XMP_JNI_LOUDNESS_H
+#define XMP_JNI_LOUDNESS_H
+
+/* Reported for silent modules, the BS.1770 absolute gate */
+#define LOUDNESS_SILENCE -70.0f
+
+struct loudness {
+    float integrated;       /* LUFS */
+    float true_peak;        /* dBTP */
+    unsigned char md5[16];
+};
+
+int loudness_scan(int, int, int, struct loudness *);
+
+void loudness_cancel(void);
+
+#endif
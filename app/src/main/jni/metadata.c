@@ -0,0 +1,112 @@
+/*
+ * Builds the packed module metadata blob handed to the UI in one call
+ */
+
+#include "metadata.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define ALIGN4(x) (((x) + 3) & ~3u)
+
+void *metadata_build(const struct xmp_module_info *mi, size_t *size) {
+    const struct xmp_module *mod = mi->mod;
+    struct metadata_header *h;
+    uint8_t *blob;
+    size_t comment_len = mi->comment != NULL ? strlen(mi->comment) : 0;
+    uint32_t off;
+    int i;
+
+    /* Lay out sections back to back, each 4-byte aligned */
+    off = sizeof(struct metadata_header);
+    uint32_t name_off = off;
+    off += XMP_NAME_SIZE;
+    uint32_t type_off = off;
+    off += XMP_NAME_SIZE;
+    uint32_t ins_off = off;
+    off += mod->ins * sizeof(struct metadata_instrument);
+    uint32_t smp_off = off;
+    off += mod->smp * sizeof(struct metadata_sample);
+    uint32_t seq_off = off;
+    off += mi->num_sequences * sizeof(struct metadata_sequence);
+    uint32_t rows_off = off;
+    off += mod->pat * sizeof(int32_t);
+    uint32_t ord_off = off;
+    off = ALIGN4(off + mod->len);
+    uint32_t comment_off = off;
+    off = ALIGN4(off + comment_len);
+
+    blob = calloc(1, off);
+    if (blob == NULL)
+        return NULL;
+
+    h = (struct metadata_header *) blob;
+    h->magic = METADATA_MAGIC;
+    h->version = METADATA_VERSION;
+    h->header_size = sizeof(struct metadata_header);
+    h->total_size = off;
+    h->chn = mod->chn;
+    h->pat = mod->pat;
+    h->ins = mod->ins;
+    h->smp = mod->smp;
+    h->len = mod->len;
+    h->rst = mod->rst;
+    h->spd = mod->spd;
+    h->bpm = mod->bpm;
+    h->gvl = mod->gvl;
+    h->vol_base = mi->vol_base;
+    h->num_sequences = mi->num_sequences;
+    h->name_off = name_off;
+    h->type_off = type_off;
+    h->ins_off = ins_off;
+    h->smp_off = smp_off;
+    h->seq_off = seq_off;
+    h->rows_off = rows_off;
+    h->ord_off = ord_off;
+    h->comment_off = comment_off;
+    h->comment_len = comment_len;
+    memcpy(h->md5, mi->md5, sizeof(h->md5));
+
+    strncpy((char *) blob + name_off, mod->name, XMP_NAME_SIZE - 1);
+    strncpy((char *) blob + type_off, mod->type, XMP_NAME_SIZE - 1);
+
+    for (i = 0; i < mod->ins; i++) {
+        struct metadata_instrument *ins = (struct metadata_instrument *) (blob + ins_off) + i;
+
+        strncpy(ins->name, mod->xxi[i].name, METADATA_INS_NAME - 1);
+        ins->nsm = mod->xxi[i].nsm;
+        ins->vol = mod->xxi[i].vol;
+    }
+
+    for (i = 0; i < mod->smp; i++) {
+        struct metadata_sample *smp = (struct metadata_sample *) (blob + smp_off) + i;
+
+        strncpy(smp->name, mod->xxs[i].name, METADATA_SMP_NAME - 1);
+        smp->len = mod->xxs[i].len;
+        smp->lps = mod->xxs[i].lps;
+        smp->lpe = mod->xxs[i].lpe;
+        smp->flg = mod->xxs[i].flg;
+    }
+
+    for (i = 0; i < mi->num_sequences; i++) {
+        struct metadata_sequence *seq = (struct metadata_sequence *) (blob + seq_off) + i;
+
+        seq->entry_point = mi->seq_data[i].entry_point;
+        seq->duration = mi->seq_data[i].duration;
+    }
+
+    for (i = 0; i < mod->pat; i++) {
+        int32_t *rows = (int32_t *) (blob + rows_off) + i;
+
+        *rows = mod->xxp[i] != NULL ? mod->xxp[i]->rows : 0;
+    }
+
+    memcpy(blob + ord_off, mod->xxo, mod->len);
+
+    if (comment_len > 0) {
+        memcpy(blob + comment_off, mi->comment, comment_len);
+    }
+
+    *size = off;
+
+    return blob;
+}
@@ -0,0 +1,69 @@
+#ifndef XMP_JNI_METADATA_H
+#define XMP_JNI_METADATA_H
+
+#include "xmp.h"
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Packed, immutable module metadata. Little-endian, all offsets are from
+ * the start of the blob. Bump METADATA_VERSION on any layout change and
+ * mirror it in ModMetadata.kt.
+ */
+
+#define METADATA_MAGIC 0x4d504d58 /* "XMPM" */
+#define METADATA_VERSION 2
+
+#define METADATA_INS_NAME 32
+#define METADATA_SMP_NAME 32
+
+struct metadata_header {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t header_size;
+    uint32_t total_size;
+    int32_t chn;
+    int32_t pat;
+    int32_t ins;
+    int32_t smp;
+    int32_t len;
+    int32_t rst;
+    int32_t spd;
+    int32_t bpm;
+    int32_t gvl;
+    int32_t vol_base;
+    int32_t num_sequences;
+    uint32_t name_off;      /* XMP_NAME_SIZE bytes, NUL padded */
+    uint32_t type_off;      /* XMP_NAME_SIZE bytes, NUL padded */
+    uint32_t ins_off;       /* ins x struct metadata_instrument */
+    uint32_t smp_off;       /* smp x struct metadata_sample */
+    uint32_t seq_off;       /* num_sequences x struct metadata_sequence */
+    uint32_t rows_off;      /* pat x int32 rows */
+    uint32_t ord_off;       /* len x uint8 order list */
+    uint32_t comment_off;   /* comment_len raw bytes, not terminated */
+    uint32_t comment_len;
+    uint8_t md5[16];        /* module MD5, keys the on-disk metadata cache */
+};
+
+struct metadata_instrument {
+    char name[METADATA_INS_NAME];
+    int32_t nsm;
+    int32_t vol;
+};
+
+struct metadata_sample {
+    char name[METADATA_SMP_NAME];
+    int32_t len;
+    int32_t lps;
+    int32_t lpe;
+    int32_t flg;
+};
+
+struct metadata_sequence {
+    int32_t entry_point;
+    int32_t duration;
+};
+
+void *metadata_build(const struct xmp_module_info *, size_t *);
+
+#endif
@@ -0,0 +1,215 @@
+/*
+ * LRU cache of fully loaded modules, one libxmp context each
+ *
+ * Released modules stay loaded until the byte budget or a trim request
+ * evicts them, so going back to a module or repeating a playlist skips
+ * reading, depacking and parsing the file again, and scanning its note
+ * timeline, which is kept with it. Modules in use are never evicted but
+ * count towards the budget.
+ */
+
+#include "modcache.h"
+#include <pthread.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#define MAX_ENTRIES 8
+
+struct entry {
+    struct modcache_key key;
+    xmp_context ctx;
+    size_t bytes;
+    struct downgrade_report report;
+    struct timeline *timeline;
+    unsigned long last_used;
+    int in_use;
+};
+
+static struct entry entries[MAX_ENTRIES];
+static int num_entries;
+static size_t budget = MODCACHE_DEFAULT_BUDGET;
+static size_t total;
+static unsigned long use_clock;
+static pthread_mutex_t mc_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static size_t module_bytes(xmp_context ctx) {
+    struct xmp_module_info mi;
+
+    xmp_get_module_info(ctx, &mi);
+
+    return module_footprint(mi.mod);
+}
+
+static void free_context(xmp_context ctx) {
+    xmp_release_module(ctx);
+    xmp_free_context(ctx);
+}
+
+static void remove_entry(int i) {
+    total -= entries[i].bytes;
+    free_context(entries[i].ctx);
+    timeline_free(entries[i].timeline);
+    entries[i] = entries[--num_entries];
+}
+
+static int find_lru(void) {
+    int lru = -1;
+    int i;
+
+    for (i = 0; i < num_entries; i++) {
+        if (!entries[i].in_use &&
+            (lru < 0 || entries[i].last_used < entries[lru].last_used)) {
+            lru = i;
+        }
+    }
+
+    return lru;
+}
+
+static void evict_to(size_t limit) {
+    int i;
+
+    while (total > limit && (i = find_lru()) >= 0) {
+        remove_entry(i);
+    }
+}
+
+/*
+ * Build the cache key of the module file in fd, or of one of its zip
+ * members. Fails for anything that isn't a regular file, those are not
+ * cached.
+ */
+int modcache_key(int fd, int member, int defpan, size_t mem_budget, struct modcache_key *key) {
+    struct stat st;
+
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode))
+        return -1;
+
+    memset(key, 0, sizeof(struct modcache_key));
+    key->dev = st.st_dev;
+    key->ino = st.st_ino;
+    key->size = st.st_size;
+    key->mtime = st.st_mtime;
+    key->member = member;
+    key->defpan = defpan;
+    key->mem_budget = mem_budget;
+
+    return 0;
+}
+
+/*
+ * Take a cached module, what was done to it at load time and a reference
+ * to its timeline, NULL on a miss. Hand it back with modcache_release.
+ */
+xmp_context modcache_lookup(const struct modcache_key *key, struct downgrade_report *report,
+                            struct timeline **timeline) {
+    xmp_context ctx = NULL;
+    int i;
+
+    pthread_mutex_lock(&mc_mutex);
+
+    for (i = 0; i < num_entries; i++) {
+        if (!entries[i].in_use && !memcmp(&entries[i].key, key, sizeof(struct modcache_key))) {
+            entries[i].in_use = 1;
+            ctx = entries[i].ctx;
+            *report = entries[i].report;
+            *timeline = timeline_ref(entries[i].timeline);
+            break;
+        }
+    }
+
+    pthread_mutex_unlock(&mc_mutex);
+
+    return ctx;
+}
+
+/*
+ * Track a newly loaded module, in use, and keep a reference to its
+ * timeline. Modules without a key or larger than the whole budget are not
+ * cached and are freed on release.
+ */
+void modcache_insert(const struct modcache_key *key, xmp_context ctx,
+                     const struct downgrade_report *report, struct timeline *timeline) {
+    size_t bytes;
+    int i;
+
+    if (key == NULL)
+        return;
+
+    bytes = module_bytes(ctx) + timeline_bytes(timeline);
+
+    pthread_mutex_lock(&mc_mutex);
+
+    if (bytes <= budget) {
+        if (num_entries >= MAX_ENTRIES && (i = find_lru()) >= 0) {
+            remove_entry(i);
+        }
+
+        if (num_entries < MAX_ENTRIES) {
+            struct entry *e = &entries[num_entries++];
+
+            e->key = *key;
+            e->ctx = ctx;
+            e->bytes = bytes;
+            e->report = *report;
+            e->timeline = timeline_ref(timeline);
+            e->last_used = ++use_clock;
+            e->in_use = 1;
+            total += bytes;
+
+            evict_to(budget);
+        }
+    }
+
+    pthread_mutex_unlock(&mc_mutex);
+}
+
+/* Done playing, keep the module around if it's cached */
+void modcache_release(xmp_context ctx) {
+    int i;
+
+    pthread_mutex_lock(&mc_mutex);
+
+    for (i = 0; i < num_entries; i++) {
+        if (entries[i].ctx == ctx) {
+            entries[i].in_use = 0;
+            entries[i].last_used = ++use_clock;
+            evict_to(budget);
+            pthread_mutex_unlock(&mc_mutex);
+            return;
+        }
+    }
+
+    pthread_mutex_unlock(&mc_mutex);
+
+    free_context(ctx);
+}
+
+void modcache_set_budget(size_t bytes) {
+    pthread_mutex_lock(&mc_mutex);
+    budget = bytes;
+    evict_to(budget);
+    pthread_mutex_unlock(&mc_mutex);
+}
+
+/* Memory pressure, evict unused modules until at most bytes remain */
+void modcache_trim(size_t bytes) {
+    pthread_mutex_lock(&mc_mutex);
+    evict_to(bytes);
+    pthread_mutex_unlock(&mc_mutex);
+}
+
+size_t modcache_size(void) {
+    size_t size;
+
+    pthread_mutex_lock(&mc_mutex);
+    size = total;
+    pthread_mutex_unlock(&mc_mutex);
+
+    return size;
+}
+
+/* Free every module not in use */
+void modcache_clear(void) {
+    modcache_trim(0);
+}
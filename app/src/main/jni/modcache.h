@@ -0,0 +1,42 @@
+#ifndef XMP_JNI_MODCACHE_H
+#define XMP_JNI_MODCACHE_H
+
+#include "downgrade.h"
+#include "timeline.h"
+#include "xmp.h"
+#include <stddef.h>
+#include <sys/types.h>
+
+/* Default budget until the app sets one from the device memory class */
+#define MODCACHE_DEFAULT_BUDGET (32 * 1024 * 1024)
+
+/* Identifies a module file and the load-time settings baked into it */
+struct modcache_key {
+    dev_t dev;
+    ino_t ino;
+    off_t size;
+    time_t mtime;
+    int member;
+    int defpan;
+    size_t mem_budget;
+};
+
+int modcache_key(int, int, int, size_t, struct modcache_key *);
+
+xmp_context modcache_lookup(const struct modcache_key *, struct downgrade_report *,
+                            struct timeline **);
+
+void modcache_insert(const struct modcache_key *, xmp_context, const struct downgrade_report *,
+                     struct timeline *);
+
+void modcache_release(xmp_context);
+
+void modcache_set_budget(size_t);
+
+void modcache_trim(size_t);
+
+size_t modcache_size(void);
+
+void modcache_clear(void);
+
+#endif
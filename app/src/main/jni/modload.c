@@ -0,0 +1,365 @@
+/*
+ * Module loading off the control path
+ *
+ * Loads submitted with modload_submit run on a dedicated thread. A newer
+ * request supersedes the previous one: a load that hasn't started yet is
+ * dropped and one in progress is abandoned at its next phase boundary,
+ * so skipping quickly through a playlist only parses the module finally
+ * asked for. Contexts that are done with are handed back to the same
+ * thread, so tearing a module down never holds up the player.
+ */
+
+#include "modload.h"
+#include "archive.h"
+#include "metadata.h"
+#include "modcache.h"
+#include "probe.h"
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#define MAX_RELEASES 16
+
+static pthread_mutex_t ld_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t ld_cond = PTHREAD_COND_INITIALIZER;
+static atomic_int generation;
+static int started;
+static int busy;
+static int has_pending;
+static struct load_request pending;
+static int done_gen = -1;
+static struct loaded done;
+static int num_releases;
+static xmp_context releases[MAX_RELEASES];
+
+static int superseded(const struct load_request *r) {
+    return r->gen >= 0 && r->gen != atomic_load(&generation);
+}
+
+/* With ld_mutex held, generations stay positive */
+static int next_generation(void) {
+    int gen = (atomic_load(&generation) + 1) & 0x7fffffff;
+
+    atomic_store(&generation, gen);
+
+    return gen;
+}
+
+/*
+ * Load the module in r->fd, which is closed. Loads with a generation give
+ * up with MODLOAD_CANCELLED between phases once a newer one is submitted.
+ */
+void modload_load(const struct load_request *r, struct loaded *out) {
+    struct xmp_test_info ti;
+    struct xmp_module_info mi;
+    struct modcache_key key;
+    struct stat st;
+    xmp_context ctx;
+    FILE *f;
+    int cacheable;
+    int res = 0;
+
+    memset(out, 0, sizeof(struct loaded));
+    load_begin(&out->report);
+
+    f = fdopen(r->fd, "rb");
+    if (f == NULL) {
+        close(r->fd);
+        out->res = out->report.res = -XMP_ERROR_SYSTEM;
+        return;
+    }
+
+    /* Zip members are tested by loading them */
+    if (r->test && r->member < 0) {
+        if (probe_module(f, &ti) != 0) {
+            res = -XMP_ERROR_FORMAT;
+            goto end;
+        }
+        load_phase(&out->report, LOAD_PROBE);
+    }
+
+    if (superseded(r))
+        goto cancel;
+
+    if (fstat(fileno(f), &st) != 0) {
+        res = -XMP_ERROR_SYSTEM;
+        goto end;
+    }
+    load_phase(&out->report, LOAD_OPEN);
+
+    /* Recently played modules are still loaded in their own context */
+    cacheable = modcache_key(fileno(f), r->member, r->defpan, r->budget, &key) == 0;
+    ctx = cacheable ? modcache_lookup(&key, &out->downgrade, &out->timeline) : NULL;
+    out->report.cached = ctx != NULL;
+    load_phase(&out->report, LOAD_CACHE);
+
+    if (ctx == NULL) {
+        if (superseded(r))
+            goto cancel;
+
+        ctx = xmp_create_context();
+        if (ctx == NULL) {
+            res = -XMP_ERROR_SYSTEM;
+            goto end;
+        }
+
+        xmp_set_player(ctx, XMP_PLAYER_DEFPAN, r->defpan);
+        res = archive_load(ctx, f, st.st_size, r->member, &out->report);
+
+        if (res != 0 || superseded(r)) {
+            xmp_free_context(ctx);
+            if (res == 0)
+                goto cancel;
+            goto end;
+        }
+
+        /* Samples are only reduced if the module doesn't fit in budget */
+        if (r->budget > 0)
+            downgrade_module(ctx, r->budget, &out->downgrade);
+        load_phase(&out->report, LOAD_DOWNGRADE);
+
+        /* Runs the player, so before anyone else can. Kept with the module in the cache */
+        out->timeline = timeline_build(ctx);
+        load_phase(&out->report, LOAD_TIMELINE);
+
+        modcache_insert(cacheable ? &key : NULL, ctx, &out->downgrade, out->timeline);
+    }
+
+    xmp_get_module_info(ctx, &mi);
+    out->metadata = metadata_build(&mi, &out->metadata_size);
+    load_phase(&out->report, LOAD_METADATA);
+    out->ctx = ctx;
+
+end:
+    fclose(f);
+    out->res = out->report.res = res;
+    return;
+
+cancel:
+    fclose(f);
+    out->res = out->report.res = MODLOAD_CANCELLED;
+}
+
+/* With ld_mutex held */
+static void queue_release(xmp_context ctx) {
+    if (started && num_releases < MAX_RELEASES) {
+        releases[num_releases++] = ctx;
+    } else {
+        pthread_mutex_unlock(&ld_mutex);
+        modcache_release(ctx);
+        pthread_mutex_lock(&ld_mutex);
+    }
+}
+
+/* With ld_mutex held, a finished load nobody will collect */
+static void drop_done(void) {
+    if (done_gen < 0)
+        return;
+
+    done_gen = -1;
+    free(done.metadata);
+    timeline_free(done.timeline);
+    if (done.ctx != NULL)
+        queue_release(done.ctx);
+}
+
+static void *load_thread(void *arg) {
+    struct load_request r;
+    struct loaded l;
+    xmp_context ctx;
+
+    (void) arg;
+
+    pthread_mutex_lock(&ld_mutex);
+
+    for (;;) {
+        while (!has_pending && num_releases == 0)
+            pthread_cond_wait(&ld_cond, &ld_mutex);
+
+        busy = 1;
+
+        /* Loads first, the player is waiting for them */
+        if (has_pending) {
+            r = pending;
+            has_pending = 0;
+            pthread_mutex_unlock(&ld_mutex);
+
+            modload_load(&r, &l);
+
+            pthread_mutex_lock(&ld_mutex);
+            if (!superseded(&r)) {
+                drop_done();
+                done = l;
+                done_gen = r.gen;
+            } else {
+                free(l.metadata);
+                timeline_free(l.timeline);
+                if (l.ctx != NULL)
+                    queue_release(l.ctx);
+            }
+        } else {
+            ctx = releases[--num_releases];
+            pthread_mutex_unlock(&ld_mutex);
+
+            modcache_release(ctx);
+
+            pthread_mutex_lock(&ld_mutex);
+        }
+
+        busy = 0;
+        pthread_cond_broadcast(&ld_cond);
+    }
+
+    return NULL;
+}
+
+/* With ld_mutex held */
+static int start_thread(void) {
+    pthread_t thread;
+
+    if (!started && pthread_create(&thread, NULL, load_thread, NULL) == 0) {
+        pthread_detach(thread);
+        started = 1;
+    }
+
+    return started ? 0 : -1;
+}
+
+/*
+ * Load the module in fd, which the loader owns, superseding any previous
+ * request. Returns the generation to wait for.
+ */
+int modload_submit(int fd, int member, int defpan, size_t budget) {
+    struct load_request r;
+    struct loaded l;
+    int gen;
+
+    pthread_mutex_lock(&ld_mutex);
+
+    gen = next_generation();
+
+    r.fd = fd;
+    r.member = member;
+    r.defpan = defpan;
+    r.budget = budget;
+    r.test = 1;
+    r.gen = gen;
+
+    if (has_pending)
+        close(pending.fd);
+    drop_done();
+
+    if (start_thread() == 0) {
+        pending = r;
+        has_pending = 1;
+        pthread_cond_broadcast(&ld_cond);
+        pthread_mutex_unlock(&ld_mutex);
+        return gen;
+    }
+
+    /* No loader thread, load right here */
+    has_pending = 0;
+    pthread_mutex_unlock(&ld_mutex);
+
+    r.gen = -1;
+    modload_load(&r, &l);
+
+    pthread_mutex_lock(&ld_mutex);
+    if (atomic_load(&generation) == gen) {
+        done = l;
+        done_gen = gen;
+    } else {
+        free(l.metadata);
+        timeline_free(l.timeline);
+        if (l.ctx != NULL)
+            queue_release(l.ctx);
+    }
+    pthread_mutex_unlock(&ld_mutex);
+
+    return gen;
+}
+
+/*
+ * Wait up to timeout milliseconds for load gen. Returns 0 with the module
+ * in out, which the caller then owns, MODLOAD_PENDING if it isn't loaded
+ * yet, or MODLOAD_CANCELLED if a newer request superseded it.
+ */
+int modload_wait(int gen, int timeout, struct loaded *out) {
+    struct timespec ts;
+    int res;
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+    ts.tv_sec += timeout / 1000;
+    ts.tv_nsec += (long) (timeout % 1000) * 1000000;
+    if (ts.tv_nsec >= 1000000000) {
+        ts.tv_sec++;
+        ts.tv_nsec -= 1000000000;
+    }
+
+    pthread_mutex_lock(&ld_mutex);
+
+    while (done_gen != gen && atomic_load(&generation) == gen) {
+        if (pthread_cond_timedwait(&ld_cond, &ld_mutex, &ts) == ETIMEDOUT)
+            break;
+    }
+
+    if (done_gen == gen) {
+        *out = done;
+        done_gen = -1;
+        res = 0;
+    } else if (atomic_load(&generation) != gen) {
+        res = MODLOAD_CANCELLED;
+    } else {
+        res = MODLOAD_PENDING;
+    }
+
+    pthread_mutex_unlock(&ld_mutex);
+
+    return res;
+}
+
+/* Supersede every request, loads in progress stop at their next phase */
+void modload_cancel(void) {
+    pthread_mutex_lock(&ld_mutex);
+
+    next_generation();
+    if (has_pending) {
+        close(pending.fd);
+        has_pending = 0;
+    }
+    drop_done();
+    pthread_cond_broadcast(&ld_cond);
+
+    pthread_mutex_unlock(&ld_mutex);
+}
+
+/* Release a module context on the loader thread */
+void modload_release(xmp_context ctx) {
+    pthread_mutex_lock(&ld_mutex);
+
+    if (start_thread() == 0) {
+        queue_release(ctx);
+        pthread_cond_broadcast(&ld_cond);
+        pthread_mutex_unlock(&ld_mutex);
+        return;
+    }
+
+    pthread_mutex_unlock(&ld_mutex);
+    modcache_release(ctx);
+}
+
+/* Cancel loads and wait until the loader thread is idle */
+void modload_stop(void) {
+    modload_cancel();
+
+    pthread_mutex_lock(&ld_mutex);
+    while (busy || has_pending || num_releases > 0)
+        pthread_cond_wait(&ld_cond, &ld_mutex);
+    pthread_mutex_unlock(&ld_mutex);
+}
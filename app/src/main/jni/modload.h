@@ -0,0 +1,46 @@
+#ifndef XMP_JNI_MODLOAD_H
+#define XMP_JNI_MODLOAD_H
+
+#include "downgrade.h"
+#include "loadreport.h"
+#include "timeline.h"
+#include "xmp.h"
+#include <stddef.h>
+
+/* Still loading, or superseded by a newer request */
+#define MODLOAD_PENDING 1
+#define MODLOAD_CANCELLED (-100)
+
+struct load_request {
+    int fd;
+    int member;
+    int defpan;
+    size_t budget;
+    int test;               /* probe the format first */
+    int gen;                /* negative for loads that can't be superseded */
+};
+
+/* A module ready to be played, ctx is NULL if loading failed */
+struct loaded {
+    xmp_context ctx;
+    int res;
+    struct downgrade_report downgrade;
+    struct load_report report;
+    void *metadata;
+    size_t metadata_size;
+    struct timeline *timeline;
+};
+
+void modload_load(const struct load_request *, struct loaded *);
+
+int modload_submit(int, int, int, size_t);
+
+int modload_wait(int, int, struct loaded *);
+
+void modload_cancel(void);
+
+void modload_release(xmp_context);
+
+void modload_stop(void);
+
+#endif
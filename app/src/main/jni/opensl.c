@@ -1,9 +1,11 @@
 #include "audio.h"
 #include <SLES/OpenSLES.h>
 #include <SLES/OpenSLES_Android.h>
+#include <poll.h>
 #include <pthread.h>
 #include <stdatomic.h>
 #include <stdlib.h>
+#include <sys/eventfd.h>
 #include <time.h>
 
 /* #include <android/log.h> */
@@ -25,15 +27,29 @@ static atomic_int last_free;
 static char *buffer;
 static int buffer_num;
 static int buffer_size;
+static int buffer_frames;
+static int output_rate;
 static int playing;
 static pthread_mutex_t mutex;
 
+/* Signalled by the callback for wait_free_buffer, with the time it ran */
+static int free_efd = -1;
+static pthread_once_t free_once = PTHREAD_ONCE_INIT;
+static atomic_llong freed_ns;
+
 #define TAG "Xmp"
-#define BUFFER_TIME 40
 
 #define lock()   pthread_mutex_lock(&mutex)
 #define unlock() pthread_mutex_unlock(&mutex)
 
+static int64_t now_ns(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (int64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
 static void player_callback(SLAndroidSimpleBufferQueueItf bq, void *context) {
     (void) bq;
     (void) context;
@@ -44,6 +60,15 @@ static void player_callback(SLAndroidSimpleBufferQueueItf bq, void *context) {
     if (last_free == first_free) {
         DEC(last_free, buffer_num);
     }
+
+    if (free_efd >= 0) {
+        atomic_store(&freed_ns, now_ns());
+        eventfd_write(free_efd, 1);
+    }
+}
+
+static void open_eventfd(void) {
+    free_efd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
 }
 
 static int opensl_open(int sr, int num) {
@@ -54,15 +79,27 @@ static int opensl_open(int sr, int num) {
         case 8000:
             rate = SL_SAMPLINGRATE_8;
             break;
+        case 16000:
+            rate = SL_SAMPLINGRATE_16;
+            break;
         case 22050:
             rate = SL_SAMPLINGRATE_22_05;
             break;
+        case 32000:
+            rate = SL_SAMPLINGRATE_32;
+            break;
         case 44100:
             rate = SL_SAMPLINGRATE_44_1;
             break;
         case 48000:
             rate = SL_SAMPLINGRATE_48;
             break;
+        case 88200:
+            rate = SL_SAMPLINGRATE_88_2;
+            break;
+        case 96000:
+            rate = SL_SAMPLINGRATE_96;
+            break;
         default:
             goto err;
     }
@@ -127,19 +164,34 @@ static int opensl_open(int sr, int num) {
 
     /* create audio player */
     const SLInterfaceID ids1[] = {
-            SL_IID_VOLUME, SL_IID_ANDROIDSIMPLEBUFFERQUEUE
+            SL_IID_VOLUME, SL_IID_ANDROIDSIMPLEBUFFERQUEUE, SL_IID_ANDROIDCONFIGURATION
     };
 
     const SLboolean req1[] = {
-            SL_BOOLEAN_TRUE
+            SL_BOOLEAN_TRUE, SL_BOOLEAN_TRUE, SL_BOOLEAN_FALSE
     };
 
     r = (*engine_engine)->CreateAudioPlayer(engine_engine, &player_obj,
-                                            &audio_source, &audio_sink, 2, ids1, req1);
+                                            &audio_source, &audio_sink, 3, ids1, req1);
 
     if (r != SL_RESULT_SUCCESS)
         goto err2;
 
+#ifdef SL_ANDROID_KEY_PERFORMANCE_MODE
+    /*
+     * Ask for the fast mixer track, which Android 7.1 and later grant when the
+     * rate is the device rate and buffers are whole bursts. Older releases
+     * don't have the key and decide from the rate and buffer size alone.
+     */
+    SLAndroidConfigurationItf config;
+    r = (*player_obj)->GetInterface(player_obj, SL_IID_ANDROIDCONFIGURATION, &config);
+    if (r == SL_RESULT_SUCCESS) {
+        SLuint32 mode = SL_ANDROID_PERFORMANCE_LATENCY;
+        (*config)->SetConfiguration(config, SL_ANDROID_KEY_PERFORMANCE_MODE, &mode,
+                                    sizeof(SLuint32));
+    }
+#endif
+
     /* realize player */
     r = (*player_obj)->Realize(player_obj, SL_BOOLEAN_FALSE);
     if (r != SL_RESULT_SUCCESS)
@@ -211,11 +263,20 @@ void close_audio() {
     free(buffer);
 }
 
-int open_audio(int rate, int latency) {
+/*
+ * Open the output at rate with about latency ms of buffers. Buffers are
+ * rounded up to whole bursts of the device mixer when burst isn't 0.
+ */
+int open_audio(int rate, int latency, int burst) {
     int ret;
 
     buffer_num = latency / BUFFER_TIME;
-    buffer_size = rate * 2 * 2 * BUFFER_TIME / 1000;
+    buffer_frames = rate * BUFFER_TIME / 1000;
+    if (burst > 0) {
+        buffer_frames = (buffer_frames + burst - 1) / burst * burst;
+    }
+    buffer_size = buffer_frames * 2 * 2;
+    output_rate = rate;
 
     if (buffer_num < 3)
         buffer_num = 3;
@@ -224,9 +285,15 @@ int open_audio(int rate, int latency) {
     if (buffer == NULL)
         return -1;
 
+    /* Lives as long as the process, without it waits fall back to polling */
+    pthread_once(&free_once, open_eventfd);
+
     ret = opensl_open(rate, buffer_num);
-    if (ret < 0)
+    if (ret < 0) {
+        free(buffer);
+        buffer = NULL;
         return ret;
+    }
 
     first_free = 0;
     last_free = buffer_num - 1;
@@ -279,10 +346,62 @@ int play_audio() {
     return 0;
 }
 
+/* The output ring, for keeping it resident */
+void *get_audio_buffer(size_t *size) {
+    *size = buffer != NULL ? (size_t) buffer_size * buffer_num : 0;
+
+    return buffer;
+}
+
+int get_output_rate() {
+    return output_rate;
+}
+
+int get_buffer_frames() {
+    return buffer_frames;
+}
+
 int has_free_buffer() {
     return last_free != first_free;
 }
 
+/*
+ * Wait up to timeout ms for the output to free a buffer. Returns whether
+ * one is free. late is set to how long after the buffer was freed the
+ * caller got to run, or -1 if it didn't have to wait for one.
+ */
+int wait_free_buffer(int timeout, int64_t *late) {
+    struct pollfd pfd;
+    eventfd_t count;
+
+    *late = -1;
+
+    if (free_efd < 0) {
+        /* No eventfd, poll the queue every ms rather than have the caller spin */
+        while (!has_free_buffer() && timeout-- > 0) {
+            poll(NULL, 0, 1);
+        }
+        return has_free_buffer();
+    }
+
+    /* Drop the signals of buffers already seen free */
+    eventfd_read(free_efd, &count);
+
+    if (has_free_buffer())
+        return 1;
+
+    pfd.fd = free_efd;
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+
+    if (poll(&pfd, 1, timeout) > 0) {
+        int64_t d = now_ns() - atomic_load(&freed_ns);
+        *late = d > 0 ? d : 0;
+    }
+
+    return has_free_buffer();
+}
+
 int fill_buffer(int looped) {
     int ret;
 
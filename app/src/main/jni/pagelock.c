@@ -0,0 +1,138 @@
+/*
+ * Keep the memory the mixer touches resident while playing
+ *
+ * Before playback starts the output ring, the frame info ring and the
+ * sample data of the module are paged in, so the render thread doesn't
+ * fault on pages that were never touched or were reclaimed. Regions are
+ * locked with mlock in the order they are added while the budget and
+ * RLIMIT_MEMLOCK allow. Past that they are only advised with
+ * MADV_WILLNEED and touched once per page, which brings them in but lets
+ * the kernel reclaim them again under pressure.
+ *
+ * mlock populates pages writable already. Writable regions that are only
+ * prefaulted are touched by writing a byte back as read, which replaces
+ * zero page and copy-on-write mappings too. Only bytes inside the region
+ * are touched, never the rest of its first and last pages.
+ */
+
+#include "pagelock.h"
+#include "downgrade.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <unistd.h>
+
+/* Locks all regions may hold, whatever the budget asked for */
+static size_t memlock_limit(void) {
+    struct rlimit rl;
+
+    if (getrlimit(RLIMIT_MEMLOCK, &rl) != 0)
+        return 0;
+
+    return rl.rlim_cur == RLIM_INFINITY ? SIZE_MAX : (size_t) rl.rlim_cur;
+}
+
+void pagelock_init(struct pagelock *p, size_t budget) {
+    size_t limit = memlock_limit();
+
+    p->budget = budget < limit ? budget : limit;
+    p->locked = 0;
+    p->prefaulted = 0;
+    p->num = 0;
+    p->size = 0;
+    p->regions = NULL;
+}
+
+static void touch(void *addr, size_t len, int writable) {
+    volatile uint8_t *b = addr;
+    long page = sysconf(_SC_PAGESIZE);
+    size_t i = 0;
+
+    /* One byte per page, the first in the region and then each page start */
+    while (i < len) {
+        uint8_t v = b[i];
+        if (writable) {
+            b[i] = v;
+        }
+        i = ((uintptr_t) (b + i) | (page - 1)) + 1 - (uintptr_t) b;
+    }
+}
+
+static int remember(struct pagelock *p, void *addr, size_t len) {
+    if (p->num >= p->size) {
+        int size = p->size > 0 ? p->size * 2 : 16;
+        struct pagelock_region *r = realloc(p->regions, size * sizeof(struct pagelock_region));
+
+        if (r == NULL)
+            return -1;
+
+        p->regions = r;
+        p->size = size;
+    }
+
+    p->regions[p->num].addr = addr;
+    p->regions[p->num].len = len;
+    p->num++;
+
+    return 0;
+}
+
+/*
+ * Page in len bytes at addr, locked while the budget allows. Returns 1
+ * if they were locked, 0 if only prefaulted.
+ */
+int pagelock_add(struct pagelock *p, void *addr, size_t len, int writable) {
+    long page = sysconf(_SC_PAGESIZE);
+    uintptr_t start, end;
+
+    if (addr == NULL || len == 0)
+        return 0;
+
+    start = (uintptr_t) addr & ~((uintptr_t) page - 1);
+    end = ((uintptr_t) addr + len + page - 1) & ~((uintptr_t) page - 1);
+
+    if (p->locked + (end - start) <= p->budget && remember(p, (void *) start, end - start) == 0) {
+        if (mlock((void *) start, end - start) == 0) {
+            p->locked += end - start;
+            return 1;
+        }
+        p->num--;
+    }
+
+    madvise((void *) start, end - start, MADV_WILLNEED);
+    touch(addr, len, writable);
+    p->prefaulted += end - start;
+
+    return 0;
+}
+
+/* The sample data of mod, which the mixer only reads */
+void pagelock_module(struct pagelock *p, const struct xmp_module *mod) {
+    int i;
+
+    for (i = 0; i < mod->smp; i++) {
+        const struct xmp_sample *xxs = &mod->xxs[i];
+
+        if (xxs->data == NULL || xxs->len <= 0 || (xxs->flg & XMP_SAMPLE_SYNTH))
+            continue;
+
+        pagelock_add(p, xxs->data, sample_bytes(xxs), 0);
+    }
+}
+
+/* Unlock everything, before the regions are freed */
+void pagelock_release(struct pagelock *p) {
+    int i;
+
+    for (i = 0; i < p->num; i++) {
+        munlock(p->regions[i].addr, p->regions[i].len);
+    }
+
+    free(p->regions);
+    p->regions = NULL;
+    p->num = 0;
+    p->size = 0;
+    p->locked = 0;
+    p->prefaulted = 0;
+}
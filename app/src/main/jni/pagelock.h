@@ -0,0 +1,29 @@
+#ifndef XMP_JNI_PAGELOCK_H
+#define XMP_JNI_PAGELOCK_H
+
+#include "xmp.h"
+#include <stddef.h>
+
+struct pagelock_region {
+    void *addr;             /* page aligned */
+    size_t len;
+};
+
+struct pagelock {
+    size_t budget;          /* bytes that may be locked */
+    size_t locked;
+    size_t prefaulted;      /* bytes paged in without being locked */
+    int num;
+    int size;
+    struct pagelock_region *regions;
+};
+
+void pagelock_init(struct pagelock *, size_t);
+
+int pagelock_add(struct pagelock *, void *, size_t, int);
+
+void pagelock_module(struct pagelock *, const struct xmp_module *);
+
+void pagelock_release(struct pagelock *);
+
+#endif
@@ -0,0 +1,409 @@
+/*
+ * Magic-indexed front end for module probing
+ *
+ * xmp_test_module_from_file runs every loader's test in turn, each one
+ * seeking and reading its own header. Here a single pread of the file
+ * prefix is matched against a table of magic bytes and file extensions,
+ * resolved against libxmp's loader list once at startup, and only the
+ * few loaders it points at are tested. Packed files, formats without a
+ * magic and files no candidate accepts still go through the full scan,
+ * so the result is the same as before, only faster in the common case.
+ * Gzip and zip files are probed the same way once depacked in memory.
+ */
+
+#include "probe.h"
+#include "common.h"
+#include "depack.h"
+#include "format.h"
+#include "hio.h"
+#include <limits.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <unistd.h>
+
+/* Covers every magic offset in the table, MOD tags are at 1080 */
+#define PROBE_PREFIX 2048
+#define MAX_CANDIDATES 4
+
+/* '?' in a magic matches any byte */
+struct magic {
+    int offset;
+    const char *bytes;
+    const char *loader;
+};
+
+struct extension {
+    const char *ext;
+    const char *loader;
+};
+
+static const struct magic magics[] = {
+    {0, "Extended Module: ", "Fast Tracker II"},
+    {0, "IMPM", "Impulse Tracker"},
+    {44, "SCRM", "Scream Tracker 3"},
+    {1080, "M.K.", "Amiga Protracker/Compatible"},
+    {1080, "M!K!", "Amiga Protracker/Compatible"},
+    {1080, "M&K!", "Amiga Protracker/Compatible"},
+    {1080, "N.T.", "Amiga Protracker/Compatible"},
+    {1080, "FLT?", "Startrekker"},
+    {1080, "EXO?", "Startrekker"},
+    {1080, "?CHN", "Amiga Protracker/Compatible"},
+    {1080, "??CH", "Amiga Protracker/Compatible"},
+    {1080, "??CN", "Amiga Protracker/Compatible"},
+    {1080, "CD81", "Amiga Protracker/Compatible"},
+    {1080, "OKTA", "Amiga Protracker/Compatible"},
+    {20, "!Scream!", "Scream Tracker 2"},
+    {20, "BMOD2STM", "Scream Tracker 2"},
+    {0, "MTM", "Multitracker"},
+    {0, "if", "Composer 669"},
+    {0, "JN", "Composer 669"},
+    {0, "OKTASONG", "Oktalyzer"},
+    {0, "FAR\xfe", "Farandole Composer"},
+    {0, "MAS_UTrack_V00", "Ultra Tracker"},
+    {44, "PTMF", "Poly Tracker"},
+    {60, "IM10", "Imago Orpheus"},
+    {0, "GDM\xfe", "General Digital Music"},
+    {0, "DBM0", "DigiBooster Pro"},
+    {0, "DMDL", "Digitrakker"},
+    {0, "MMD0", "MED 2.10/OctaMED"},
+    {0, "MMD1", "MED 2.10/OctaMED"},
+    {0, "MMD2", "OctaMED"},
+    {0, "MMD3", "OctaMED"},
+};
+
+static const struct extension extensions[] = {
+    {"xm", "Fast Tracker II"},
+    {"it", "Impulse Tracker"},
+    {"s3m", "Scream Tracker 3"},
+    {"mod", "Amiga Protracker/Compatible"},
+    {"stm", "Scream Tracker 2"},
+    {"mtm", "Multitracker"},
+    {"669", "Composer 669"},
+    {"okt", "Oktalyzer"},
+    {"far", "Farandole Composer"},
+    {"ult", "Ultra Tracker"},
+    {"ptm", "Poly Tracker"},
+    {"imf", "Imago Orpheus"},
+    {"gdm", "General Digital Music"},
+    {"dbm", "DigiBooster Pro"},
+    {"mdl", "Digitrakker"},
+    {"med", "MED 2.10/OctaMED"},
+};
+
+/* Depacked before testing, gzip and zip here and the rest by libxmp */
+static const struct magic packed[] = {
+    {0, "\x1f\x8b", NULL},              /* gzip */
+    {0, "\x1f\x9d", NULL},              /* compress */
+    {0, "BZh", NULL},                   /* bzip2 */
+    {0, "\xfd" "7zXZ", NULL},           /* xz */
+    {0, "PK\x03\x04", NULL},            /* zip */
+    {2, "-lh", NULL},                   /* lha */
+    {0, "PP20", NULL},                  /* PowerPacker */
+    {0, "S404", NULL},                  /* StoneCracker */
+    {0, "ziRCONia", NULL},              /* MMCMP */
+    {0, "XPKF", NULL},                  /* XPK */
+};
+
+#define NUM_MAGICS (sizeof(magics) / sizeof(magics[0]))
+#define NUM_EXTENSIONS (sizeof(extensions) / sizeof(extensions[0]))
+#define NUM_PACKED (sizeof(packed) / sizeof(packed[0]))
+
+/* Loader index of each table entry, -1 if this libxmp doesn't have it */
+static int magic_loader[NUM_MAGICS];
+static int extension_loader[NUM_EXTENSIONS];
+static int num_loaders;
+static struct probe_stat *stats;
+static uint64_t full_scans;
+static uint64_t full_scan_ns;
+static pthread_once_t init_once = PTHREAD_ONCE_INIT;
+static pthread_mutex_t stats_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static int find_loader(const char *name) {
+    int i;
+
+    for (i = 0; i < num_loaders; i++) {
+        if (!strcmp(format_loaders[i]->name, name))
+            return i;
+    }
+
+    return -1;
+}
+
+static void init_tables(void) {
+    size_t i;
+
+    for (num_loaders = 0; format_loaders[num_loaders] != NULL; num_loaders++);
+
+    stats = calloc(num_loaders, sizeof(struct probe_stat));
+    if (stats != NULL) {
+        for (i = 0; i < (size_t) num_loaders; i++) {
+            stats[i].name = format_loaders[i]->name;
+        }
+    }
+
+    for (i = 0; i < NUM_MAGICS; i++) {
+        magic_loader[i] = find_loader(magics[i].loader);
+    }
+
+    for (i = 0; i < NUM_EXTENSIONS; i++) {
+        extension_loader[i] = find_loader(extensions[i].loader);
+    }
+}
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int matches(const struct magic *m, const uint8_t *buf, ssize_t len) {
+    size_t n = strlen(m->bytes);
+    size_t i;
+
+    if (m->offset + (ssize_t) n > len)
+        return 0;
+
+    for (i = 0; i < n; i++) {
+        if (m->bytes[i] != '?' && (uint8_t) m->bytes[i] != buf[m->offset + i])
+            return 0;
+    }
+
+    return 1;
+}
+
+static int add_candidate(int *list, int num, int loader) {
+    int i;
+
+    if (loader < 0 || num >= MAX_CANDIDATES)
+        return num;
+
+    for (i = 0; i < num; i++) {
+        if (list[i] == loader)
+            return num;
+    }
+
+    list[num] = loader;
+
+    return num + 1;
+}
+
+/*
+ * Amiga modules are often named mod.title rather than title.mod, so
+ * both the suffix and the prefix of the name are tried
+ */
+static int add_by_name(int fd, int *list, int num) {
+    char link[32], path[PATH_MAX];
+    const char *base, *dot;
+    ssize_t len;
+    size_t i;
+
+    snprintf(link, sizeof(link), "/proc/self/fd/%d", fd);
+    len = readlink(link, path, sizeof(path) - 1);
+    if (len <= 0)
+        return num;
+    path[len] = 0;
+
+    base = strrchr(path, '/');
+    base = base != NULL ? base + 1 : path;
+    dot = strrchr(base, '.');
+    if (dot == NULL)
+        return num;
+
+    for (i = 0; i < NUM_EXTENSIONS; i++) {
+        size_t n = strlen(extensions[i].ext);
+
+        if (!strcasecmp(dot + 1, extensions[i].ext) ||
+            (!strncasecmp(base, extensions[i].ext, n) && base[n] == '.')) {
+            num = add_candidate(list, num, extension_loader[i]);
+        }
+    }
+
+    return num;
+}
+
+static int is_packed(const uint8_t *buf, ssize_t len) {
+    size_t i;
+
+    for (i = 0; i < NUM_PACKED; i++) {
+        if (matches(&packed[i], buf, len))
+            return 1;
+    }
+
+    return 0;
+}
+
+/* Mirror what xmp_test_module_from_file reports for a plain loader */
+static void fill_info(struct xmp_test_info *ti, const char *name, int loader) {
+    strncpy(ti->name, name, XMP_NAME_SIZE - 1);
+    ti->name[XMP_NAME_SIZE - 1] = 0;
+    strncpy(ti->type, format_loaders[loader]->name, XMP_NAME_SIZE - 1);
+    ti->type[XMP_NAME_SIZE - 1] = 0;
+}
+
+static int test_candidates(HIO_HANDLE *h, const int *list, int num, struct xmp_test_info *ti) {
+    char buf[XMP_NAME_SIZE];
+    int i;
+
+    for (i = 0; i < num; i++) {
+        uint64_t t0 = now_ns();
+        int ok;
+
+        memset(buf, 0, sizeof(buf));
+        hio_seek(h, 0, SEEK_SET);
+        ok = format_loaders[list[i]]->test(h, buf, 0) == 0;
+
+        pthread_mutex_lock(&stats_mutex);
+        stats[list[i]].tries++;
+        stats[list[i]].ns += now_ns() - t0;
+        if (ok)
+            stats[list[i]].hits++;
+        pthread_mutex_unlock(&stats_mutex);
+
+        if (ok) {
+            fill_info(ti, buf, list[i]);
+            return 0;
+        }
+    }
+
+    return -1;
+}
+
+static int find_candidates(const uint8_t *buf, ssize_t len, int *list) {
+    int num = 0;
+    size_t i;
+
+    for (i = 0; i < NUM_MAGICS; i++) {
+        if (matches(&magics[i], buf, len))
+            num = add_candidate(list, num, magic_loader[i]);
+    }
+
+    return num;
+}
+
+/* Test the whole loader list, on the file or on depacked memory */
+static int full_scan(FILE *f, const void *mem, size_t len, struct xmp_test_info *ti) {
+    uint64_t t0 = now_ns();
+    int res, loader;
+
+    if (mem != NULL) {
+        res = xmp_test_module_from_memory(mem, len, ti);
+    } else {
+        rewind(f);
+        res = xmp_test_module_from_file(f, ti);
+    }
+
+    pthread_mutex_lock(&stats_mutex);
+    full_scans++;
+    full_scan_ns += now_ns() - t0;
+    if (res == 0 && (loader = find_loader(ti->type)) >= 0)
+        stats[loader].missed++;
+    pthread_mutex_unlock(&stats_mutex);
+
+    return res;
+}
+
+/*
+ * Test a module in memory, depacked or the start of an archive member,
+ * with the same result and info as xmp_test_module_from_memory
+ */
+int probe_memory(const void *mem, size_t len, struct xmp_test_info *ti) {
+    int list[MAX_CANDIDATES];
+    HIO_HANDLE *h;
+    int num;
+
+    pthread_once(&init_once, init_tables);
+
+    if (stats == NULL)
+        return xmp_test_module_from_memory(mem, len, ti);
+
+    num = find_candidates(mem, len < PROBE_PREFIX ? len : PROBE_PREFIX, list);
+
+    if (num > 0 && (h = hio_open_const_mem(mem, len)) != NULL) {
+        int res = test_candidates(h, list, num, ti);
+
+        hio_close(h);
+        if (res == 0)
+            return 0;
+    }
+
+    return full_scan(NULL, mem, len, ti);
+}
+
+/*
+ * Test the module in f, with the same result and info as
+ * xmp_test_module_from_file. The file is left open.
+ */
+int probe_module(FILE *f, struct xmp_test_info *ti) {
+    uint8_t buf[PROBE_PREFIX];
+    int list[MAX_CANDIDATES];
+    int fd = fileno(f);
+    struct depacked d;
+    HIO_HANDLE *h;
+    ssize_t len;
+    int num, res;
+
+    pthread_once(&init_once, init_tables);
+
+    if (stats == NULL)
+        return xmp_test_module_from_file(f, ti);
+
+    len = pread(fd, buf, sizeof(buf), 0);
+    if (len <= 0)
+        return -XMP_ERROR_SYSTEM;
+
+    if (is_packed(buf, len)) {
+        if (depack_fd(fd, &d) == 0) {
+            res = probe_memory(d.data, d.len, ti);
+            depack_free(&d);
+            return res;
+        }
+
+        return full_scan(f, NULL, 0, ti);
+    }
+
+    num = find_candidates(buf, len, list);
+    num = add_by_name(fd, list, num);
+
+    if (num > 0 && (h = hio_open_file(f)) != NULL) {
+        res = test_candidates(h, list, num, ti);
+
+        hio_close(h);
+        if (res == 0)
+            return 0;
+    }
+
+    return full_scan(f, NULL, 0, ti);
+}
+
+int probe_num_loaders(void) {
+    pthread_once(&init_once, init_tables);
+
+    return stats != NULL ? num_loaders : 0;
+}
+
+/*
+ * Copy up to num loader stats, and the count and time of full scans.
+ * Returns the number of loaders copied.
+ */
+int probe_get_stats(struct probe_stat *out, int num, uint64_t *scans, uint64_t *scan_ns) {
+    pthread_once(&init_once, init_tables);
+
+    if (stats == NULL)
+        return 0;
+
+    if (num > num_loaders)
+        num = num_loaders;
+
+    pthread_mutex_lock(&stats_mutex);
+    memcpy(out, stats, num * sizeof(struct probe_stat));
+    *scans = full_scans;
+    *scan_ns = full_scan_ns;
+    pthread_mutex_unlock(&stats_mutex);
+
+    return num;
+}
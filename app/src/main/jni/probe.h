@@ -0,0 +1,26 @@
+#ifndef XMP_JNI_PROBE_H
+#define XMP_JNI_PROBE_H
+
+#include "xmp.h"
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/* Probe cost of one libxmp loader, times in nanoseconds */
+struct probe_stat {
+    const char *name;
+    uint64_t tries;         /* tested as a dispatch candidate */
+    uint64_t hits;          /* candidate test accepted the file */
+    uint64_t ns;            /* time spent in candidate tests */
+    uint64_t missed;        /* accepted by the full scan, not a candidate */
+};
+
+int probe_module(FILE *, struct xmp_test_info *);
+
+int probe_memory(const void *, size_t, struct xmp_test_info *);
+
+int probe_num_loaders(void);
+
+int probe_get_stats(struct probe_stat *, int, uint64_t *, uint64_t *);
+
+#endif
@@ -0,0 +1,419 @@
+/*
+ * Windowed-sinc polyphase resampler for interleaved 16-bit stereo
+ *
+ * Coefficient tables are built once per (taps, cutoff) pair and shared by
+ * every resampler instance. Each phase row is padded to a cache line so the
+ * dot product kernels always load aligned coefficients. If the sinc kernel
+ * goes over its per-buffer time budget the resampler drops to a 4-point
+ * cubic kernel on the same history, and tries sinc again a bit later.
+ */
+
+#include "resampler.h"
+#include "simd.h"
+#include <math.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define SINC_PHASES 256
+#define SINC_ZEROS 16
+#define SINC_ROLLOFF 0.91
+#define KAISER_BETA 7.5
+#define MAX_TABLES 8
+
+/* Share of the output buffer duration the sinc kernel may take */
+#define BUDGET_PERCENT 20
+
+/* Buffers to stay on the cubic kernel before trying sinc again */
+#define RETRY_BUFFERS 50
+
+struct sinc_table {
+    int taps;
+    int stride;
+    double cutoff;
+    float *coef;
+};
+
+struct resampler {
+    const struct sinc_table *table;
+    int out_rate;
+    uint64_t step;
+    uint64_t pos;
+    int max_in;
+    int filled;
+    int hist_len;
+    float *hist[2];
+    int quality;
+    int retry;
+};
+
+static struct sinc_table tables[MAX_TABLES];
+static int num_tables;
+static pthread_mutex_t table_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static long long now_ns(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (long long) ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static double bessel_i0(double x) {
+    double sum = 1.0;
+    double term = 1.0;
+    int k;
+
+    for (k = 1; k < 64; k++) {
+        term *= (x / (2 * k)) * (x / (2 * k));
+        sum += term;
+        if (term < sum * 1e-12)
+            break;
+    }
+
+    return sum;
+}
+
+static const struct sinc_table *get_table(int taps, double cutoff) {
+    struct sinc_table *t = NULL;
+    float *coef;
+    double norm;
+    int i, p, k, half, stride;
+
+    pthread_mutex_lock(&table_mutex);
+
+    for (i = 0; i < num_tables; i++) {
+        if (tables[i].taps == taps && tables[i].cutoff == cutoff) {
+            t = &tables[i];
+            goto done;
+        }
+    }
+
+    if (num_tables >= MAX_TABLES)
+        goto done;
+
+    /* One extra phase row so phase interpolation never wraps */
+    stride = ALIGN_UP(taps, (int) (CACHE_LINE / sizeof(float)));
+    if (posix_memalign((void **) &coef, CACHE_LINE,
+                       (SINC_PHASES + 1) * stride * sizeof(float)) != 0) {
+        goto done;
+    }
+    memset(coef, 0, (SINC_PHASES + 1) * stride * sizeof(float));
+
+    half = taps / 2;
+    norm = bessel_i0(KAISER_BETA);
+
+    for (p = 0; p <= SINC_PHASES; p++) {
+        float *row = coef + p * stride;
+        double sum = 0.0;
+
+        for (k = 0; k < taps; k++) {
+            double x = k - (half - 1) - (double) p / SINC_PHASES;
+            double r = x / half;
+            double w, s;
+
+            if (r <= -1.0 || r >= 1.0) {
+                w = 0.0;
+            } else {
+                w = bessel_i0(KAISER_BETA * sqrt(1.0 - r * r)) / norm;
+            }
+
+            if (x == 0.0) {
+                s = 1.0;
+            } else {
+                s = sin(2.0 * M_PI * cutoff * x) / (2.0 * M_PI * cutoff * x);
+            }
+
+            row[k] = (float) (s * w);
+            sum += row[k];
+        }
+
+        /* Unity gain at DC for every phase */
+        for (k = 0; k < taps; k++) {
+            row[k] = (float) (row[k] / sum);
+        }
+    }
+
+    t = &tables[num_tables++];
+    t->taps = taps;
+    t->stride = stride;
+    t->cutoff = cutoff;
+    t->coef = coef;
+
+    done:
+    pthread_mutex_unlock(&table_mutex);
+
+    return t;
+}
+
+/*
+ * Dot products of two adjacent phase rows against both channels:
+ * acc[0] = c0.l, acc[1] = c1.l, acc[2] = c0.r, acc[3] = c1.r
+ * n is a multiple of 4, c0 and c1 are cache aligned.
+ */
+static void dot4(const float *c0, const float *c1,
+                 const float *l, const float *r, int n, float *acc) {
+    int k;
+
+#if defined(HAVE_NEON)
+    float32x4_t a0 = vdupq_n_f32(0.0f);
+    float32x4_t a1 = vdupq_n_f32(0.0f);
+    float32x4_t a2 = vdupq_n_f32(0.0f);
+    float32x4_t a3 = vdupq_n_f32(0.0f);
+
+    for (k = 0; k < n; k += 4) {
+        float32x4_t k0 = vld1q_f32(c0 + k);
+        float32x4_t k1 = vld1q_f32(c1 + k);
+        float32x4_t xl = vld1q_f32(l + k);
+        float32x4_t xr = vld1q_f32(r + k);
+
+        a0 = vmlaq_f32(a0, k0, xl);
+        a1 = vmlaq_f32(a1, k1, xl);
+        a2 = vmlaq_f32(a2, k0, xr);
+        a3 = vmlaq_f32(a3, k1, xr);
+    }
+
+#if defined(__aarch64__)
+    acc[0] = vaddvq_f32(a0);
+    acc[1] = vaddvq_f32(a1);
+    acc[2] = vaddvq_f32(a2);
+    acc[3] = vaddvq_f32(a3);
+#else
+    {
+        float32x2_t s0 = vadd_f32(vget_low_f32(a0), vget_high_f32(a0));
+        float32x2_t s1 = vadd_f32(vget_low_f32(a1), vget_high_f32(a1));
+        float32x2_t s2 = vadd_f32(vget_low_f32(a2), vget_high_f32(a2));
+        float32x2_t s3 = vadd_f32(vget_low_f32(a3), vget_high_f32(a3));
+        float32x2_t p01 = vpadd_f32(s0, s1);
+        float32x2_t p23 = vpadd_f32(s2, s3);
+
+        vst1_f32(acc, p01);
+        vst1_f32(acc + 2, p23);
+    }
+#endif
+#elif defined(HAVE_SSE2)
+    __m128 a0 = _mm_setzero_ps();
+    __m128 a1 = _mm_setzero_ps();
+    __m128 a2 = _mm_setzero_ps();
+    __m128 a3 = _mm_setzero_ps();
+    __m128 t0, t1, t2, t3;
+
+    for (k = 0; k < n; k += 4) {
+        __m128 k0 = _mm_load_ps(c0 + k);
+        __m128 k1 = _mm_load_ps(c1 + k);
+        __m128 xl = _mm_loadu_ps(l + k);
+        __m128 xr = _mm_loadu_ps(r + k);
+
+        a0 = _mm_add_ps(a0, _mm_mul_ps(k0, xl));
+        a1 = _mm_add_ps(a1, _mm_mul_ps(k1, xl));
+        a2 = _mm_add_ps(a2, _mm_mul_ps(k0, xr));
+        a3 = _mm_add_ps(a3, _mm_mul_ps(k1, xr));
+    }
+
+    /* 4x4 transpose, then a vertical add gives the four sums */
+    t0 = _mm_unpacklo_ps(a0, a1);
+    t1 = _mm_unpackhi_ps(a0, a1);
+    t2 = _mm_unpacklo_ps(a2, a3);
+    t3 = _mm_unpackhi_ps(a2, a3);
+    a0 = _mm_movelh_ps(t0, t2);
+    a1 = _mm_movehl_ps(t2, t0);
+    a2 = _mm_movelh_ps(t1, t3);
+    a3 = _mm_movehl_ps(t3, t1);
+    _mm_storeu_ps(acc, _mm_add_ps(_mm_add_ps(a0, a1), _mm_add_ps(a2, a3)));
+#else
+    acc[0] = acc[1] = acc[2] = acc[3] = 0.0f;
+
+    for (k = 0; k < n; k++) {
+        acc[0] += c0[k] * l[k];
+        acc[1] += c1[k] * l[k];
+        acc[2] += c0[k] * r[k];
+        acc[3] += c1[k] * r[k];
+    }
+#endif
+}
+
+static float cubic(const float *x, float t) {
+    /* Catmull-Rom through x[0]..x[3], between x[1] and x[2] */
+    float a = -0.5f * x[0] + 1.5f * x[1] - 1.5f * x[2] + 0.5f * x[3];
+    float b = x[0] - 2.5f * x[1] + 2.0f * x[2] - 0.5f * x[3];
+    float c = -0.5f * x[0] + 0.5f * x[2];
+
+    return ((a * t + b) * t + c) * t + x[1];
+}
+
+static short clamp16(float v) {
+    long s = lrintf(v);
+
+    if (s > 32767)
+        return 32767;
+    if (s < -32768)
+        return -32768;
+
+    return (short) s;
+}
+
+struct resampler *resampler_new(int in_rate, int out_rate, int max_out) {
+    struct resampler *r;
+    double ratio, cutoff;
+    int taps, i;
+
+    if (in_rate <= 0 || out_rate <= 0 || max_out <= 0)
+        return NULL;
+
+    r = calloc(1, sizeof(struct resampler));
+    if (r == NULL)
+        return NULL;
+
+    /* When going down in rate, the cutoff and kernel width follow the ratio */
+    ratio = out_rate < in_rate ? (double) out_rate / in_rate : 1.0;
+    cutoff = 0.5 * ratio * SINC_ROLLOFF;
+    taps = ALIGN_UP((int) ceil(2 * SINC_ZEROS / ratio), 4);
+
+    r->table = get_table(taps, cutoff);
+    if (r->table == NULL)
+        goto err;
+
+    r->out_rate = out_rate;
+    r->step = ((uint64_t) in_rate << 32) / (uint64_t) out_rate;
+    r->max_in = (int) (((uint64_t) max_out * r->step) >> 32) + taps + 2;
+    r->hist_len = r->max_in + taps + 4;
+
+    for (i = 0; i < 2; i++) {
+        if (posix_memalign((void **) &r->hist[i], CACHE_LINE,
+                           r->hist_len * sizeof(float)) != 0) {
+            r->hist[i] = NULL;
+            goto err;
+        }
+    }
+
+    resampler_reset(r);
+
+    return r;
+
+    err:
+    resampler_free(r);
+
+    return NULL;
+}
+
+void resampler_free(struct resampler *r) {
+    if (r == NULL)
+        return;
+
+    free(r->hist[0]);
+    free(r->hist[1]);
+    free(r);
+}
+
+void resampler_reset(struct resampler *r) {
+    memset(r->hist[0], 0, r->hist_len * sizeof(float));
+    memset(r->hist[1], 0, r->hist_len * sizeof(float));
+
+    /* Pre-roll of silence so the first output lines up with the first input */
+    r->filled = r->table->taps / 2 - 1;
+    r->pos = 0;
+    r->quality = RESAMPLER_SINC;
+    r->retry = 0;
+}
+
+int resampler_quality(struct resampler *r) {
+    return r->quality;
+}
+
+/* Number of input frames to feed before producing out_frames */
+int resampler_input_frames(struct resampler *r, int out_frames) {
+    uint64_t last;
+    int need;
+
+    if (out_frames <= 0)
+        return 0;
+
+    last = r->pos + (uint64_t) (out_frames - 1) * r->step;
+    need = (int) (last >> 32) + r->table->taps - r->filled;
+
+    if (need < 0)
+        need = 0;
+    if (need > r->max_in)
+        need = r->max_in;
+
+    return need;
+}
+
+void resampler_process(struct resampler *r, const short *in, int in_frames,
+                       short *out, int out_frames) {
+    const struct sinc_table *t = r->table;
+    float *l = r->hist[0];
+    float *rt = r->hist[1];
+    int half = t->taps / 2;
+    long long start = 0;
+    int i, consumed;
+
+    if (in_frames > r->hist_len - r->filled)
+        in_frames = r->hist_len - r->filled;
+
+    for (i = 0; i < in_frames; i++) {
+        l[r->filled + i] = in[i * 2];
+        rt[r->filled + i] = in[i * 2 + 1];
+    }
+    r->filled += in_frames;
+
+    if (r->quality == RESAMPLER_SINC) {
+        start = now_ns();
+    }
+
+    for (i = 0; i < out_frames; i++) {
+        int ipos = (int) (r->pos >> 32);
+        uint32_t f = (uint32_t) r->pos;
+        float a, b;
+
+        if (ipos + t->taps > r->filled) {
+            /* Starved, only if the caller fed less than asked for */
+            out[i * 2] = out[i * 2 + 1] = 0;
+            continue;
+        }
+
+        if (r->quality == RESAMPLER_SINC) {
+            const float *c0 = t->coef + (f >> 24) * t->stride;
+            float frac = (float) ((f >> 8) & 0xffff) * (1.0f / 65536.0f);
+            float acc[4];
+
+            dot4(c0, c0 + t->stride, l + ipos, rt + ipos, t->taps, acc);
+            a = acc[0] + frac * (acc[1] - acc[0]);
+            b = acc[2] + frac * (acc[3] - acc[2]);
+        } else {
+            int base = ipos + half - 2;
+            float frac = (float) f * (1.0f / 4294967296.0f);
+
+            a = cubic(l + base, frac);
+            b = cubic(rt + base, frac);
+        }
+
+        out[i * 2] = clamp16(a);
+        out[i * 2 + 1] = clamp16(b);
+
+        r->pos += r->step;
+    }
+
+    /* Drop history that no further output can reach */
+    consumed = (int) (r->pos >> 32);
+    if (consumed > r->filled)
+        consumed = r->filled;
+
+    memmove(l, l + consumed, (r->filled - consumed) * sizeof(float));
+    memmove(rt, rt + consumed, (r->filled - consumed) * sizeof(float));
+    r->filled -= consumed;
+    r->pos -= (uint64_t) consumed << 32;
+
+    if (r->quality == RESAMPLER_SINC) {
+        long long budget = (long long) out_frames * 1000000000LL / r->out_rate;
+
+        if ((now_ns() - start) * 100 > budget * BUDGET_PERCENT) {
+            r->quality = RESAMPLER_CUBIC;
+            r->retry = RETRY_BUFFERS;
+        }
+    } else if (--r->retry <= 0) {
+        r->quality = RESAMPLER_SINC;
+    }
+}
@@ -0,0 +1,21 @@
+#ifndef XMP_JNI_RESAMPLER_H
+#define XMP_JNI_RESAMPLER_H
+
+#define RESAMPLER_SINC  0
+#define RESAMPLER_CUBIC 1
+
+struct resampler;
+
+struct resampler *resampler_new(int, int, int);
+
+void resampler_free(struct resampler *);
+
+int resampler_input_frames(struct resampler *, int);
+
+void resampler_process(struct resampler *, const short *, int, short *, int);
+
+int resampler_quality(struct resampler *);
+
+void resampler_reset(struct resampler *);
+
+#endif
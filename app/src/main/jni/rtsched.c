@@ -0,0 +1,175 @@
+/*
+ * Scheduling and placement of the render thread, and what it costs
+ *
+ * The thread that fills output buffers asks for SCHED_FIFO first, which
+ * needs the permission to, and otherwise for the most urgent nice value
+ * it is allowed. On big.LITTLE devices it is then bound to the cores
+ * above the slowest cluster, found from their maximum frequencies, so it
+ * stays off the little cores the UI and the collector crowd. Whatever
+ * can't be had is left at its default.
+ *
+ * For every buffer the time the thread spent off the CPU while rendering,
+ * its involuntary context switches and its page faults are accounted, and
+ * for every wait on the output how long after the buffer was freed the
+ * thread ran.
+ */
+
+#include "rtsched.h"
+#include <sched.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifndef SCHED_RESET_ON_FORK
+#define SCHED_RESET_ON_FORK 0
+#endif
+
+static uint64_t clock_ns(clockid_t id) {
+    struct timespec ts;
+
+    clock_gettime(id, &ts);
+
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static long max_freq(int cpu) {
+    char path[80];
+    long khz = -1;
+    FILE *f;
+
+    snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/cpufreq/cpuinfo_max_freq", cpu);
+
+    f = fopen(path, "r");
+    if (f != NULL) {
+        if (fscanf(f, "%ld", &khz) != 1)
+            khz = -1;
+        fclose(f);
+    }
+
+    return khz;
+}
+
+/* Cores faster than the slowest cluster, 0 if they are all alike or unknown */
+static int fast_cores(cpu_set_t *set) {
+    long freq[CPU_SETSIZE];
+    long lowest = -1, highest = -1;
+    int i, num = 0;
+    int cpus = (int) sysconf(_SC_NPROCESSORS_CONF);
+
+    if (cpus > CPU_SETSIZE)
+        cpus = CPU_SETSIZE;
+
+    for (i = 0; i < cpus; i++) {
+        freq[i] = max_freq(i);
+        if (freq[i] < 0)
+            continue;
+        if (lowest < 0 || freq[i] < lowest)
+            lowest = freq[i];
+        if (freq[i] > highest)
+            highest = freq[i];
+    }
+
+    if (lowest < 0 || lowest == highest)
+        return 0;
+
+    CPU_ZERO(set);
+
+    for (i = 0; i < cpus; i++) {
+        if (freq[i] > lowest) {
+            CPU_SET(i, set);
+            num++;
+        }
+    }
+
+    return num;
+}
+
+/*
+ * Raise the scheduling of the calling thread as far as allowed and bind
+ * it to the fast cores. Returns the policy it got.
+ */
+int rtsched_apply(struct rtsched *r) {
+    struct sched_param sp;
+    cpu_set_t set;
+    int num;
+
+    memset(&sp, 0, sizeof(sp));
+    sp.sched_priority = RTSCHED_FIFO_PRIORITY;
+
+    if (sched_setscheduler(0, SCHED_FIFO | SCHED_RESET_ON_FORK, &sp) == 0) {
+        r->policy = RTSCHED_FIFO;
+        r->priority = RTSCHED_FIFO_PRIORITY;
+    } else if (setpriority(PRIO_PROCESS, gettid(), RTSCHED_NICE_URGENT) == 0) {
+        r->policy = RTSCHED_NICE;
+        r->priority = RTSCHED_NICE_URGENT;
+    } else if (setpriority(PRIO_PROCESS, gettid(), RTSCHED_NICE_AUDIO) == 0) {
+        r->policy = RTSCHED_NICE;
+        r->priority = RTSCHED_NICE_AUDIO;
+    } else {
+        r->policy = RTSCHED_DEFAULT;
+        r->priority = getpriority(PRIO_PROCESS, gettid());
+    }
+
+    num = fast_cores(&set);
+    r->cpus = num > 0 && sched_setaffinity(0, sizeof(set), &set) == 0 ? num : 0;
+
+    return r->policy;
+}
+
+/* Clear the counters, for a new module */
+void rtsched_reset(struct rtsched *r) {
+    r->buffers = 0;
+    r->wakeups = 0;
+    r->wake_ns = 0;
+    r->wake_max_ns = 0;
+    r->preempt_ns = 0;
+    r->preempt_max_ns = 0;
+    r->switches = 0;
+    r->minor_faults = 0;
+    r->major_faults = 0;
+    r->fault_buffers = 0;
+}
+
+/* The render thread ran late ns after the output freed a buffer */
+void rtsched_wake(struct rtsched *r, int64_t late) {
+    if (late < 0)
+        return;
+
+    r->wakeups++;
+    r->wake_ns += late;
+    if ((uint64_t) late > r->wake_max_ns)
+        r->wake_max_ns = late;
+}
+
+static void thread_usage(struct rusage *ru) {
+    if (getrusage(RUSAGE_THREAD, ru) != 0)
+        memset(ru, 0, sizeof(struct rusage));
+}
+
+/* Around rendering a buffer, on the render thread */
+void rtsched_begin(struct rtsched *r) {
+    thread_usage(&r->ru0);
+    r->wall0 = clock_ns(CLOCK_MONOTONIC);
+    r->cpu0 = clock_ns(CLOCK_THREAD_CPUTIME_ID);
+}
+
+void rtsched_end(struct rtsched *r) {
+    uint64_t wall = clock_ns(CLOCK_MONOTONIC) - r->wall0;
+    uint64_t cpu = clock_ns(CLOCK_THREAD_CPUTIME_ID) - r->cpu0;
+    uint64_t off = wall > cpu ? wall - cpu : 0;
+    struct rusage ru;
+
+    thread_usage(&ru);
+
+    r->buffers++;
+    r->preempt_ns += off;
+    if (off > r->preempt_max_ns)
+        r->preempt_max_ns = off;
+    r->switches += ru.ru_nivcsw - r->ru0.ru_nivcsw;
+    r->minor_faults += ru.ru_minflt - r->ru0.ru_minflt;
+    r->major_faults += ru.ru_majflt - r->ru0.ru_majflt;
+    if (ru.ru_minflt != r->ru0.ru_minflt || ru.ru_majflt != r->ru0.ru_majflt)
+        r->fault_buffers++;
+}
@@ -0,0 +1,48 @@
+#ifndef XMP_JNI_RTSCHED_H
+#define XMP_JNI_RTSCHED_H
+
+#include <stdint.h>
+#include <sys/resource.h>
+
+/* Scheduling the render thread got */
+#define RTSCHED_DEFAULT 0
+#define RTSCHED_NICE 1          /* raised nice value */
+#define RTSCHED_FIFO 2          /* real-time, SCHED_FIFO */
+
+/* Low like the platform audio threads, above every normal thread anyway */
+#define RTSCHED_FIFO_PRIORITY 2
+
+/* Nice values tried in turn, Android's urgent audio and audio priorities */
+#define RTSCHED_NICE_URGENT (-19)
+#define RTSCHED_NICE_AUDIO (-16)
+
+struct rtsched {
+    int policy;
+    int priority;           /* SCHED_FIFO priority or nice value */
+    int cpus;               /* cores the thread is bound to, 0 for any */
+    uint64_t buffers;
+    uint64_t wakeups;       /* waits for the output to free a buffer */
+    uint64_t wake_ns;       /* total and worst time from freed to running */
+    uint64_t wake_max_ns;
+    uint64_t preempt_ns;    /* total and worst time off the CPU while rendering */
+    uint64_t preempt_max_ns;
+    uint64_t switches;      /* involuntary context switches while rendering */
+    uint64_t minor_faults;  /* page faults while rendering */
+    uint64_t major_faults;
+    uint64_t fault_buffers; /* buffers that faulted at all */
+    uint64_t wall0;
+    uint64_t cpu0;
+    struct rusage ru0;
+};
+
+int rtsched_apply(struct rtsched *);
+
+void rtsched_reset(struct rtsched *);
+
+void rtsched_wake(struct rtsched *, int64_t);
+
+void rtsched_begin(struct rtsched *);
+
+void rtsched_end(struct rtsched *);
+
+#endif
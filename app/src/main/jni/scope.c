@@ -0,0 +1,208 @@
+/*
+ * Per-channel oscilloscopes and peaks from the mixer voices
+ *
+ * After each rendered buffer the voices libxmp just mixed are walked and
+ * the stretch of sample data each one played is resampled into a window
+ * of fixed width, at its final volume, and summed into the window of the
+ * channel it belongs to, so new note actions add up on their channel.
+ * Each voice's step is measured from how far it moved during the buffer,
+ * which follows portamento and vibrato, the mixer formula is only used
+ * when a voice starts or wraps around its loop.
+ *
+ * Windows and peaks are kept per buffer in a ring with one slot per
+ * frame info snapshot, so they are read with the same latency. Work per
+ * buffer is bounded by voices times width whatever the buffer size is.
+ */
+
+#include "scope.h"
+#include "common.h"
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef XMP_SAMPLE_STEREO
+#define XMP_SAMPLE_STEREO 0
+#endif
+
+/* Final voice volume of the libxmp mixer at full scale */
+#define VOL_MAX 0x400
+
+struct scope {
+    int slots;
+    int chn;
+    int width;
+    int voices;
+    int8_t *wave;           /* slots * chn * width */
+    int *peak;              /* slots * chn */
+    int *acc;               /* chn * width */
+    double *last_pos;       /* per voice, position after the previous buffer */
+    int *last_smp;          /* per voice, -1 when it wasn't playing */
+};
+
+/* Ring of slots windows of width points for the channels of the loaded module */
+struct scope *scope_new(xmp_context ctx, int slots, int chn, int width) {
+    struct context_data *c = (struct context_data *) ctx;
+    struct scope *s;
+    int i;
+
+    if (slots <= 0 || chn <= 0 || width <= 0)
+        return NULL;
+
+    s = calloc(1, sizeof(struct scope));
+    if (s == NULL)
+        return NULL;
+
+    s->slots = slots;
+    s->chn = chn;
+    s->width = width;
+    s->voices = c->p.virt.maxvoc;
+    s->wave = calloc((size_t) slots * chn * width, 1);
+    s->peak = calloc((size_t) slots * chn, sizeof(int));
+    s->acc = malloc((size_t) chn * width * sizeof(int));
+    s->last_pos = calloc(s->voices > 0 ? s->voices : 1, sizeof(double));
+    s->last_smp = malloc((s->voices > 0 ? s->voices : 1) * sizeof(int));
+
+    if (s->wave == NULL || s->peak == NULL || s->acc == NULL || s->last_pos == NULL ||
+        s->last_smp == NULL) {
+        scope_free(s);
+        return NULL;
+    }
+
+    for (i = 0; i < s->voices; i++)
+        s->last_smp[i] = -1;
+
+    return s;
+}
+
+void scope_free(struct scope *s) {
+    if (s == NULL)
+        return;
+
+    free(s->wave);
+    free(s->peak);
+    free(s->acc);
+    free(s->last_pos);
+    free(s->last_smp);
+    free(s);
+}
+
+static int sample_at(const struct xmp_sample *xxs, int i) {
+    if (xxs->flg & XMP_SAMPLE_STEREO)
+        i *= 2;
+
+    if (xxs->flg & XMP_SAMPLE_16BIT)
+        return ((const int16_t *) xxs->data)[i];
+
+    return ((const int8_t *) xxs->data)[i] << 8;
+}
+
+/* Add what the voice played over the last frames to its channel window */
+static void add_voice(struct scope *s, const struct xmp_sample *xxs, int root, int vol,
+                      double pos, double step, int frames) {
+    int *acc = s->acc + root * s->width;
+    int loop = (xxs->flg & XMP_SAMPLE_LOOP) && xxs->lpe > xxs->lps;
+    int end = loop ? xxs->lpe : xxs->len;
+    double delta = step * frames / s->width;
+    double start = pos - step * frames;
+    int i;
+
+    if (loop && start < xxs->lps && pos >= xxs->lps) {
+        start = xxs->lpe - fmod(xxs->lps - start, xxs->lpe - xxs->lps);
+    } else if (start < 0) {
+        start = 0;
+    }
+
+    for (i = 0; i < s->width; i++) {
+        int n = (int) start;
+
+        if (n >= end) {
+            if (!loop)
+                break;
+            start = xxs->lps + fmod(start - xxs->lpe, xxs->lpe - xxs->lps);
+            n = (int) start;
+        }
+
+        acc[i] += sample_at(xxs, n) * vol / VOL_MAX;
+        start += delta;
+    }
+}
+
+/*
+ * Record the voices mixed into the last buffer, frames long at the
+ * player rate, into slot
+ */
+void scope_capture(struct scope *s, xmp_context ctx, int slot, int frames) {
+    struct context_data *c = (struct context_data *) ctx;
+    struct xmp_module *mod = &c->m.mod;
+    struct mixer_voice *voices = c->p.virt.voice_array;
+    int num = c->p.virt.maxvoc < s->voices ? c->p.virt.maxvoc : s->voices;
+    int8_t *wave = s->wave + (size_t) slot * s->chn * s->width;
+    int *peak = s->peak + slot * s->chn;
+    int i, j;
+
+    memset(s->acc, 0, (size_t) s->chn * s->width * sizeof(int));
+
+    for (i = 0; i < num && frames > 0; i++) {
+        const struct mixer_voice *vi = &voices[i];
+        const struct xmp_sample *xxs;
+        double step;
+        int vol;
+
+        if (vi->chn < 0 || vi->root < 0 || vi->root >= s->chn || vi->smp < 0 ||
+            vi->smp >= mod->smp || vi->period < 1) {
+            s->last_smp[i] = -1;
+            continue;
+        }
+
+        xxs = &mod->xxs[vi->smp];
+        if (xxs->data == NULL || xxs->len <= 0 || (xxs->flg & XMP_SAMPLE_SYNTH)) {
+            s->last_smp[i] = -1;
+            continue;
+        }
+
+        if (s->last_smp[i] == vi->smp && vi->pos > s->last_pos[i]) {
+            step = (vi->pos - s->last_pos[i]) / frames;
+        } else {
+            step = C4_PERIOD * c->m.c4rate / c->s.freq / vi->period;
+        }
+
+        s->last_smp[i] = vi->smp;
+        s->last_pos[i] = vi->pos;
+
+        vol = vi->vol < VOL_MAX ? vi->vol : VOL_MAX;
+        if (vol > 0)
+            add_voice(s, xxs, vi->root, vol, vi->pos, step, frames);
+    }
+
+    for (i = 0; i < s->chn; i++) {
+        const int *acc = s->acc + i * s->width;
+        int8_t *w = wave + i * s->width;
+        int max = 0;
+
+        for (j = 0; j < s->width; j++) {
+            int v = acc[j] < -32768 ? -32768 : acc[j] > 32767 ? 32767 : acc[j];
+
+            if (abs(v) > max)
+                max = abs(v);
+            w[j] = (int8_t) (v >> 8);
+        }
+
+        peak[i] = max;
+    }
+}
+
+/*
+ * Copy the window of channel chn in slot to buf, up to len points.
+ * Returns the channel peak, 0 to 32767, or -1 if there is none.
+ */
+int scope_get(const struct scope *s, int slot, int chn, int8_t *buf, int len) {
+    if (chn < 0 || chn >= s->chn || slot < 0 || slot >= s->slots)
+        return -1;
+
+    if (len > s->width)
+        len = s->width;
+
+    memcpy(buf, s->wave + ((size_t) slot * s->chn + chn) * s->width, len);
+
+    return s->peak[slot * s->chn + chn];
+}
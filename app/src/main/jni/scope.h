@@ -0,0 +1,17 @@
+#ifndef XMP_JNI_SCOPE_H
+#define XMP_JNI_SCOPE_H
+
+#include "xmp.h"
+#include <stdint.h>
+
+struct scope;
+
+struct scope *scope_new(xmp_context, int, int, int);
+
+void scope_free(struct scope *);
+
+void scope_capture(struct scope *, xmp_context, int, int);
+
+int scope_get(const struct scope *, int, int, int8_t *, int);
+
+#endif
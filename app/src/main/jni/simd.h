@@ -0,0 +1,26 @@
+#ifndef XMP_JNI_SIMD_H
+#define XMP_JNI_SIMD_H
+
+/*
+ * Compile-time SIMD selection. NEON is baseline on arm64-v8a and on
+ * armeabi-v7a as built by the NDK, SSE2 is baseline on x86 and x86_64,
+ * so no runtime dispatch is needed on any ABI we ship. NO_SIMD builds
+ * the scalar fallbacks instead, for the host tools to compare against.
+ */
+
+#if defined(NO_SIMD)
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define HAVE_NEON 1
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define HAVE_SSE2 1
+#endif
+
+#define CACHE_LINE 64
+
+#define ALIGNED(x) __attribute__((aligned(x)))
+
+#define ALIGN_UP(x, a) (((x) + (a) - 1) & ~((a) - 1))
+
+#endif
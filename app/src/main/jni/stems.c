@@ -0,0 +1,363 @@
+/*
+ * One WAV file per module channel, rendered in parallel
+ *
+ * The module is depacked or mapped once into a read-only image that all
+ * workers load their private context from. Each worker then takes the
+ * next channel not yet done, renders the sequence with every other
+ * channel muted and streams it to its file, so no more than a buffer of
+ * audio is held per worker. libxmp contexts own their sample data, so
+ * memory grows with the number of workers, which is capped by the core
+ * count, and not with the number of channels.
+ *
+ * Nothing here touches the player context or its lock.
+ */
+
+#include "stems.h"
+#include "archive.h"
+#include "depack.h"
+#include "xmp.h"
+#include <limits.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define STEMS_FRAMES 4096
+#define WAV_HEADER 44
+
+/* Background thread niceness, keep well below the render thread */
+#define STEMS_NICE 10
+
+static int st_fd;
+static int st_member;
+static int st_sequence;
+static int st_rate;
+static int st_defpan;
+static char st_dir[PATH_MAX];
+static int st_running;
+static pthread_t st_thread;
+
+/* Shared by the workers of a run */
+static struct depacked st_image;
+static atomic_int st_chn;
+static atomic_llong st_total;           /* frames to render over all channels */
+static atomic_llong st_rendered;
+static atomic_int st_next;
+static atomic_int st_finished;
+static atomic_int st_failed;
+static atomic_int st_cancel;
+
+static void put32(uint8_t *p, uint32_t v) {
+    p[0] = v;
+    p[1] = v >> 8;
+    p[2] = v >> 16;
+    p[3] = v >> 24;
+}
+
+static void put16(uint8_t *p, uint32_t v) {
+    p[0] = v;
+    p[1] = v >> 8;
+}
+
+/* RIFF header of 16 bit stereo data of the given size */
+static void wav_header(uint8_t *h, int rate, uint32_t size) {
+    memcpy(h, "RIFF", 4);
+    put32(h + 4, 36 + size);
+    memcpy(h + 8, "WAVEfmt ", 8);
+    put32(h + 16, 16);
+    put16(h + 20, 1);
+    put16(h + 22, 2);
+    put32(h + 24, rate);
+    put32(h + 28, rate * 4);
+    put16(h + 32, 4);
+    put16(h + 34, 16);
+    memcpy(h + 36, "data", 4);
+    put32(h + 40, size);
+}
+
+/* The header is written with empty sizes first and patched at the end */
+static int render_stem(xmp_context c, const struct xmp_module_info *mi, int chn, FILE *f) {
+    int16_t buf[STEMS_FRAMES * 2];
+    uint8_t h[WAV_HEADER];
+    uint32_t size = 0;
+    int i;
+
+    wav_header(h, st_rate, 0);
+    if (fwrite(h, 1, WAV_HEADER, f) != WAV_HEADER)
+        return -1;
+
+    if (xmp_start_player(c, st_rate, 0) != 0)
+        return -1;
+
+    xmp_set_player(c, XMP_PLAYER_INTERP, XMP_INTERP_SPLINE);
+    xmp_set_position(c, mi->seq_data[st_sequence].entry_point);
+
+    for (i = 0; i < mi->mod->chn; i++) {
+        xmp_channel_mute(c, i, i != chn);
+    }
+
+    while (!atomic_load(&st_cancel)) {
+        if (xmp_play_buffer(c, buf, sizeof(buf), 1) < 0)
+            break;
+
+        /* WAV is little endian like every Android ABI */
+        if (fwrite(buf, 1, sizeof(buf), f) != sizeof(buf) || size > UINT32_MAX - 2 * sizeof(buf)) {
+            xmp_end_player(c);
+            return -1;
+        }
+
+        size += sizeof(buf);
+        atomic_fetch_add(&st_rendered, STEMS_FRAMES);
+    }
+
+    xmp_end_player(c);
+
+    if (atomic_load(&st_cancel))
+        return -1;
+
+    wav_header(h, st_rate, size);
+    if (fseek(f, 0, SEEK_SET) != 0 || fwrite(h, 1, WAV_HEADER, f) != WAV_HEADER)
+        return -1;
+
+    return 0;
+}
+
+/* A private context loaded from st_image like the player would load the file */
+static xmp_context load_context(void) {
+    xmp_context c = xmp_create_context();
+
+    if (c == NULL)
+        return NULL;
+
+    xmp_set_player(c, XMP_PLAYER_DEFPAN, st_defpan);
+
+    if (xmp_load_module_from_memory(c, st_image.data, st_image.len) != 0) {
+        xmp_free_context(c);
+        return NULL;
+    }
+
+    return c;
+}
+
+static void *worker(void *arg) {
+    struct xmp_module_info mi;
+    char path[PATH_MAX];
+    xmp_context c = arg;
+    FILE *f;
+    int chn, res;
+
+    if (c == NULL) {
+        c = load_context();
+        if (c == NULL) {
+            atomic_store(&st_failed, 1);
+            return NULL;
+        }
+    }
+
+    xmp_get_module_info(c, &mi);
+
+    while (!atomic_load(&st_cancel) && !atomic_load(&st_failed)) {
+        chn = atomic_fetch_add(&st_next, 1);
+        if (chn >= atomic_load(&st_chn))
+            break;
+
+        snprintf(path, sizeof(path), "%s/%02d.wav", st_dir, chn + 1);
+
+        f = fopen(path, "wb");
+        if (f == NULL) {
+            atomic_store(&st_failed, 1);
+            break;
+        }
+
+        res = render_stem(c, &mi, chn, f);
+        if (fclose(f) != 0)
+            res = -1;
+
+        if (res < 0) {
+            unlink(path);
+            if (!atomic_load(&st_cancel))
+                atomic_store(&st_failed, 1);
+            break;
+        }
+
+        atomic_fetch_add(&st_finished, 1);
+    }
+
+    xmp_release_module(c);
+    xmp_free_context(c);
+
+    return NULL;
+}
+
+/* Depack the module, or map it as is, into st_image */
+static int load_image(void) {
+    struct archive *a;
+    struct stat st;
+    void *map;
+    int fd, res;
+
+    if (st_member >= 0) {
+        fd = dup(st_fd);
+        if (fd < 0)
+            return -1;
+
+        a = archive_open(fd);
+        if (a == NULL) {
+            close(fd);
+            return -1;
+        }
+
+        res = archive_depack(a, st_member, &st_image);
+        archive_close(a);
+
+        return res;
+    }
+
+    if (depack_fd(st_fd, &st_image) == 0)
+        return 0;
+
+    if (fstat(st_fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size <= 0)
+        return -1;
+
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, st_fd, 0);
+    if (map == MAP_FAILED)
+        return -1;
+
+    st_image.data = map;
+    st_image.len = st.st_size;
+
+    return 0;
+}
+
+static void *stems_thread(void *arg) {
+    pthread_t threads[STEMS_MAX_WORKERS];
+    struct xmp_module_info mi;
+    xmp_context c;
+    long cpus;
+    int i, res, num = 0;
+
+    (void) arg;
+
+    /* Workers inherit the niceness */
+    setpriority(PRIO_PROCESS, gettid(), STEMS_NICE);
+
+    res = load_image();
+    close(st_fd);
+
+    c = res < 0 ? NULL : load_context();
+    if (c == NULL) {
+        depack_free(&st_image);
+        atomic_store(&st_failed, 1);
+        return NULL;
+    }
+
+    xmp_get_module_info(c, &mi);
+
+    if (st_sequence >= mi.num_sequences || mi.seq_data[st_sequence].duration <= 0) {
+        xmp_release_module(c);
+        xmp_free_context(c);
+        depack_free(&st_image);
+        atomic_store(&st_failed, 1);
+        return NULL;
+    }
+
+    atomic_store(&st_total, (int64_t) mi.seq_data[st_sequence].duration * st_rate / 1000 * mi.mod->chn);
+    atomic_store(&st_chn, mi.mod->chn);
+
+    cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    if (cpus > mi.mod->chn)
+        cpus = mi.mod->chn;
+    if (cpus > STEMS_MAX_WORKERS)
+        cpus = STEMS_MAX_WORKERS;
+
+    /* This thread is the first worker, with the context it already loaded */
+    while (num < cpus - 1 && pthread_create(&threads[num], NULL, worker, NULL) == 0) {
+        num++;
+    }
+
+    worker(c);
+
+    for (i = 0; i < num; i++) {
+        pthread_join(threads[i], NULL);
+    }
+
+    depack_free(&st_image);
+
+    return NULL;
+}
+
+/*
+ * Start writing one WAV file per channel of the given sequence of the
+ * module in fd, or of a zip member if member isn't negative, as 01.wav,
+ * 02.wav and so on in dir, panned with the player's default pan. The fd
+ * is owned by the export from here on, even on failure.
+ */
+int stems_start(int fd, int member, int sequence, const char *dir, int rate, int defpan) {
+    stems_stop();
+
+    if (rate < XMP_MIN_SRATE || rate > XMP_MAX_SRATE || strlen(dir) + 8 >= sizeof(st_dir)) {
+        close(fd);
+        return -1;
+    }
+
+    st_fd = fd;
+    st_member = member;
+    st_sequence = sequence;
+    st_rate = rate;
+    st_defpan = defpan;
+    strcpy(st_dir, dir);
+    atomic_store(&st_chn, 0);
+    atomic_store(&st_total, 0);
+    atomic_store(&st_rendered, 0);
+    atomic_store(&st_next, 0);
+    atomic_store(&st_finished, 0);
+    atomic_store(&st_failed, 0);
+    atomic_store(&st_cancel, 0);
+
+    if (pthread_create(&st_thread, NULL, stems_thread, NULL) != 0) {
+        close(fd);
+        return -1;
+    }
+
+    st_running = 1;
+
+    return 0;
+}
+
+/* Cancel an export in progress, the stem being written is removed */
+void stems_stop(void) {
+    if (st_running) {
+        atomic_store(&st_cancel, 1);
+        pthread_join(st_thread, NULL);
+        st_running = 0;
+    }
+}
+
+/*
+ * Percentage of the export done, 100 once every stem is written, or -1
+ * if it failed
+ */
+int stems_progress(void) {
+    int chn = atomic_load(&st_chn);
+    int64_t total = atomic_load(&st_total);
+    int64_t rendered;
+
+    if (atomic_load(&st_failed))
+        return -1;
+
+    if (chn > 0 && atomic_load(&st_finished) == chn)
+        return 100;
+
+    rendered = atomic_load(&st_rendered);
+    if (total <= 0)
+        return 0;
+
+    /* Songs run a little past their scanned duration */
+    return rendered < total ? (int) (rendered * 100 / total) : 99;
+}
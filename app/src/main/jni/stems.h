@@ -0,0 +1,13 @@
+#ifndef XMP_JNI_STEMS_H
+#define XMP_JNI_STEMS_H
+
+/* Most contexts rendering at once, whatever the core count */
+#define STEMS_MAX_WORKERS 4
+
+int stems_start(int, int, int, const char *, int, int);
+
+void stems_stop(void);
+
+int stems_progress(void);
+
+#endif
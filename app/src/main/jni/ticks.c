@@ -0,0 +1,143 @@
+/*
+ * Player state of every tick, placed where it is heard
+ *
+ * xmp_play_buffer only shows the state at the end of each buffer, so at
+ * high tempos whole rows, and the notes and volume changes in them, never
+ * get seen. Buffers are filled here tick by tick with xmp_play_frame, the
+ * way xmp_play_buffer does, and the state after each tick is recorded in
+ * a ring with the output frame it starts at and the monotonic time that
+ * frame is heard at: position, row, frame, tempo, and the key, volume and
+ * note-ons of every channel. Looking up a time gives the tick that is
+ * audible then.
+ *
+ * Each tick is also passed on to the playback events, which then carry
+ * the time of the tick instead of the time of its buffer.
+ *
+ * Everything here runs under the player lock.
+ */
+
+#include "ticks.h"
+#include "events.h"
+#include <string.h>
+
+#define FRAME_BYTES 4           /* 16 bit stereo */
+
+static struct tick_state ring[TICKS_SIZE];
+static unsigned int head;
+static int num_chn;
+
+/* What is left of the last tick rendered, as in xmp_play_buffer */
+static const char *pending;
+static int consumed;
+static int available;
+
+/* Forget the ticks of the last player, which had chn channels */
+void ticks_reset(int chn) {
+    head = 0;
+    num_chn = chn < XMP_MAX_CHANNELS ? chn : XMP_MAX_CHANNELS;
+    ticks_drop();
+}
+
+/* Drop what is left of the last tick, after a jump to another sequence */
+void ticks_drop(void) {
+    pending = NULL;
+    consumed = available = 0;
+}
+
+static void record(const struct xmp_frame_info *f, int offset, int64_t pts) {
+    struct tick_state *t = &ring[head % TICKS_SIZE];
+    int i;
+
+    t->pts = pts;
+    t->offset = offset;
+    t->pos = f->pos;
+    t->row = f->row;
+    t->frame = f->frame;
+    t->speed = f->speed;
+    t->bpm = f->bpm;
+    t->trigger = 0;
+
+    for (i = 0; i < num_chn; i++) {
+        const struct xmp_channel_info *ci = &f->channel_info[i];
+
+        /* The row event is reported for all its ticks, it triggers on the first */
+        if (f->frame == 0 && ci->event.note > 0 && ci->event.note <= XMP_MAX_KEYS) {
+            t->trigger |= 1ULL << i;
+        }
+
+        t->key[i] = ci->note;
+        t->vol[i] = ci->volume;
+    }
+
+    head++;
+}
+
+/*
+ * Fill size bytes of out like xmp_play_buffer, ending after loop loops
+ * when loop isn't 0. The buffer starts being heard at pts, as out_frames
+ * frames at out_rate once resampled. Returns 0, or -XMP_END at the end.
+ */
+int ticks_render(xmp_context c, void *out, int size, int loop, int64_t pts,
+                 int out_frames, int out_rate) {
+    struct xmp_frame_info f;
+    char *p = out;
+    int frames = size / FRAME_BYTES;
+    int filled = 0;
+    int ret, n;
+
+    while (filled < size) {
+        if (consumed >= available) {
+            int64_t offset;
+
+            ret = xmp_play_frame(c);
+            xmp_get_frame_info(c, &f);
+
+            if (ret < 0 || (loop > 0 && f.loop_count >= loop)) {
+                ticks_drop();
+
+                if (filled == 0)
+                    return -XMP_END;
+
+                memset(p + filled, 0, size - filled);
+                return 0;
+            }
+
+            offset = (int64_t) (filled / FRAME_BYTES) * out_frames / frames;
+            record(&f, (int) offset, pts + offset * 1000000000 / out_rate);
+            events_track(&f, pts + offset * 1000000000 / out_rate, 0);
+
+            pending = f.buffer;
+            consumed = 0;
+            available = f.buffer_size;
+        }
+
+        n = size - filled < available - consumed ? size - filled : available - consumed;
+        memcpy(p + filled, pending + consumed, n);
+        consumed += n;
+        filled += n;
+    }
+
+    return 0;
+}
+
+/* The tick heard at time, or the oldest one kept if it is earlier */
+const struct tick_state *ticks_at(int64_t time) {
+    unsigned int num = head < TICKS_SIZE ? head : TICKS_SIZE;
+    unsigned int i;
+
+    if (num == 0)
+        return NULL;
+
+    for (i = 1; i < num; i++) {
+        const struct tick_state *t = &ring[(head - i) % TICKS_SIZE];
+
+        if (t->pts <= time)
+            return t;
+    }
+
+    return &ring[(head - num) % TICKS_SIZE];
+}
+
+int ticks_channels(void) {
+    return num_chn;
+}
@@ -0,0 +1,33 @@
+#ifndef XMP_JNI_TICKS_H
+#define XMP_JNI_TICKS_H
+
+#include "xmp.h"
+#include <stdint.h>
+
+/* Ticks kept, a power of two, enough for the longest queue at top tempo */
+#define TICKS_SIZE 512
+
+struct tick_state {
+    int64_t pts;                    /* CLOCK_MONOTONIC ns it becomes audible at */
+    int offset;                     /* output frame it starts at in its buffer */
+    int pos;
+    int row;
+    int frame;
+    int speed;
+    int bpm;
+    uint64_t trigger;               /* channels with a note-on at this tick */
+    uint8_t key[XMP_MAX_CHANNELS];  /* key playing */
+    uint8_t vol[XMP_MAX_CHANNELS];  /* channel volume */
+};
+
+void ticks_reset(int);
+
+void ticks_drop(void);
+
+int ticks_render(xmp_context, void *, int, int, int64_t, int, int);
+
+const struct tick_state *ticks_at(int64_t);
+
+int ticks_channels(void);
+
+#endif
@@ -0,0 +1,231 @@
+/*
+ * Note-on timeline of every sequence, for piano-roll and activity views
+ *
+ * libxmp has no way to run its sequencer apart from the mixer, so after a
+ * module is loaded its player is stepped one frame at a time at the lowest
+ * rate, in mono, without interpolation or filters, which leaves very
+ * little mixing to do. Speed and tempo changes, jumps, breaks and pattern
+ * loops are followed exactly as in playback. Each time a row starts the
+ * notes it triggers are recorded with their time, channel, key,
+ * instrument and channel volume.
+ *
+ * The events of all sequences share one array, each sequence a time
+ * sorted run of it, so a window of time is found with two binary searches.
+ * A timeline never changes once built and is reference counted, so the
+ * module cache can keep it with the module and readers can copy from it
+ * without holding the player lock.
+ */
+
+#include "timeline.h"
+#include <stdatomic.h>
+#include <stdlib.h>
+
+#define TIMELINE_RATE XMP_MIN_SRATE
+
+/* A sequence that runs this far past its scanned duration is cut */
+#define OVERRUN_MS 1000
+
+struct timeline {
+    atomic_int refs;
+    int num_seq;
+    int *first;             /* num_seq + 1 offsets into events */
+    int num;
+    int size;
+    struct note_event *events;
+};
+
+static int push(struct timeline *t, int time, int chn, int key, int ins, int vol) {
+    if (t->num >= t->size) {
+        int size = t->size > 0 ? t->size * 2 : 1024;
+        struct note_event *e;
+
+        if (size > TIMELINE_MAX_EVENTS)
+            size = TIMELINE_MAX_EVENTS;
+        if (t->num >= size)
+            return -1;
+
+        e = realloc(t->events, size * sizeof(struct note_event));
+        if (e == NULL)
+            return -1;
+
+        t->events = e;
+        t->size = size;
+    }
+
+    t->events[t->num].time = time;
+    t->events[t->num].chn = chn;
+    t->events[t->num].key = key;
+    t->events[t->num].ins = ins;
+    t->events[t->num].vol = vol;
+    t->num++;
+
+    return 0;
+}
+
+/* Notes triggered by the row in fi, which started at time */
+static int add_row(struct timeline *t, const struct xmp_frame_info *fi, int chn, int time) {
+    int i;
+
+    for (i = 0; i < chn; i++) {
+        const struct xmp_channel_info *ci = &fi->channel_info[i];
+
+        if (ci->event.note == 0 || ci->event.note > XMP_MAX_KEYS)
+            continue;
+
+        if (push(t, time, i, ci->event.note - 1, ci->instrument, ci->volume) < 0)
+            return -1;
+    }
+
+    return 0;
+}
+
+static int scan_sequence(xmp_context c, const struct xmp_module_info *mi, int seq,
+                         struct timeline *t) {
+    struct xmp_frame_info fi;
+    int chn = mi->mod->chn < XMP_MAX_CHANNELS ? mi->mod->chn : XMP_MAX_CHANNELS;
+    int last_pos = -1, last_row = -1, last_frame = 0;
+    int start, time;
+
+    if (xmp_start_player(c, TIMELINE_RATE, XMP_FORMAT_MONO) != 0)
+        return -1;
+
+    xmp_set_player(c, XMP_PLAYER_INTERP, XMP_INTERP_NEAREST);
+    xmp_set_player(c, XMP_PLAYER_DSP, 0);
+    xmp_set_position(c, mi->seq_data[seq].entry_point);
+
+    xmp_get_frame_info(c, &fi);
+    start = time = fi.time;
+
+    while (xmp_play_frame(c) == 0) {
+        xmp_get_frame_info(c, &fi);
+
+        if (fi.loop_count > 0 || fi.time - start > mi->seq_data[seq].duration + OVERRUN_MS)
+            break;
+
+        /* A new row, or the same one again from a loop or a jump */
+        if (fi.pos != last_pos || fi.row != last_row || fi.frame < last_frame) {
+            if (add_row(t, &fi, chn, time) < 0)
+                break;
+        }
+
+        last_pos = fi.pos;
+        last_row = fi.row;
+        last_frame = fi.frame;
+        time = fi.time;
+    }
+
+    xmp_end_player(c);
+
+    return 0;
+}
+
+/*
+ * Scan every sequence of the module loaded in c, which must not be
+ * playing. Returns NULL if there is nothing to scan or no memory.
+ */
+struct timeline *timeline_build(xmp_context c) {
+    struct xmp_module_info mi;
+    struct timeline *t;
+    struct note_event *e;
+    int i;
+
+    xmp_get_module_info(c, &mi);
+    if (mi.mod == NULL || mi.num_sequences <= 0)
+        return NULL;
+
+    t = calloc(1, sizeof(struct timeline));
+    if (t == NULL)
+        return NULL;
+
+    atomic_init(&t->refs, 1);
+    t->num_seq = mi.num_sequences;
+    t->first = malloc((t->num_seq + 1) * sizeof(int));
+    if (t->first == NULL) {
+        free(t);
+        return NULL;
+    }
+
+    for (i = 0; i < t->num_seq; i++) {
+        t->first[i] = t->num;
+        scan_sequence(c, &mi, i, t);
+    }
+    t->first[t->num_seq] = t->num;
+
+    /* Give back what growing the array overshot */
+    if (t->num > 0 && t->num < t->size) {
+        e = realloc(t->events, t->num * sizeof(struct note_event));
+        if (e != NULL)
+            t->events = e;
+    }
+
+    return t;
+}
+
+/* Another reference to t, which may be NULL */
+struct timeline *timeline_ref(struct timeline *t) {
+    if (t != NULL)
+        atomic_fetch_add(&t->refs, 1);
+
+    return t;
+}
+
+/* Drop a reference, the last one frees the timeline */
+void timeline_free(struct timeline *t) {
+    if (t == NULL || atomic_fetch_sub(&t->refs, 1) > 1)
+        return;
+
+    free(t->first);
+    free(t->events);
+    free(t);
+}
+
+/* Memory held by t */
+size_t timeline_bytes(const struct timeline *t) {
+    if (t == NULL)
+        return 0;
+
+    return sizeof(struct timeline) + (t->num_seq + 1) * sizeof(int) +
+           t->num * sizeof(struct note_event);
+}
+
+/* Number of note events in sequence seq, -1 if there is no such sequence */
+int timeline_count(const struct timeline *t, int seq) {
+    if (t == NULL || seq < 0 || seq >= t->num_seq)
+        return -1;
+
+    return t->first[seq + 1] - t->first[seq];
+}
+
+/* First event of the run from lo to hi at or after time */
+static int lower_bound(const struct timeline *t, int lo, int hi, int time) {
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+
+        if (t->events[mid].time < time) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+
+    return lo;
+}
+
+/*
+ * Events of sequence seq from start up to end ms, in time order. Points
+ * events at the first one and returns how many, -1 if there is no such
+ * sequence.
+ */
+int timeline_query(const struct timeline *t, int seq, int start, int end,
+                   const struct note_event **events) {
+    int lo, hi;
+
+    if (timeline_count(t, seq) < 0)
+        return -1;
+
+    lo = lower_bound(t, t->first[seq], t->first[seq + 1], start);
+    hi = end > start ? lower_bound(t, lo, t->first[seq + 1], end) : lo;
+    *events = t->events + lo;
+
+    return hi - lo;
+}
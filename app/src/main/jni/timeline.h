@@ -0,0 +1,34 @@
+#ifndef XMP_JNI_TIMELINE_H
+#define XMP_JNI_TIMELINE_H
+
+#include "xmp.h"
+#include <stddef.h>
+#include <stdint.h>
+
+/* Most note events kept for a module, over all its sequences */
+#define TIMELINE_MAX_EVENTS (1 << 20)
+
+/* A note-on, at time ms from the start of the module */
+struct note_event {
+    int32_t time;
+    uint8_t chn;
+    uint8_t key;
+    uint8_t ins;
+    uint8_t vol;
+};
+
+struct timeline;
+
+struct timeline *timeline_build(xmp_context);
+
+struct timeline *timeline_ref(struct timeline *);
+
+void timeline_free(struct timeline *);
+
+size_t timeline_bytes(const struct timeline *);
+
+int timeline_count(const struct timeline *, int);
+
+int timeline_query(const struct timeline *, int, int, int, const struct note_event **);
+
+#endif
@@ -0,0 +1,198 @@
+/*
+ * Load report over a corpus of modules, on the host
+ *
+ * Every file given, or found under a directory given, is loaded once
+ * through modload_load as the player would, with the module cache off so
+ * each load is cold. The report of each load is printed as a line of tab
+ * separated phase times in microseconds, and at the end every phase that
+ * took over OUTLIER_FACTOR times the corpus median for that phase, and at
+ * least OUTLIER_NS, is listed as an outlier, the same rule the player
+ * logs slow loads with.
+ *
+ *   loadcorpus [-b budget_mb] file_or_dir...
+ */
+
+#include "../loadreport.h"
+#include "../modcache.h"
+#include "../modload.h"
+#include <fcntl.h>
+#include <ftw.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define OUTLIER_FACTOR 4
+#define OUTLIER_NS 50000000ULL
+
+static const char *phase_names[LOAD_PHASES] = {
+    "probe", "open", "cache", "depack", "parse", "downgrade", "metadata", "timeline"
+};
+
+struct result {
+    char *path;
+    struct load_report report;
+};
+
+static struct result *results;
+static int num_results;
+static int size_results;
+static size_t budget;
+
+static int add_result(const char *path, const struct load_report *r) {
+    if (num_results >= size_results) {
+        int size = size_results > 0 ? size_results * 2 : 256;
+        struct result *res = realloc(results, size * sizeof(struct result));
+
+        if (res == NULL)
+            return -1;
+
+        results = res;
+        size_results = size;
+    }
+
+    results[num_results].path = strdup(path);
+    results[num_results].report = *r;
+    num_results++;
+
+    return 0;
+}
+
+static void print_report(const char *path, const struct load_report *r) {
+    int i;
+
+    printf("%d", r->res);
+    for (i = 0; i < LOAD_PHASES; i++) {
+        printf("\t%llu", (unsigned long long) (r->phase[i].ns / 1000));
+    }
+    printf("\t%s\n", path);
+}
+
+static void load_file(const char *path) {
+    struct load_request req;
+    struct loaded l;
+    int fd;
+
+    fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        perror(path);
+        return;
+    }
+
+    req.fd = fd;
+    req.member = -1;
+    req.defpan = 100;
+    req.budget = budget;
+    req.test = 1;
+    req.gen = -1;
+
+    modload_load(&req, &l);
+
+    print_report(path, &l.report);
+
+    if (l.res == 0)
+        add_result(path, &l.report);
+
+    free(l.metadata);
+    timeline_free(l.timeline);
+    if (l.ctx != NULL)
+        modcache_release(l.ctx);
+}
+
+static int visit(const char *path, const struct stat *st, int type, struct FTW *ftw) {
+    (void) st;
+    (void) ftw;
+
+    if (type == FTW_F)
+        load_file(path);
+
+    return 0;
+}
+
+static int cmp_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *) a;
+    uint64_t y = *(const uint64_t *) b;
+
+    return x < y ? -1 : x > y;
+}
+
+static void flag_outliers(void) {
+    uint64_t *ns;
+    int i, j, num = 0;
+
+    if (num_results == 0)
+        return;
+
+    ns = malloc(num_results * sizeof(uint64_t));
+    if (ns == NULL)
+        return;
+
+    printf("\n# medians over %d loads, us:", num_results);
+
+    for (i = 0; i < LOAD_PHASES; i++) {
+        uint64_t median;
+
+        for (j = 0; j < num_results; j++) {
+            ns[j] = results[j].report.phase[i].ns;
+        }
+        qsort(ns, num_results, sizeof(uint64_t), cmp_u64);
+        median = ns[num_results / 2];
+
+        printf(" %s %llu", phase_names[i], (unsigned long long) (median / 1000));
+
+        for (j = 0; j < num_results; j++) {
+            uint64_t t = results[j].report.phase[i].ns;
+
+            if (t > OUTLIER_NS && t > median * OUTLIER_FACTOR) {
+                fprintf(stderr, "outlier: %s %llu us, median %llu us: %s\n", phase_names[i],
+                        (unsigned long long) (t / 1000), (unsigned long long) (median / 1000),
+                        results[j].path);
+                num++;
+            }
+        }
+    }
+
+    printf("\n# %d outliers\n", num);
+
+    free(ns);
+}
+
+int main(int argc, char **argv) {
+    int i, opt;
+
+    while ((opt = getopt(argc, argv, "b:")) != -1) {
+        if (opt == 'b') {
+            budget = (size_t) atol(optarg) << 20;
+        } else {
+            fprintf(stderr, "usage: %s [-b budget_mb] file_or_dir...\n", argv[0]);
+            return 1;
+        }
+    }
+
+    if (optind >= argc) {
+        fprintf(stderr, "usage: %s [-b budget_mb] file_or_dir...\n", argv[0]);
+        return 1;
+    }
+
+    /* Every load cold, nothing is kept once released */
+    modcache_set_budget(0);
+
+    printf("# res");
+    for (i = 0; i < LOAD_PHASES; i++) {
+        printf("\t%s", phase_names[i]);
+    }
+    printf("\tpath\n");
+
+    for (i = optind; i < argc; i++) {
+        nftw(argv[i], visit, 16, FTW_PHYS);
+    }
+
+    flag_outliers();
+
+    for (i = 0; i < num_results; i++) {
+        free(results[i].path);
+    }
+    free(results);
+
+    return 0;
+}
@@ -0,0 +1,140 @@
+/*
+ * Resampler throughput on the host
+ *
+ * Runs resampler_process over some seconds of generated stereo at each rate
+ * pair the player uses, 44.1 to 48 kHz for the usual output and 48 to
+ * 96 kHz for the high rate render, once with the SIMD dot4 kernel of the
+ * build and once with the scalar one, and prints the time per output
+ * frame of both. Buffers where the sinc kernel went over its budget and
+ * fell back to cubic are counted, so a slow kernel isn't hidden by it.
+ *
+ *   resampler_bench [seconds]
+ */
+
+#include "../resampler.h"
+#include "../simd.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define FRAMES 1024
+
+/* tools/resampler_scalar.c */
+struct resampler *scalar_resampler_new(int, int, int);
+void scalar_resampler_free(struct resampler *);
+int scalar_resampler_input_frames(struct resampler *, int);
+void scalar_resampler_process(struct resampler *, const short *, int, short *, int);
+int scalar_resampler_quality(struct resampler *);
+
+struct kernel {
+    const char *name;
+    struct resampler *(*create)(int, int, int);
+    void (*destroy)(struct resampler *);
+    int (*input_frames)(struct resampler *, int);
+    void (*process)(struct resampler *, const short *, int, short *, int);
+    int (*quality)(struct resampler *);
+};
+
+static const struct kernel kernels[] = {
+#if defined(HAVE_NEON)
+    { "neon", resampler_new, resampler_free, resampler_input_frames, resampler_process, resampler_quality },
+#elif defined(HAVE_SSE2)
+    { "sse2", resampler_new, resampler_free, resampler_input_frames, resampler_process, resampler_quality },
+#endif
+    { "scalar", scalar_resampler_new, scalar_resampler_free, scalar_resampler_input_frames,
+      scalar_resampler_process, scalar_resampler_quality }
+};
+
+static const int rates[][2] = {
+    { 44100, 48000 },
+    { 48000, 96000 }
+};
+
+static long long now_ns(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (long long) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* Two detuned tones with some noise, so no kernel sees only zeros */
+static short *make_input(int rate, int frames) {
+    short *in = malloc(frames * 2 * sizeof(short));
+    int i;
+
+    if (in == NULL)
+        return NULL;
+
+    srand(1);
+    for (i = 0; i < frames; i++) {
+        double t = (double) i / rate;
+        double n = (rand() / (double) RAND_MAX - 0.5) * 1000.0;
+
+        in[i * 2] = (short) (12000.0 * sin(2 * M_PI * 440.0 * t) + n);
+        in[i * 2 + 1] = (short) (12000.0 * sin(2 * M_PI * 443.0 * t) - n);
+    }
+
+    return in;
+}
+
+static void run(const struct kernel *k, int in_rate, int out_rate, int seconds) {
+    struct resampler *r;
+    short *in, out[FRAMES * 2];
+    int in_frames = in_rate * seconds;
+    int out_frames = 0, fallbacks = 0, pos = 0;
+    long long start, ns;
+
+    in = make_input(in_rate, in_frames);
+    r = k->create(in_rate, out_rate, FRAMES);
+    if (in == NULL || r == NULL) {
+        fprintf(stderr, "%s: can't set up %d -> %d\n", k->name, in_rate, out_rate);
+        free(in);
+        k->destroy(r);
+        return;
+    }
+
+    start = now_ns();
+
+    for (;;) {
+        int need = k->input_frames(r, FRAMES);
+
+        if (pos + need > in_frames)
+            break;
+
+        k->process(r, in + pos * 2, need, out, FRAMES);
+        pos += need;
+        out_frames += FRAMES;
+
+        if (k->quality(r) != RESAMPLER_SINC)
+            fallbacks++;
+    }
+
+    ns = now_ns() - start;
+
+    printf("%-6s %5d -> %5d: %6.1f ns/frame, %7.1fx realtime, %d cubic buffers\n",
+           k->name, in_rate, out_rate, (double) ns / out_frames,
+           (double) out_frames / out_rate * 1e9 / ns, fallbacks);
+
+    k->destroy(r);
+    free(in);
+}
+
+int main(int argc, char **argv) {
+    int seconds = argc > 1 ? atoi(argv[1]) : 10;
+    size_t i, j;
+
+    if (seconds <= 0) {
+        fprintf(stderr, "usage: %s [seconds]\n", argv[0]);
+        return 1;
+    }
+
+    for (i = 0; i < sizeof(rates) / sizeof(rates[0]); i++) {
+        for (j = 0; j < sizeof(kernels) / sizeof(kernels[0]); j++) {
+            run(&kernels[j], rates[i][0], rates[i][1], seconds);
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,15 @@
+/*
+ * The resampler built with the scalar kernels, under its own names, so
+ * resampler_bench can run it next to the SIMD build
+ */
+
+#define NO_SIMD
+
+#define resampler_new scalar_resampler_new
+#define resampler_free scalar_resampler_free
+#define resampler_input_frames scalar_resampler_input_frames
+#define resampler_process scalar_resampler_process
+#define resampler_quality scalar_resampler_quality
+#define resampler_reset scalar_resampler_reset
+
+#include "../resampler.c"
@@ -0,0 +1,461 @@
+/*
+ * Min/max waveform pyramids for instrument samples
+ *
+ * Built on a low priority background thread after a module is loaded.
+ * Level 0 holds min/max pairs over blocks of BASE_BLOCK frames and every
+ * level above merges FANOUT blocks of the one below, so a view of any
+ * width over any range touches only a handful of blocks per pixel.
+ */
+
+#include "waveform.h"
+#include "simd.h"
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <unistd.h>
+
+#define BASE_BLOCK 16
+#define FANOUT 4
+#define MAX_LEVELS 16
+
+/* Background thread niceness, keep well below the render thread */
+#define BUILD_NICE 10
+
+struct pyramid {
+    int levels;
+    int count[MAX_LEVELS];
+    int16_t *min[MAX_LEVELS];
+    int16_t *max[MAX_LEVELS];
+    int16_t *pool;
+};
+
+static struct xmp_module *wf_mod;
+static struct pyramid **wf_pyr;
+static int wf_num;
+static int wf_running;
+static atomic_int wf_done;
+static atomic_int wf_cancel;
+static pthread_t wf_thread;
+static pthread_mutex_t wf_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static void minmax16(const int16_t *p, int n, int16_t *mn, int16_t *mx) {
+    int16_t lo = INT16_MAX;
+    int16_t hi = INT16_MIN;
+    int i = 0;
+
+#if defined(HAVE_NEON)
+    if (n >= 8) {
+        int16x8_t vlo = vld1q_s16(p);
+        int16x8_t vhi = vlo;
+
+        for (i = 8; i + 8 <= n; i += 8) {
+            int16x8_t v = vld1q_s16(p + i);
+            vlo = vminq_s16(vlo, v);
+            vhi = vmaxq_s16(vhi, v);
+        }
+#if defined(__aarch64__)
+        lo = vminvq_s16(vlo);
+        hi = vmaxvq_s16(vhi);
+#else
+        {
+            int16x4_t l4 = vmin_s16(vget_low_s16(vlo), vget_high_s16(vlo));
+            int16x4_t h4 = vmax_s16(vget_low_s16(vhi), vget_high_s16(vhi));
+
+            l4 = vpmin_s16(l4, l4);
+            l4 = vpmin_s16(l4, l4);
+            h4 = vpmax_s16(h4, h4);
+            h4 = vpmax_s16(h4, h4);
+            lo = vget_lane_s16(l4, 0);
+            hi = vget_lane_s16(h4, 0);
+        }
+#endif
+    }
+#elif defined(HAVE_SSE2)
+    if (n >= 8) {
+        __m128i vlo = _mm_loadu_si128((const __m128i *) p);
+        __m128i vhi = vlo;
+
+        for (i = 8; i + 8 <= n; i += 8) {
+            __m128i v = _mm_loadu_si128((const __m128i *) (p + i));
+            vlo = _mm_min_epi16(vlo, v);
+            vhi = _mm_max_epi16(vhi, v);
+        }
+
+        vlo = _mm_min_epi16(vlo, _mm_shuffle_epi32(vlo, _MM_SHUFFLE(1, 0, 3, 2)));
+        vlo = _mm_min_epi16(vlo, _mm_shuffle_epi32(vlo, _MM_SHUFFLE(2, 3, 0, 1)));
+        vlo = _mm_min_epi16(vlo, _mm_shufflelo_epi16(vlo, _MM_SHUFFLE(2, 3, 0, 1)));
+        vhi = _mm_max_epi16(vhi, _mm_shuffle_epi32(vhi, _MM_SHUFFLE(1, 0, 3, 2)));
+        vhi = _mm_max_epi16(vhi, _mm_shuffle_epi32(vhi, _MM_SHUFFLE(2, 3, 0, 1)));
+        vhi = _mm_max_epi16(vhi, _mm_shufflelo_epi16(vhi, _MM_SHUFFLE(2, 3, 0, 1)));
+        lo = (int16_t) _mm_extract_epi16(vlo, 0);
+        hi = (int16_t) _mm_extract_epi16(vhi, 0);
+    }
+#endif
+
+    for (; i < n; i++) {
+        if (p[i] < lo)
+            lo = p[i];
+        if (p[i] > hi)
+            hi = p[i];
+    }
+
+    *mn = lo;
+    *mx = hi;
+}
+
+/* 8-bit data is scaled to the 16-bit range */
+static void minmax8(const int8_t *p, int n, int16_t *mn, int16_t *mx) {
+    int8_t lo = INT8_MAX;
+    int8_t hi = INT8_MIN;
+    int i = 0;
+
+#if defined(HAVE_NEON)
+    if (n >= 16) {
+        int8x16_t vlo = vld1q_s8(p);
+        int8x16_t vhi = vlo;
+
+        for (i = 16; i + 16 <= n; i += 16) {
+            int8x16_t v = vld1q_s8(p + i);
+            vlo = vminq_s8(vlo, v);
+            vhi = vmaxq_s8(vhi, v);
+        }
+#if defined(__aarch64__)
+        lo = vminvq_s8(vlo);
+        hi = vmaxvq_s8(vhi);
+#else
+        {
+            int8x8_t l8 = vmin_s8(vget_low_s8(vlo), vget_high_s8(vlo));
+            int8x8_t h8 = vmax_s8(vget_low_s8(vhi), vget_high_s8(vhi));
+
+            l8 = vpmin_s8(l8, l8);
+            l8 = vpmin_s8(l8, l8);
+            l8 = vpmin_s8(l8, l8);
+            h8 = vpmax_s8(h8, h8);
+            h8 = vpmax_s8(h8, h8);
+            h8 = vpmax_s8(h8, h8);
+            lo = vget_lane_s8(l8, 0);
+            hi = vget_lane_s8(h8, 0);
+        }
+#endif
+    }
+#elif defined(HAVE_SSE2)
+    if (n >= 16) {
+        /* SSE2 only has unsigned byte min/max, flip the sign bit around them */
+        const __m128i bias = _mm_set1_epi8((char) 0x80);
+        __m128i vlo = _mm_xor_si128(_mm_loadu_si128((const __m128i *) p), bias);
+        __m128i vhi = vlo;
+
+        for (i = 16; i + 16 <= n; i += 16) {
+            __m128i v = _mm_xor_si128(_mm_loadu_si128((const __m128i *) (p + i)), bias);
+            vlo = _mm_min_epu8(vlo, v);
+            vhi = _mm_max_epu8(vhi, v);
+        }
+
+        vlo = _mm_min_epu8(vlo, _mm_shuffle_epi32(vlo, _MM_SHUFFLE(1, 0, 3, 2)));
+        vlo = _mm_min_epu8(vlo, _mm_shuffle_epi32(vlo, _MM_SHUFFLE(2, 3, 0, 1)));
+        vlo = _mm_min_epu8(vlo, _mm_srli_epi32(vlo, 16));
+        vlo = _mm_min_epu8(vlo, _mm_srli_epi16(vlo, 8));
+        vhi = _mm_max_epu8(vhi, _mm_shuffle_epi32(vhi, _MM_SHUFFLE(1, 0, 3, 2)));
+        vhi = _mm_max_epu8(vhi, _mm_shuffle_epi32(vhi, _MM_SHUFFLE(2, 3, 0, 1)));
+        vhi = _mm_max_epu8(vhi, _mm_srli_epi32(vhi, 16));
+        vhi = _mm_max_epu8(vhi, _mm_srli_epi16(vhi, 8));
+        lo = (int8_t) ((_mm_cvtsi128_si32(vlo) & 0xff) ^ 0x80);
+        hi = (int8_t) ((_mm_cvtsi128_si32(vhi) & 0xff) ^ 0x80);
+    }
+#endif
+
+    for (; i < n; i++) {
+        if (p[i] < lo)
+            lo = p[i];
+        if (p[i] > hi)
+            hi = p[i];
+    }
+
+    *mn = (int16_t) (lo * 256);
+    *mx = (int16_t) (hi * 256);
+}
+
+static int sample_channels(const struct xmp_sample *xxs) {
+#ifdef XMP_SAMPLE_STEREO
+    if (xxs->flg & XMP_SAMPLE_STEREO)
+        return 2;
+#endif
+    (void) xxs;
+    return 1;
+}
+
+/* Min/max over frames [s0, s1) straight from sample data */
+static void minmax_raw(const struct xmp_sample *xxs, int s0, int s1, int16_t *mn, int16_t *mx) {
+    int ch = sample_channels(xxs);
+
+    if (xxs->flg & XMP_SAMPLE_16BIT) {
+        minmax16((const int16_t *) xxs->data + s0 * ch, (s1 - s0) * ch, mn, mx);
+    } else {
+        minmax8((const int8_t *) xxs->data + s0 * ch, (s1 - s0) * ch, mn, mx);
+    }
+}
+
+static void free_pyramid(struct pyramid *p) {
+    if (p != NULL) {
+        free(p->pool);
+        free(p);
+    }
+}
+
+static struct pyramid *build_pyramid(const struct xmp_sample *xxs) {
+    struct pyramid *p;
+    int16_t *pos;
+    int total, l, b;
+
+    p = calloc(1, sizeof(struct pyramid));
+    if (p == NULL)
+        return NULL;
+
+    p->count[0] = (xxs->len + BASE_BLOCK - 1) / BASE_BLOCK;
+    total = p->count[0];
+    for (l = 1; l < MAX_LEVELS && p->count[l - 1] > 1; l++) {
+        p->count[l] = (p->count[l - 1] + FANOUT - 1) / FANOUT;
+        total += p->count[l];
+    }
+    p->levels = l;
+
+    p->pool = malloc(total * 2 * sizeof(int16_t));
+    if (p->pool == NULL) {
+        free(p);
+        return NULL;
+    }
+
+    pos = p->pool;
+    for (l = 0; l < p->levels; l++) {
+        p->min[l] = pos;
+        p->max[l] = pos + p->count[l];
+        pos += p->count[l] * 2;
+    }
+
+    for (b = 0; b < p->count[0]; b++) {
+        int s0 = b * BASE_BLOCK;
+        int s1 = s0 + BASE_BLOCK < xxs->len ? s0 + BASE_BLOCK : xxs->len;
+
+        if ((b & 0xfff) == 0 && atomic_load(&wf_cancel)) {
+            free_pyramid(p);
+            return NULL;
+        }
+
+        minmax_raw(xxs, s0, s1, &p->min[0][b], &p->max[0][b]);
+    }
+
+    for (l = 1; l < p->levels; l++) {
+        for (b = 0; b < p->count[l]; b++) {
+            int c0 = b * FANOUT;
+            int c1 = c0 + FANOUT < p->count[l - 1] ? c0 + FANOUT : p->count[l - 1];
+            int16_t lo = p->min[l - 1][c0];
+            int16_t hi = p->max[l - 1][c0];
+            int c;
+
+            for (c = c0 + 1; c < c1; c++) {
+                if (p->min[l - 1][c] < lo)
+                    lo = p->min[l - 1][c];
+                if (p->max[l - 1][c] > hi)
+                    hi = p->max[l - 1][c];
+            }
+
+            p->min[l][b] = lo;
+            p->max[l][b] = hi;
+        }
+    }
+
+    return p;
+}
+
+static void *build_thread(void *arg) {
+    int i;
+
+    (void) arg;
+
+    setpriority(PRIO_PROCESS, gettid(), BUILD_NICE);
+
+    for (i = 0; i < wf_num && !atomic_load(&wf_cancel); i++) {
+        const struct xmp_sample *xxs = &wf_mod->xxs[i];
+        struct pyramid *p = NULL;
+
+        if (xxs->len > 0 && xxs->data != NULL && !(xxs->flg & XMP_SAMPLE_SYNTH)) {
+            p = build_pyramid(xxs);
+        }
+
+        pthread_mutex_lock(&wf_mutex);
+        wf_pyr[i] = p;
+        pthread_mutex_unlock(&wf_mutex);
+
+        atomic_fetch_add(&wf_done, 1);
+    }
+
+    return NULL;
+}
+
+int waveform_start(struct xmp_module *mod) {
+    waveform_stop();
+
+    if (mod == NULL || mod->smp <= 0)
+        return 0;
+
+    wf_pyr = calloc(mod->smp, sizeof(struct pyramid *));
+    if (wf_pyr == NULL)
+        return -1;
+
+    wf_mod = mod;
+    wf_num = mod->smp;
+    atomic_store(&wf_done, 0);
+    atomic_store(&wf_cancel, 0);
+
+    if (pthread_create(&wf_thread, NULL, build_thread, NULL) != 0) {
+        free(wf_pyr);
+        wf_pyr = NULL;
+        wf_num = 0;
+        return -1;
+    }
+
+    wf_running = 1;
+
+    return 0;
+}
+
+/* Must run before the module's sample data goes away */
+void waveform_stop(void) {
+    int i;
+
+    if (wf_running) {
+        atomic_store(&wf_cancel, 1);
+        pthread_join(wf_thread, NULL);
+        wf_running = 0;
+    }
+
+    pthread_mutex_lock(&wf_mutex);
+
+    if (wf_pyr != NULL) {
+        for (i = 0; i < wf_num; i++) {
+            free_pyramid(wf_pyr[i]);
+        }
+        free(wf_pyr);
+    }
+
+    wf_pyr = NULL;
+    wf_mod = NULL;
+    wf_num = 0;
+
+    pthread_mutex_unlock(&wf_mutex);
+}
+
+int waveform_progress(void) {
+    if (wf_num == 0)
+        return 100;
+
+    return atomic_load(&wf_done) * 100 / wf_num;
+}
+
+/*
+ * Fill width min/max pairs for frames [start, end) of a sample. Loop points
+ * that fall in view are returned as pixel columns in loop[0..1], else -1.
+ * Returns the number of columns, 0 if the pyramid isn't ready yet, or -1.
+ */
+int waveform_query(int smp, int start, int end, int width, short *out_min, short *out_max,
+                   int *loop) {
+    const struct xmp_sample *xxs;
+    struct pyramid *p;
+    double spp;
+    int x;
+
+    pthread_mutex_lock(&wf_mutex);
+
+    if (wf_pyr == NULL || smp < 0 || smp >= wf_num || width <= 0) {
+        pthread_mutex_unlock(&wf_mutex);
+        return -1;
+    }
+
+    p = wf_pyr[smp];
+    if (p == NULL) {
+        pthread_mutex_unlock(&wf_mutex);
+        return 0;
+    }
+
+    xxs = &wf_mod->xxs[smp];
+
+    if (start < 0)
+        start = 0;
+    if (end > xxs->len)
+        end = xxs->len;
+    if (end <= start) {
+        pthread_mutex_unlock(&wf_mutex);
+        return -1;
+    }
+    if (width > WAVEFORM_MAX_WIDTH)
+        width = WAVEFORM_MAX_WIDTH;
+
+    spp = (double) (end - start) / width;
+
+    if (spp < BASE_BLOCK) {
+        /* Zoomed in, a column covers less than a block */
+        for (x = 0; x < width; x++) {
+            int s0 = start + (int) (x * spp);
+            int s1 = start + (int) ((x + 1) * spp);
+
+            if (s1 <= s0)
+                s1 = s0 + 1;
+            if (s1 > end)
+                s1 = end;
+
+            minmax_raw(xxs, s0, s1, &out_min[x], &out_max[x]);
+        }
+    } else {
+        int level = 0;
+        int block = BASE_BLOCK;
+
+        /* Coarsest level where a block still fits inside one column */
+        while (level + 1 < p->levels && block * FANOUT <= spp) {
+            level++;
+            block *= FANOUT;
+        }
+
+        for (x = 0; x < width; x++) {
+            int s0 = start + (int) (x * spp);
+            int s1 = start + (int) ((x + 1) * spp);
+            int b0 = s0 / block;
+            int b1 = (s1 + block - 1) / block;
+            int16_t lo, hi;
+            int b;
+
+            if (b1 > p->count[level])
+                b1 = p->count[level];
+            if (b1 <= b0)
+                b1 = b0 + 1;
+
+            lo = p->min[level][b0];
+            hi = p->max[level][b0];
+            for (b = b0 + 1; b < b1; b++) {
+                if (p->min[level][b] < lo)
+                    lo = p->min[level][b];
+                if (p->max[level][b] > hi)
+                    hi = p->max[level][b];
+            }
+
+            out_min[x] = lo;
+            out_max[x] = hi;
+        }
+    }
+
+    loop[0] = loop[1] = -1;
+    if (xxs->flg & XMP_SAMPLE_LOOP) {
+        if (xxs->lps >= start && xxs->lps < end)
+            loop[0] = (int) ((xxs->lps - start) / spp);
+        if (xxs->lpe > start && xxs->lpe <= end)
+            loop[1] = (int) ((xxs->lpe - start) / spp);
+        if (loop[1] >= width)
+            loop[1] = width - 1;
+    }
+
+    pthread_mutex_unlock(&wf_mutex);
+
+    return width;
+}
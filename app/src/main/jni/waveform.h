@@ -0,0 +1,17 @@
+#ifndef XMP_JNI_WAVEFORM_H
+#define XMP_JNI_WAVEFORM_H
+
+#include "xmp.h"
+
+/* Widest view served by a single query */
+#define WAVEFORM_MAX_WIDTH 4096
+
+int waveform_start(struct xmp_module *);
+
+void waveform_stop(void);
+
+int waveform_progress(void);
+
+int waveform_query(int, int, int, int, short *, short *, int *);
+
+#endif
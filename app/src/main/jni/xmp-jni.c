@@ -5,36 +5,90 @@
  * or updated: https://github.com/TheEssem/libxmp-java
  */
 
+#include "archive.h"
 #include "audio.h"
 #include "common.h"
+#include "depack.h"
+#include "downgrade.h"
+#include "envelope.h"
+#include "events.h"
+#include "fingerprint.h"
+#include "governor.h"
+#include "limiter.h"
+#include "modload.h"
+#include "pagelock.h"
+#include "loadreport.h"
+#include "loudness.h"
+#include "metadata.h"
+#include "modcache.h"
+#include "probe.h"
+#include "resampler.h"
+#include "rtsched.h"
+#include "scope.h"
+#include "stems.h"
+#include "ticks.h"
+#include "timeline.h"
+#include "waveform.h"
 #include "xmp.h"
+#include <android/api-level.h>
 #include <jni.h>
+#include <limits.h>
+#include <math.h>
 #include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
 
 #define MAX_BUFFER_SIZE 256
 #define PERIOD_BASE 13696
 
+/* Mix rate for rates past what libxmp accepts, converted to the output rate */
+#define HQ_RENDER_RATE 48000
+
 #define lock()   pthread_mutex_lock(&mutex)
 #define unlock() pthread_mutex_unlock(&mutex)
 
-#define JNI_FUNCTION(name) Java_org_helllabs_android_xmp_Xmp_##name
+/*
+ * Natives are registered in JNI_OnLoad rather than looked up by name. The
+ * scalar getters polled from the player loop and the UI are @CriticalNative,
+ * called without env or class, with JNI wrappers for runtimes before Android
+ * 8 that don't know the annotation.
+ */
+#define JNI_FUNCTION(name) jni_##name
+#define CRITICAL_FUNCTION(name) critical_##name
 
 static xmp_context ctx = NULL;
+static xmp_context g_idle_ctx = NULL;
 static struct xmp_module_info mi;
 static struct xmp_frame_info *fi;
 
+/*
+ * Packed state of the buffer being heard, for the lock-free getters, which
+ * must not touch fi: bits 0-31 are the time in ms or -1, 32-39 the
+ * position, 40-51 the row, 52-59 the loop count up to 255 and bit 60 is
+ * set while playing
+ */
+#define STATE_PLAYING (1ULL << 60)
+#define STATE_FREE_BUFFER (1ULL << 61)
+static atomic_llong g_play_state = 0xffffffff;
+
 static int g_before;
 static int g_buffer_num;
 static int g_cur_vol[XMP_MAX_CHANNELS];
 static int g_decay = 4;
+static int g_defpan = 100;
 static int g_final_vol[XMP_MAX_CHANNELS];
+static int g_governor_on;
 static int g_hold_vol[XMP_MAX_CHANNELS];
 static int g_ins[XMP_MAX_CHANNELS];
+static int g_interp = XMP_INTERP_LINEAR;
 static int g_key[XMP_MAX_CHANNELS];
 static int g_last_key[XMP_MAX_CHANNELS];
+static int g_limiter_on;
 static int g_loop_count;
 static int g_mod_is_loaded;
 static int g_now;
@@ -42,9 +96,24 @@ static int g_pan[XMP_MAX_CHANNELS];
 static int g_period[XMP_MAX_CHANNELS];
 static int g_playing = 0;
 static int g_pos[XMP_MAX_CHANNELS];
+static int g_rate;
 static int g_sequence;
 static jbyte g_buffer[MAX_BUFFER_SIZE];
 static pthread_mutex_t mutex;
+static short *g_render_buf;
+static struct resampler *g_resampler;
+static struct scope *g_scope;
+static int g_scope_width;
+static struct limiter g_limiter;
+static struct governor g_governor;
+static struct rtsched g_rtsched;
+static struct pagelock g_pagelock;
+static size_t g_lock_budget;
+static struct downgrade_report g_downgrade;
+static struct load_report g_load_report;
+static void *g_metadata;
+static size_t g_metadata_size;
+static struct timeline *g_timeline;
 
 typedef struct {
     jfieldID name;
@@ -91,15 +160,23 @@ typedef struct {
 } FrameInfoIDs;
 static FrameInfoIDs frameInfoIDs;
 
-void cacheModInfoIDs(JNIEnv *env) {
+static int cacheModInfoIDs(JNIEnv *env) {
     jclass modInfoClass = (*env)->FindClass(env, "org/helllabs/android/xmp/model/ModInfo");
+    if (modInfoClass == NULL)
+        return -1;
 
     modInfoIDs.name = (*env)->GetFieldID(env, modInfoClass, "name", "Ljava/lang/String;");
     modInfoIDs.type = (*env)->GetFieldID(env, modInfoClass, "type", "Ljava/lang/String;");
+
+    (*env)->DeleteLocalRef(env, modInfoClass);
+
+    return 0;
 }
 
-void cacheChannelVarsIDs(JNIEnv *env) {
+static int cacheChannelVarsIDs(JNIEnv *env) {
     jclass channelVarsClass = (*env)->FindClass(env, "org/helllabs/android/xmp/model/ChannelInfo");
+    if (channelVarsClass == NULL)
+        return -1;
 
     channelVarsIDs.volumes = (*env)->GetFieldID(env, channelVarsClass, "volumes", "[I");
     channelVarsIDs.finalVols = (*env)->GetFieldID(env, channelVarsClass, "finalVols", "[I");
@@ -109,10 +186,15 @@ void cacheChannelVarsIDs(JNIEnv *env) {
     channelVarsIDs.periods = (*env)->GetFieldID(env, channelVarsClass, "periods", "[I");
     channelVarsIDs.holdVols = (*env)->GetFieldID(env, channelVarsClass, "holdVols", "[I");
 
+    (*env)->DeleteLocalRef(env, channelVarsClass);
+
+    return 0;
 }
 
-void cacheModVarsIDs(JNIEnv *env) {
+static int cacheModVarsIDs(JNIEnv *env) {
     jclass modVarsClass = (*env)->FindClass(env, "org/helllabs/android/xmp/model/ModVars");
+    if (modVarsClass == NULL)
+        return -1;
 
     modVarsIDs.currentSequence = (*env)->GetFieldID(env, modVarsClass, "currentSequence", "I");
     modVarsIDs.lengthInPatterns = (*env)->GetFieldID(env, modVarsClass, "lengthInPatterns", "I");
@@ -122,16 +204,28 @@ void cacheModVarsIDs(JNIEnv *env) {
     modVarsIDs.numSamples = (*env)->GetFieldID(env, modVarsClass, "numSamples", "I");
     modVarsIDs.numSequence = (*env)->GetFieldID(env, modVarsClass, "numSequence", "I");
     modVarsIDs.seqDuration = (*env)->GetFieldID(env, modVarsClass, "seqDuration", "I");
+
+    (*env)->DeleteLocalRef(env, modVarsClass);
+
+    return 0;
 }
 
-void cacheSequenceVarsIDs(JNIEnv *env) {
+static int cacheSequenceVarsIDs(JNIEnv *env) {
     jclass seqVarsClass = (*env)->FindClass(env, "org/helllabs/android/xmp/model/SequenceVars");
+    if (seqVarsClass == NULL)
+        return -1;
 
     seqVarsIDs.sequenceField = (*env)->GetFieldID(env, seqVarsClass, "sequence", "[I");
+
+    (*env)->DeleteLocalRef(env, seqVarsClass);
+
+    return 0;
 }
 
-void cacheFrameInfoIDs(JNIEnv *env) {
+static int cacheFrameInfoIDs(JNIEnv *env) {
     jclass frameInfoClass = (*env)->FindClass(env, "org/helllabs/android/xmp/model/FrameInfo");
+    if (frameInfoClass == NULL)
+        return -1;
 
     frameInfoIDs.posField = (*env)->GetFieldID(env, frameInfoClass, "pos", "I");
     frameInfoIDs.patternField = (*env)->GetFieldID(env, frameInfoClass, "pattern", "I");
@@ -140,80 +234,251 @@ void cacheFrameInfoIDs(JNIEnv *env) {
     frameInfoIDs.frameField = (*env)->GetFieldID(env, frameInfoClass, "frame", "I");
     frameInfoIDs.speedField = (*env)->GetFieldID(env, frameInfoClass, "speed", "I");
     frameInfoIDs.bpmField = (*env)->GetFieldID(env, frameInfoClass, "bpm", "I");
+
+    (*env)->DeleteLocalRef(env, frameInfoClass);
+
+    return 0;
 }
 
 /* For ModList */
-JNIEXPORT jboolean JNICALL
-JNI_FUNCTION(init)(JNIEnv *env, jobject obj, jint rate, jint ms) {
+static jboolean JNICALL
+JNI_FUNCTION(init)(JNIEnv *env, jobject obj, jint rate, jint ms, jint burst) {
     (void) env;
     (void) obj;
 
-    ctx = xmp_create_context();
+    /* Player context while no module is loaded, each module gets its own */
+    ctx = g_idle_ctx = xmp_create_context();
     pthread_mutex_init(&mutex, NULL);
 
     if (ctx == NULL) {
         return JNI_FALSE;
     }
 
-    if ((g_buffer_num = open_audio(rate, ms)) < 0) {
+    events_init();
+
+    /* Leave nothing behind so the caller can try another rate */
+    if ((g_buffer_num = open_audio(rate, ms, burst)) < 0) {
+        xmp_free_context(g_idle_ctx);
+        ctx = g_idle_ctx = NULL;
+        pthread_mutex_destroy(&mutex);
         return JNI_FALSE;
     }
 
-    /**
-     * Cache field id's
-     */
-    cacheChannelVarsIDs(env);
-    cacheFrameInfoIDs(env);
-    cacheModInfoIDs(env);
-    cacheModVarsIDs(env);
-    cacheSequenceVarsIDs(env);
-
     return JNI_TRUE;
 }
 
-JNIEXPORT jint JNICALL
+static jint JNICALL
 JNI_FUNCTION(deinit)(JNIEnv *env, jobject obj) {
     (void) env;
     (void) obj;
 
-    xmp_free_context(ctx);
+    waveform_stop();
+    envelope_stop();
+    stems_stop();
+    modload_stop();
+    if (ctx != g_idle_ctx) {
+        modcache_release(ctx);
+    }
+    modcache_clear();
+    xmp_free_context(g_idle_ctx);
+    ctx = g_idle_ctx = NULL;
     pthread_mutex_destroy(&mutex);
     close_audio();
 
+    free(g_metadata);
+    g_metadata = NULL;
+    g_metadata_size = 0;
+    timeline_free(g_timeline);
+    g_timeline = NULL;
+
     return 0;
 }
 
-JNIEXPORT jint JNICALL
-JNI_FUNCTION(loadModuleFd)(JNIEnv *env, jobject obj, jint fd) {
+/*
+ * Make a loaded module current. The previous context is released on the
+ * loader thread.
+ */
+static int install_module(struct loaded *l) {
+    xmp_context old;
+
+    lock();
+    old = ctx;
+    if (old != g_idle_ctx) {
+        waveform_stop();
+    }
+    ctx = l->ctx != NULL ? l->ctx : g_idle_ctx;
+    /* Without a module libxmp leaves mi alone, it would still point into old */
+    if (l->res == 0) {
+        xmp_get_module_info(ctx, &mi);
+    } else {
+        memset(&mi, 0, sizeof(mi));
+    }
+    g_downgrade = l->downgrade;
+    g_load_report = l->report;
+    free(g_metadata);
+    g_metadata = l->metadata;
+    g_metadata_size = l->metadata_size;
+    timeline_free(g_timeline);
+    g_timeline = l->timeline;
+    memset(g_pos, 0, XMP_MAX_CHANNELS * sizeof(int));
+    g_sequence = 0;
+    g_mod_is_loaded = l->res == 0;
+    unlock();
+
+    if (old != g_idle_ctx) {
+        modload_release(old);
+    }
+
+    if (l->res == 0) {
+        waveform_start(mi.mod);
+    }
+
+    return l->res;
+}
+
+static jint JNICALL
+JNI_FUNCTION(loadModuleFd)(JNIEnv *env, jobject obj, jint fd, jint member, jlong budget) {
     (void) env;
     (void) obj;
 
-    FILE *file = fdopen(fd, "r");
-    if (file == NULL) {
-        return -1;
+    struct load_request r;
+    struct loaded l;
+
+    r.fd = fd;
+    r.member = member;
+    r.defpan = g_defpan;
+    r.budget = (size_t) budget;
+    r.test = 0;
+    r.gen = -1;
+
+    modload_load(&r, &l);
+
+    return install_module(&l);
+}
+
+static jint JNICALL
+JNI_FUNCTION(requestModuleFd)(JNIEnv *env, jobject obj, jint fd, jint member, jlong budget) {
+    (void) env;
+    (void) obj;
+
+    return modload_submit(fd, member, g_defpan, (size_t) budget);
+}
+
+static jint JNICALL
+JNI_FUNCTION(awaitModule)(JNIEnv *env, jobject obj, jint gen, jint timeout) {
+    (void) env;
+    (void) obj;
+
+    struct loaded l;
+    int res = modload_wait(gen, timeout, &l);
+
+    if (res != 0) {
+        return res;
     }
 
-    struct stat statbuf;
-    if (fstat(fd, &statbuf) != 0) {
-        fclose(file);
-        return -1;
+    return install_module(&l);
+}
+
+static void JNICALL
+JNI_FUNCTION(cancelLoad)(JNIEnv *env, jobject obj) {
+    (void) env;
+    (void) obj;
+
+    modload_cancel();
+}
+
+static jlong JNICALL
+JNI_FUNCTION(openArchiveFd)(JNIEnv *env, jobject obj, jint fd) {
+    (void) env;
+    (void) obj;
+
+    struct archive *a = archive_open(fd);
+
+    if (a == NULL) {
+        close(fd);
+        return 0;
     }
-    off_t size = (off_t) statbuf.st_size;
 
-    int res = xmp_load_module_from_file(ctx, file, size);
+    return (jlong) (intptr_t) a;
+}
+
+static void JNICALL
+JNI_FUNCTION(closeArchive)(JNIEnv *env, jobject obj, jlong handle) {
+    (void) env;
+    (void) obj;
+
+    archive_close((struct archive *) (intptr_t) handle);
+}
 
-    xmp_get_module_info(ctx, &mi);
+static jobjectArray JNICALL
+JNI_FUNCTION(getArchiveEntries)(JNIEnv *env, jobject obj, jlong handle) {
+    (void) obj;
 
-    memset(g_pos, 0, XMP_MAX_CHANNELS * sizeof(int));
-    g_sequence = 0;
-    g_mod_is_loaded = 1;
+    struct archive *a = (struct archive *) (intptr_t) handle;
+    jstring s;
+    jclass stringClass;
+    jobjectArray stringArray;
+    char name[PATH_MAX];
+    int i, num;
 
-    fclose(file);
+    if (a == NULL)
+        return NULL;
+
+    num = archive_count(a);
+
+    stringClass = (*env)->FindClass(env, "java/lang/String");
+    if (stringClass == NULL)
+        return NULL;
+
+    stringArray = (*env)->NewObjectArray(env, num, stringClass, NULL);
+    if (stringArray == NULL)
+        return NULL;
+
+    for (i = 0; i < num; i++) {
+        archive_name(a, i, name, sizeof(name));
+        s = (*env)->NewStringUTF(env, name);
+        (*env)->SetObjectArrayElement(env, stringArray, i, s);
+        (*env)->DeleteLocalRef(env, s);
+    }
+
+    return stringArray;
+}
+
+static jboolean JNICALL
+JNI_FUNCTION(testArchiveEntry)(JNIEnv *env, jobject obj, jlong handle, jint index,
+                               jobject modInfo) {
+    (void) obj;
+
+    struct archive *a = (struct archive *) (intptr_t) handle;
+    struct xmp_test_info ti;
+    struct load_mark mark;
+    int res;
+
+    if (a == NULL) {
+        return JNI_FALSE;
+    }
+
+    load_mark(&mark);
+    res = archive_test(a, index, &ti);
+    load_probe_end(&mark);
+
+    if (res != 0) {
+        return JNI_FALSE;
+    }
 
-    return res;
+    jstring name = (*env)->NewStringUTF(env, ti.name);
+    jstring type = (*env)->NewStringUTF(env, ti.type);
+
+    (*env)->SetObjectField(env, modInfo, modInfoIDs.name, name);
+    (*env)->SetObjectField(env, modInfo, modInfoIDs.type, type);
+
+    (*env)->DeleteLocalRef(env, name);
+    (*env)->DeleteLocalRef(env, type);
+
+    return JNI_TRUE;
 }
 
-JNIEXPORT jboolean JNICALL
+static jboolean JNICALL
 JNI_FUNCTION(testModuleFd)(JNIEnv *env, jobject obj, jint fd, jobject modInfo) {
     (void) obj;
 
@@ -223,13 +488,11 @@ JNI_FUNCTION(testModuleFd)(JNIEnv *env, jobject obj, jint fd, jobject modInfo) {
     }
 
     struct xmp_test_info ti;
-    int res = xmp_test_module_from_file(file, &ti);
+    struct load_mark mark;
+    load_mark(&mark);
+    int res = probe_module(file, &ti);
     fclose(file);
-
-    // Sanity
-    if (modInfoIDs.name == NULL || modInfoIDs.type == NULL) {
-        cacheModInfoIDs(env);
-    }
+    load_probe_end(&mark);
 
     if (res == 0) {
         jstring name = (*env)->NewStringUTF(env, ti.name);
@@ -246,38 +509,92 @@ JNI_FUNCTION(testModuleFd)(JNIEnv *env, jobject obj, jint fd, jobject modInfo) {
     return res == 0 ? JNI_TRUE : JNI_FALSE;
 }
 
-JNIEXPORT jint JNICALL
+static jint JNICALL
 JNI_FUNCTION(releaseModule)(JNIEnv *env, jobject obj) {
     (void) env;
     (void) obj;
 
     lock();
 
+    xmp_context old = g_idle_ctx;
+
     if (g_mod_is_loaded) {
         g_mod_is_loaded = 0;
-        xmp_release_module(ctx);
+        waveform_stop();
+        old = ctx;
+        ctx = g_idle_ctx;
+        memset(&mi, 0, sizeof(mi));
     }
 
     unlock();
 
+    /* Freeing a module is slow, keep it off the control path */
+    if (old != g_idle_ctx) {
+        modload_release(old);
+    }
+
     return 0;
 }
 
-JNIEXPORT jint JNICALL
+/* Under the lock, whenever the frame info being heard changes */
+static void publish_state(const struct xmp_frame_info *f) {
+    int loops = f->loop_count < 255 ? f->loop_count : 255;
+    uint64_t state = (uint32_t) f->time;
+
+    state |= (uint64_t) (f->pos & 0xff) << 32;
+    state |= (uint64_t) (f->row & 0xfff) << 40;
+    state |= (uint64_t) loops << 52;
+    state |= STATE_PLAYING;
+
+    atomic_store_explicit(&g_play_state, (long long) state, memory_order_relaxed);
+}
+
+static jint JNICALL
 JNI_FUNCTION(startPlayer)(JNIEnv *env, jobject obj, jint rate) {
     (void) env;
     (void) obj;
 
     int i, ret;
+    int out_rate = get_output_rate();
+    int render_rate = rate < XMP_MAX_SRATE ? rate : HQ_RENDER_RATE;
 
     lock();
 
+    /* Nothing to play, mi has no module to size the per channel state from */
+    if (!g_mod_is_loaded) {
+        unlock();
+        return -XMP_ERROR_STATE;
+    }
+
     fi = calloc(1, g_buffer_num * sizeof(struct xmp_frame_info));
     if (fi == NULL) {
         unlock();
         return -101;
     }
 
+    /*
+     * The output runs at the device rate to stay on the fast mixer, modules
+     * are mixed at the rate asked for and converted here when they differ
+     */
+    if (render_rate != out_rate) {
+        int max_frames = get_buffer_frames();
+
+        g_resampler = resampler_new(render_rate, out_rate, max_frames);
+        if (g_resampler != NULL) {
+            int max_in = resampler_input_frames(g_resampler, max_frames) + 1;
+
+            g_render_buf = malloc(max_in * 2 * sizeof(short));
+            if (g_render_buf == NULL) {
+                resampler_free(g_resampler);
+                g_resampler = NULL;
+            }
+        }
+
+        if (g_resampler == NULL) {
+            render_rate = out_rate;
+        }
+    }
+
     for (i = 0; i < XMP_MAX_CHANNELS; i++) {
         g_key[i] = -1;
         g_last_key[i] = -1;
@@ -286,14 +603,43 @@ JNI_FUNCTION(startPlayer)(JNIEnv *env, jobject obj, jint rate) {
     g_now = g_before = 0;
     g_loop_count = 0;
     g_playing = 1;
-    ret = xmp_start_player(ctx, rate, 0);
+    publish_state(&fi[0]);
+    g_rate = out_rate;
+    governor_init(&g_governor, g_governor_on);
+    rtsched_reset(&g_rtsched);
+    events_reset();
+    ticks_reset(mi.mod->chn);
+    ret = xmp_start_player(ctx, render_rate, 0);
+
+    if (ret == 0 && g_scope_width > 0) {
+        g_scope = scope_new(ctx, g_buffer_num, mi.mod->chn, g_scope_width);
+    }
+
+    /* What every buffer touches first, then the samples as the budget allows */
+    if (ret == 0 && g_lock_budget > 0) {
+        void *audio;
+        size_t audio_size;
+
+        audio = get_audio_buffer(&audio_size);
+        pagelock_init(&g_pagelock, g_lock_budget);
+        pagelock_add(&g_pagelock, audio, audio_size, 1);
+        pagelock_add(&g_pagelock, fi, g_buffer_num * sizeof(struct xmp_frame_info), 1);
+        if (g_render_buf != NULL) {
+            pagelock_add(&g_pagelock, g_render_buf,
+                         (resampler_input_frames(g_resampler, get_buffer_frames()) + 1) * 2 * sizeof(short), 1);
+        }
+        pagelock_module(&g_pagelock, mi.mod);
+    }
+
+    /* Interpolation can only be applied to a playing context */
+    xmp_set_player(ctx, XMP_PLAYER_INTERP, g_interp);
 
     unlock();
 
     return ret;
 }
 
-JNIEXPORT jint JNICALL
+static jint JNICALL
 JNI_FUNCTION(endPlayer)(JNIEnv *env, jobject obj) {
     (void) env;
     (void) obj;
@@ -302,9 +648,17 @@ JNI_FUNCTION(endPlayer)(JNIEnv *env, jobject obj) {
 
     if (g_playing) {
         g_playing = 0;
+        atomic_store_explicit(&g_play_state, 0xffffffff, memory_order_relaxed);
         xmp_end_player(ctx);
+        pagelock_release(&g_pagelock);
         free(fi);
         fi = NULL;
+        scope_free(g_scope);
+        g_scope = NULL;
+        resampler_free(g_resampler);
+        g_resampler = NULL;
+        free(g_render_buf);
+        g_render_buf = NULL;
     }
 
     unlock();
@@ -312,19 +666,84 @@ JNI_FUNCTION(endPlayer)(JNIEnv *env, jobject obj) {
     return 0;
 }
 
+static uint64_t now_ns(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* Apply the quality level the governor asks for */
+static void apply_governor(void) {
+    int interp, dsp;
+
+    governor_settings(&g_governor, &interp, &dsp);
+    xmp_set_player(ctx, XMP_PLAYER_INTERP, interp);
+    xmp_set_player(ctx, XMP_PLAYER_DSP, dsp);
+}
+
 int play_buffer(void *buffer, int size, int looped) {
     int ret = -XMP_END;
     int num_loop;
+    int rendered = size / 4;
+    uint64_t t0 = 0;
+    uint64_t buffer_ns;
+    int64_t pts;
 
     lock();
 
     if (g_playing) {
         num_loop = looped ? 0 : g_loop_count + 1;
-        ret = xmp_play_buffer(ctx, buffer, size, num_loop);
+        buffer_ns = (uint64_t) size / 4 * 1000000000 / g_rate;
+
+        /* Heard once the buffers queued ahead of this one have played */
+        pts = (int64_t) (now_ns() + (g_buffer_num - 1) * buffer_ns);
+
+        rtsched_begin(&g_rtsched);
+
+        if (g_governor.enabled) {
+            t0 = now_ns();
+        }
+
+        if (g_resampler != NULL) {
+            int frames = size / 4;
+            int in = resampler_input_frames(g_resampler, frames);
+
+            ret = ticks_render(ctx, g_render_buf, in * 4, num_loop, pts, frames, g_rate);
+            resampler_process(g_resampler, g_render_buf, in, buffer, frames);
+            rendered = in;
+        } else {
+            ret = ticks_render(ctx, buffer, size, num_loop, pts, size / 4, g_rate);
+        }
+
+        /* Quality changes land between buffers */
+        if (g_governor.enabled &&
+            governor_update(&g_governor, now_ns() - t0, buffer_ns,
+                            xmp_get_player(ctx, XMP_PLAYER_INTERP),
+                            xmp_get_player(ctx, XMP_PLAYER_DSP))) {
+            apply_governor();
+        }
+
+        if (g_scope != NULL) {
+            scope_capture(g_scope, ctx, g_now, rendered);
+        }
+
+        if (g_limiter_on) {
+            limiter_process(&g_limiter, buffer, size / 2);
+        }
+
         xmp_get_frame_info(ctx, &fi[g_now]);
+
+        /* Changes were tracked tick by tick, only the end is left */
+        events_track(&fi[g_now], pts, ret < 0);
+
+        rtsched_end(&g_rtsched);
+
         INC(g_before, g_buffer_num);
         g_now = (g_before + g_buffer_num - 1) % g_buffer_num;
         g_loop_count = fi[g_now].loop_count;
+        publish_state(&fi[g_before]);
     }
 
     unlock();
@@ -332,7 +751,7 @@ int play_buffer(void *buffer, int size, int looped) {
     return ret;
 }
 
-JNIEXPORT jint JNICALL
+static jint JNICALL
 JNI_FUNCTION(playAudio)(JNIEnv *env, jobject obj) {
     (void) env;
     (void) obj;
@@ -340,7 +759,7 @@ JNI_FUNCTION(playAudio)(JNIEnv *env, jobject obj) {
     return play_audio();
 }
 
-JNIEXPORT void JNICALL
+static void JNICALL
 JNI_FUNCTION(dropAudio)(JNIEnv *env, jobject obj) {
     (void) env;
     (void) obj;
@@ -348,7 +767,7 @@ JNI_FUNCTION(dropAudio)(JNIEnv *env, jobject obj) {
     drop_audio();
 }
 
-JNIEXPORT jboolean JNICALL
+static jboolean JNICALL
 JNI_FUNCTION(stopAudio)(JNIEnv *env, jobject obj) {
     (void) env;
     (void) obj;
@@ -356,7 +775,7 @@ JNI_FUNCTION(stopAudio)(JNIEnv *env, jobject obj) {
     return stop_audio() == 0 ? JNI_TRUE : JNI_FALSE;
 }
 
-JNIEXPORT jboolean JNICALL
+static jboolean JNICALL
 JNI_FUNCTION(restartAudio)(JNIEnv *env, jobject obj) {
     (void) env;
     (void) obj;
@@ -364,117 +783,332 @@ JNI_FUNCTION(restartAudio)(JNIEnv *env, jobject obj) {
     return restart_audio() == 0 ? JNI_TRUE : JNI_FALSE;
 }
 
-JNIEXPORT jboolean JNICALL
-JNI_FUNCTION(hasFreeBuffer)(JNIEnv *env, jobject obj) {
-    (void) env;
-    (void) obj;
-
+static jboolean JNICALL
+CRITICAL_FUNCTION(hasFreeBuffer)(void) {
     return has_free_buffer() ? JNI_TRUE : JNI_FALSE;
 }
 
-JNIEXPORT jint JNICALL
-JNI_FUNCTION(fillBuffer)(JNIEnv *env, jobject obj, jboolean looped) {
+static jboolean JNICALL
+JNI_FUNCTION(hasFreeBuffer)(JNIEnv *env, jobject obj) {
     (void) env;
     (void) obj;
 
-    return fill_buffer(looped);
+    return CRITICAL_FUNCTION(hasFreeBuffer)();
 }
 
-JNIEXPORT jint JNICALL
-JNI_FUNCTION(nextPosition)(JNIEnv *env, jobject obj) {
+/*
+ * Block up to timeout ms for a free output buffer instead of polling,
+ * accounting how late the caller woke up
+ */
+static jboolean JNICALL
+JNI_FUNCTION(waitFreeBuffer)(JNIEnv *env, jobject obj, jint timeout) {
     (void) env;
     (void) obj;
 
-    return xmp_next_position(ctx);
-}
-
-JNIEXPORT jint JNICALL
-JNI_FUNCTION(prevPosition)(JNIEnv *env, jobject obj) {
-    (void) env;
-    (void) obj;
+    int64_t late;
+    int ret;
 
-    return xmp_prev_position(ctx);
-}
+    ret = wait_free_buffer(timeout, &late);
 
-JNIEXPORT jint JNICALL
-JNI_FUNCTION(setPosition)(JNIEnv *env, jobject obj, jint n) {
-    (void) env;
-    (void) obj;
+    if (late >= 0) {
+        lock();
+        rtsched_wake(&g_rtsched, late);
+        unlock();
+    }
 
-    return xmp_set_position(ctx, n);
+    return ret ? JNI_TRUE : JNI_FALSE;
 }
 
-JNIEXPORT jint JNICALL
-JNI_FUNCTION(stopModule)(JNIEnv *env, jobject obj) {
+/*
+ * Page in and lock up to budget bytes of output buffers and sample data
+ * from the next player on, 0 turns it off
+ */
+static void JNICALL
+JNI_FUNCTION(setMemoryLock)(JNIEnv *env, jobject obj, jlong budget) {
     (void) env;
     (void) obj;
 
-    xmp_stop_module(ctx);
-
-    return 0;
+    lock();
+    g_lock_budget = budget > 0 ? (size_t) budget : 0;
+    unlock();
 }
 
-JNIEXPORT jint JNICALL
-JNI_FUNCTION(restartModule)(JNIEnv *env, jobject obj) {
+/* Make the calling thread the render thread, returns the policy it got */
+static jint JNICALL
+JNI_FUNCTION(setRenderThread)(JNIEnv *env, jobject obj) {
     (void) env;
     (void) obj;
 
-    xmp_restart_module(ctx);
+    int ret;
 
-    return 0;
+    lock();
+    ret = rtsched_apply(&g_rtsched);
+    unlock();
+
+    return ret;
 }
 
-JNIEXPORT jint JNICALL
-JNI_FUNCTION(seek)(JNIEnv *env, jobject obj, jint time) {
-    (void) env;
+/*
+ * Render thread policy, priority and cores, then per buffer counts:
+ * buffers, wakeups, total and worst wakeup latency in ns, total and
+ * worst time preempted while rendering in ns, involuntary switches,
+ * minor and major faults and buffers that faulted, then the bytes
+ * locked and only prefaulted for the player
+ */
+static jboolean JNICALL
+JNI_FUNCTION(getRenderStats)(JNIEnv *env, jobject obj, jlongArray out) {
     (void) obj;
 
-    int ret;
-    int i;
+    jlong values[15];
+
+    if ((*env)->GetArrayLength(env, out) < 15)
+        return JNI_FALSE;
 
     lock();
 
-    ret = xmp_seek_time(ctx, time);
+    values[0] = g_rtsched.policy;
+    values[1] = g_rtsched.priority;
+    values[2] = g_rtsched.cpus;
+    values[3] = (jlong) g_rtsched.buffers;
+    values[4] = (jlong) g_rtsched.wakeups;
+    values[5] = (jlong) g_rtsched.wake_ns;
+    values[6] = (jlong) g_rtsched.wake_max_ns;
+    values[7] = (jlong) g_rtsched.preempt_ns;
+    values[8] = (jlong) g_rtsched.preempt_max_ns;
+    values[9] = (jlong) g_rtsched.switches;
+    values[10] = (jlong) g_rtsched.minor_faults;
+    values[11] = (jlong) g_rtsched.major_faults;
+    values[12] = (jlong) g_rtsched.fault_buffers;
+    values[13] = (jlong) g_pagelock.locked;
+    values[14] = (jlong) g_pagelock.prefaulted;
 
-    if (g_playing) {
-        for (i = 0; i < g_buffer_num; i++) {
-            fi[i].time = time;
-        }
-    }
+    unlock();
 
-    unlock ();
+    (*env)->SetLongArrayRegion(env, out, 0, 15, values);
 
-    return ret;
+    return JNI_TRUE;
 }
 
-JNIEXPORT jint JNICALL
-JNI_FUNCTION(time)(JNIEnv *env, jobject obj) {
+static jint JNICALL
+JNI_FUNCTION(fillBuffer)(JNIEnv *env, jobject obj, jboolean looped) {
     (void) env;
     (void) obj;
 
-    return g_playing ? fi[g_before].time : -1;
+    return fill_buffer(looped);
 }
 
-JNIEXPORT jint JNICALL
-JNI_FUNCTION(mute)(JNIEnv *env, jobject obj, jint chn, jint status) {
+static jint JNICALL
+JNI_FUNCTION(nextPosition)(JNIEnv *env, jobject obj) {
     (void) env;
     (void) obj;
 
-    return xmp_channel_mute(ctx, chn, status);
-}
+    int ret;
 
-JNIEXPORT void JNICALL
-JNI_FUNCTION(getInfo)(JNIEnv *env, jobject obj, jobject frameInfo) {
-    (void) obj;
+    lock();
+    ret = xmp_next_position(ctx);
+    unlock();
 
-    if (!g_mod_is_loaded)
-        return;
+    return ret;
+}
+
+static jint JNICALL
+JNI_FUNCTION(prevPosition)(JNIEnv *env, jobject obj) {
+    (void) env;
+    (void) obj;
+
+    int ret;
+
+    lock();
+    ret = xmp_prev_position(ctx);
+    unlock();
+
+    return ret;
+}
+
+static jint JNICALL
+JNI_FUNCTION(setPosition)(JNIEnv *env, jobject obj, jint n) {
+    (void) env;
+    (void) obj;
+
+    int ret;
+
+    lock();
+    ret = xmp_set_position(ctx, n);
+    unlock();
+
+    return ret;
+}
+
+static jint JNICALL
+JNI_FUNCTION(stopModule)(JNIEnv *env, jobject obj) {
+    (void) env;
+    (void) obj;
+
+    lock();
+    xmp_stop_module(ctx);
+    unlock();
+
+    return 0;
+}
+
+static jint JNICALL
+JNI_FUNCTION(restartModule)(JNIEnv *env, jobject obj) {
+    (void) env;
+    (void) obj;
+
+    lock();
+    xmp_restart_module(ctx);
+    unlock();
+
+    return 0;
+}
+
+static jint JNICALL
+JNI_FUNCTION(seek)(JNIEnv *env, jobject obj, jint time) {
+    (void) env;
+    (void) obj;
+
+    int ret;
+    int i;
+
+    lock();
+
+    ret = xmp_seek_time(ctx, time);
+
+    if (g_playing) {
+        for (i = 0; i < g_buffer_num; i++) {
+            fi[i].time = time;
+        }
+        publish_state(&fi[g_before]);
+    }
+
+    unlock ();
+
+    return ret;
+}
+
+static jint JNICALL
+CRITICAL_FUNCTION(time)(void) {
+    uint64_t state = (uint64_t) atomic_load_explicit(&g_play_state, memory_order_relaxed);
+
+    return (state & STATE_PLAYING) ? (jint) (uint32_t) state : -1;
+}
+
+static jint JNICALL
+JNI_FUNCTION(time)(JNIEnv *env, jobject obj) {
+    (void) env;
+    (void) obj;
+
+    return CRITICAL_FUNCTION(time)();
+}
+
+/*
+ * Time, position, row, loop count and whether the player and the output
+ * have room in one call for the player loop, packed as g_play_state with
+ * bit 61 set while a buffer is free. Rows are kept to 12 bits and loops to
+ * 255, enough for every format libxmp loads.
+ */
+static jlong JNICALL
+CRITICAL_FUNCTION(getPlayState)(void) {
+    uint64_t state = (uint64_t) atomic_load_explicit(&g_play_state, memory_order_relaxed);
+
+    if (has_free_buffer())
+        state |= STATE_FREE_BUFFER;
+
+    return (jlong) state;
+}
+
+static jlong JNICALL
+JNI_FUNCTION(getPlayState)(JNIEnv *env, jobject obj) {
+    (void) env;
+    (void) obj;
+
+    return CRITICAL_FUNCTION(getPlayState)();
+}
+
+/*
+ * State of the tick heard at monotonic time ns. info gets the position,
+ * row, frame, speed, bpm, the output frame the tick starts at in its
+ * buffer, and the mask of channels with a note-on in the low and high
+ * int. keys and volumes get one value per channel. Returns the number of
+ * channels, -1 if nothing was rendered yet.
+ */
+static jint JNICALL
+JNI_FUNCTION(getTickState)(JNIEnv *env, jobject obj, jlong time, jintArray info,
+                           jintArray keys, jintArray volumes) {
+    (void) obj;
 
-    // Sanity
-    if (frameInfoIDs.posField == NULL) {
-        cacheFrameInfoIDs(env);
+    const struct tick_state *t;
+    jint values[8];
+    jint k[XMP_MAX_CHANNELS];
+    jint v[XMP_MAX_CHANNELS];
+    int i, chn;
+
+    if ((*env)->GetArrayLength(env, info) < 8)
+        return -1;
+
+    chn = (*env)->GetArrayLength(env, keys);
+    if ((*env)->GetArrayLength(env, volumes) < chn) {
+        chn = (*env)->GetArrayLength(env, volumes);
+    }
+
+    lock();
+
+    t = g_playing ? ticks_at(time) : NULL;
+    if (t == NULL) {
+        unlock();
+        return -1;
+    }
+
+    if (chn > ticks_channels()) {
+        chn = ticks_channels();
+    }
+
+    values[0] = t->pos;
+    values[1] = t->row;
+    values[2] = t->frame;
+    values[3] = t->speed;
+    values[4] = t->bpm;
+    values[5] = t->offset;
+    values[6] = (jint) (uint32_t) t->trigger;
+    values[7] = (jint) (uint32_t) (t->trigger >> 32);
+
+    for (i = 0; i < chn; i++) {
+        k[i] = t->key[i];
+        v[i] = t->vol[i];
     }
 
+    unlock();
+
+    (*env)->SetIntArrayRegion(env, info, 0, 8, values);
+    (*env)->SetIntArrayRegion(env, keys, 0, chn, k);
+    (*env)->SetIntArrayRegion(env, volumes, 0, chn, v);
+
+    return chn;
+}
+
+static jint JNICALL
+JNI_FUNCTION(mute)(JNIEnv *env, jobject obj, jint chn, jint status) {
+    (void) env;
+    (void) obj;
+
+    int ret;
+
+    /* The context may be swapped and freed by a load meanwhile */
+    lock();
+    ret = xmp_channel_mute(ctx, chn, status);
+    unlock();
+
+    return ret;
+}
+
+static void JNICALL
+JNI_FUNCTION(getInfo)(JNIEnv *env, jobject obj, jobject frameInfo) {
+    (void) obj;
+
+    if (!g_mod_is_loaded)
+        return;
+
     lock();
 
     if (g_playing) {
@@ -490,31 +1124,114 @@ JNI_FUNCTION(getInfo)(JNIEnv *env, jobject obj, jobject frameInfo) {
     unlock();
 }
 
-JNIEXPORT void JNICALL
+/*
+ * Block up to timeout ms for playback change events, two longs each in
+ * events: the monotonic time it is heard at in ns, and the type in bits
+ * 48-63, a in bits 32-47 and b in bits 0-31. Returns the number of events.
+ */
+static jint JNICALL
+JNI_FUNCTION(waitEvents)(JNIEnv *env, jobject obj, jlongArray events, jint timeout) {
+    (void) obj;
+
+    struct event ev[EVENTS_SIZE / 4];
+    jlong packed[EVENTS_SIZE / 2];
+    int i, n, max;
+
+    max = (*env)->GetArrayLength(env, events) / 2;
+    if (max > EVENTS_SIZE / 4) {
+        max = EVENTS_SIZE / 4;
+    }
+
+    n = events_wait(ev, max, timeout);
+
+    for (i = 0; i < n; i++) {
+        packed[i * 2] = ev[i].pts;
+        packed[i * 2 + 1] = (jlong) ((uint64_t) ev[i].type << 48 |
+                                     (uint64_t) (ev[i].a & 0xffff) << 32 | (uint32_t) ev[i].b);
+    }
+
+    if (n > 0) {
+        (*env)->SetLongArrayRegion(env, events, 0, n * 2, packed);
+    }
+
+    return n;
+}
+
+static void JNICALL
+JNI_FUNCTION(wakeEvents)(JNIEnv *env, jobject obj) {
+    (void) env;
+    (void) obj;
+
+    events_wake();
+}
+
+static void JNICALL
 JNI_FUNCTION(setPlayer)(JNIEnv *env, jobject obj, jint parm, jint val) {
     (void) env;
     (void) obj;
 
+    /* Applied to each module context at load time */
+    if (parm == XMP_PLAYER_DEFPAN) {
+        g_defpan = val;
+    }
+
+    /* Settings from the app are the new full quality for the governor */
+    if (parm == XMP_PLAYER_INTERP || parm == XMP_PLAYER_DSP) {
+        lock();
+        governor_reset(&g_governor);
+        unlock();
+    }
+
+    if (parm == XMP_PLAYER_INTERP) {
+        /* Remembered here, applied by startPlayer if not playing yet */
+        g_interp = val;
+        if (!g_playing)
+            return;
+    }
+
+    lock();
     xmp_set_player(ctx, parm, val);
+    unlock();
 }
 
-JNIEXPORT jint JNICALL
+static jint JNICALL
+CRITICAL_FUNCTION(getPlayer)(jint parm) {
+    int ret;
+
+    if (parm == XMP_PLAYER_INTERP)
+        return g_interp;
+
+    lock();
+    ret = xmp_get_player(ctx, parm);
+    unlock();
+
+    return ret;
+}
+
+static jint JNICALL
 JNI_FUNCTION(getPlayer)(JNIEnv *env, jobject obj, jint parm) {
     (void) env;
     (void) obj;
 
-    return xmp_get_player(ctx, parm);
+    return CRITICAL_FUNCTION(getPlayer)(parm);
 }
 
-JNIEXPORT jint JNICALL
+static jint JNICALL
+CRITICAL_FUNCTION(getLoopCount)(void) {
+    uint64_t state = (uint64_t) atomic_load_explicit(&g_play_state, memory_order_relaxed);
+
+    return (state & STATE_PLAYING) ? (jint) (state >> 52 & 0xff) : 0;
+}
+
+static jint JNICALL
 JNI_FUNCTION(getLoopCount)(JNIEnv *env, jobject obj) {
     (void) env;
     (void) obj;
 
-    return fi[g_before].loop_count;
+    return CRITICAL_FUNCTION(getLoopCount)();
 }
 
-JNIEXPORT void JNICALL
+static void JNICALL
 JNI_FUNCTION(getModVars)(JNIEnv *env, jobject obj, jobject modVars) {
     (void) obj;
 
@@ -525,11 +1242,6 @@ JNI_FUNCTION(getModVars)(JNIEnv *env, jobject obj, jobject modVars) {
         return;
     }
 
-    // Sanity check
-    if (modVarsIDs.currentSequence == NULL) {
-        cacheModVarsIDs(env);
-    }
-
     (*env)->SetIntField(env, modVars, modVarsIDs.seqDuration, mi.seq_data[g_sequence].duration);
     (*env)->SetIntField(env, modVars, modVarsIDs.lengthInPatterns, mi.mod->len);
     (*env)->SetIntField(env, modVars, modVarsIDs.numPatterns, mi.mod->pat);
@@ -542,14 +1254,110 @@ JNI_FUNCTION(getModVars)(JNIEnv *env, jobject obj, jobject modVars) {
     unlock();
 }
 
-JNIEXPORT jstring JNICALL
+/*
+ * A copy of the metadata blob owned by the caller, the original is freed
+ * by the next load while the UI and the service may still be decoding it
+ */
+static jbyteArray JNICALL
+JNI_FUNCTION(getModMetadata)(JNIEnv *env, jobject obj) {
+    (void) obj;
+
+    jbyteArray array = NULL;
+    void *copy = NULL;
+    size_t size = 0;
+
+    lock();
+
+    if (g_mod_is_loaded && g_metadata != NULL) {
+        copy = malloc(g_metadata_size);
+        if (copy != NULL) {
+            memcpy(copy, g_metadata, g_metadata_size);
+            size = g_metadata_size;
+        }
+    }
+
+    unlock();
+
+    if (copy != NULL) {
+        array = (*env)->NewByteArray(env, (jsize) size);
+        if (array != NULL) {
+            (*env)->SetByteArrayRegion(env, array, 0, (jsize) size, copy);
+        }
+        free(copy);
+    }
+
+    return array;
+}
+
+static jint JNICALL
+JNI_FUNCTION(getTimelineSize)(JNIEnv *env, jobject obj, jint seq) {
+    (void) env;
+    (void) obj;
+
+    int num = -1;
+
+    lock();
+
+    if (g_mod_is_loaded) {
+        num = timeline_count(g_timeline, seq);
+    }
+
+    unlock();
+
+    return num;
+}
+
+/*
+ * Note-ons of sequence seq from start up to end ms into events, two ints
+ * each: the time, and the channel, key, instrument and volume from the
+ * top byte down. Returns how many the window holds, which may be more
+ * than were copied, or -1 without a timeline for the sequence.
+ */
+static jint JNICALL
+JNI_FUNCTION(getTimeline)(JNIEnv *env, jobject obj, jint seq, jint start, jint end,
+                          jintArray events) {
+    (void) obj;
+
+    struct timeline *t;
+    const struct note_event *e;
+    jint buf[256];
+    int i, j, n, num, len;
+
+    len = (*env)->GetArrayLength(env, events) / 2;
+
+    /* The timeline doesn't change, a reference keeps it past a load */
+    lock();
+    t = g_mod_is_loaded ? timeline_ref(g_timeline) : NULL;
+    unlock();
+
+    num = timeline_query(t, seq, start, end, &e);
+
+    if (len > num) {
+        len = num;
+    }
+
+    for (i = 0; i < len; i += n) {
+        n = len - i < 128 ? len - i : 128;
+        for (j = 0; j < n; j++) {
+            buf[j * 2] = e[i + j].time;
+            buf[j * 2 + 1] = e[i + j].chn << 24 | e[i + j].key << 16 | e[i + j].ins << 8 | e[i + j].vol;
+        }
+        (*env)->SetIntArrayRegion(env, events, i * 2, n * 2, buf);
+    }
+
+    timeline_free(t);
+
+    return num;
+}
+
+static jstring JNICALL
 JNI_FUNCTION(getVersion)(JNIEnv *env, jobject obj) {
     (void) obj;
 
     return (*env)->NewStringUTF(env, xmp_version);
 }
 
-JNIEXPORT jobjectArray JNICALL
+static jobjectArray JNICALL
 JNI_FUNCTION(getFormats)(JNIEnv *env, jobject obj) {
     (void) obj;
 
@@ -581,26 +1389,34 @@ JNI_FUNCTION(getFormats)(JNIEnv *env, jobject obj) {
     return stringArray;
 }
 
-JNIEXPORT jstring JNICALL
+static jstring JNICALL
 JNI_FUNCTION(getModName)(JNIEnv *env, jobject obj) {
     (void) obj;
 
-    char *s = g_mod_is_loaded ? mi.mod->name : "";
+    char s[XMP_NAME_SIZE];
+
+    lock();
+    snprintf(s, sizeof(s), "%s", g_mod_is_loaded ? mi.mod->name : "");
+    unlock();
 
     return (*env)->NewStringUTF(env, s);
 }
 
-JNIEXPORT jstring JNICALL
+static jstring JNICALL
 JNI_FUNCTION(getModType)(JNIEnv *env, jobject obj) {
     (void) obj;
 
-    char *s = g_mod_is_loaded ? mi.mod->type : "";
+    char s[XMP_NAME_SIZE];
+
+    lock();
+    snprintf(s, sizeof(s), "%s", g_mod_is_loaded ? mi.mod->type : "");
+    unlock();
 
     return (*env)->NewStringUTF(env, s);
 }
 
 
-JNIEXPORT jbyteArray JNICALL
+static jbyteArray JNICALL
 JNI_FUNCTION(getComment)(JNIEnv *env, jobject obj) {
     (void) obj;
 
@@ -608,19 +1424,25 @@ JNI_FUNCTION(getComment)(JNIEnv *env, jobject obj) {
     // so just pass the entire thing as a byte array!
 
     jbyteArray byteArray = (*env)->NewByteArray(env, 0);
+    char *comment;
 
-    if (mi.comment) {
-        size_t length = strlen(mi.comment);
+    lock();
+    comment = g_mod_is_loaded && mi.comment != NULL ? strdup(mi.comment) : NULL;
+    unlock();
+
+    if (comment) {
+        size_t length = strlen(comment);
 
         byteArray = (*env)->NewByteArray(env, (jsize) length);
 
-        (*env)->SetByteArrayRegion(env, byteArray, 0, (jsize) length, (const jbyte *) mi.comment);
+        (*env)->SetByteArrayRegion(env, byteArray, 0, (jsize) length, (const jbyte *) comment);
+        free(comment);
     }
 
     return byteArray;
 }
 
-JNIEXPORT jobjectArray JNICALL
+static jobjectArray JNICALL
 JNI_FUNCTION(getInstruments)(JNIEnv *env, jobject obj) {
     (void) obj;
 
@@ -631,16 +1453,22 @@ JNI_FUNCTION(getInstruments)(JNIEnv *env, jobject obj) {
     char buf[80];
     // int ins;
 
-    if (!g_mod_is_loaded)
-        return NULL;
-
     stringClass = (*env)->FindClass(env, "java/lang/String");
     if (stringClass == NULL)
         return NULL;
 
+    lock();
+
+    if (!g_mod_is_loaded) {
+        unlock();
+        return NULL;
+    }
+
     stringArray = (*env)->NewObjectArray(env, mi.mod->ins, stringClass, NULL);
-    if (stringArray == NULL)
+    if (stringArray == NULL) {
+        unlock();
         return NULL;
+    }
 
     for (i = 0; i < mi.mod->ins; i++) {
         snprintf(buf, 80, "%02X %s", i + 1, mi.mod->xxi[i].name);
@@ -649,6 +1477,8 @@ JNI_FUNCTION(getInstruments)(JNIEnv *env, jobject obj) {
         (*env)->DeleteLocalRef(env, s);
     }
 
+    unlock();
+
     return stringArray;
 }
 
@@ -664,12 +1494,12 @@ static struct xmp_subinstrument *get_subinstrument(int ins, int key) {
     return NULL;
 }
 
-JNIEXPORT void JNICALL
+static void JNICALL
 JNI_FUNCTION(getChannelData)(JNIEnv *env, jobject obj, jobject channelInfo) {
     (void) obj;
 
     struct xmp_subinstrument *sub;
-    int chn = mi.mod->chn;
+    int chn;
     int i;
 
     lock();
@@ -679,10 +1509,7 @@ JNI_FUNCTION(getChannelData)(JNIEnv *env, jobject obj, jobject channelInfo) {
         return;
     }
 
-    // Sanity
-    if (channelVarsIDs.finalVols == NULL) {
-        cacheChannelVarsIDs(env);
-    }
+    chn = mi.mod->chn;
 
     jintArray vol = (*env)->GetObjectField(env, channelInfo, channelVarsIDs.volumes);
     jintArray finalVols = (*env)->GetObjectField(env, channelInfo, channelVarsIDs.finalVols);
@@ -737,7 +1564,7 @@ JNI_FUNCTION(getChannelData)(JNIEnv *env, jobject obj, jobject channelInfo) {
     unlock();
 }
 
-JNIEXPORT void JNICALL
+static void JNICALL
 JNI_FUNCTION(getPatternRow)(JNIEnv *env, jobject obj, jint pat, jint row,
                             jbyteArray rowNotes, jbyteArray rowInstruments,
                             jbyteArray rowFxType, jbyteArray rowFxParm) {
@@ -751,11 +1578,12 @@ JNI_FUNCTION(getPatternRow)(JNIEnv *env, jobject obj, jint pat, jint row,
     int chn;
     int i;
 
-    if (!g_mod_is_loaded)
-        return;
+    lock();
 
-    if (pat > mi.mod->pat || row > mi.mod->xxp[pat]->rows)
+    if (!g_mod_is_loaded || pat > mi.mod->pat || row > mi.mod->xxp[pat]->rows) {
+        unlock();
         return;
+    }
 
     xxp = mi.mod->xxp[pat];
     chn = mi.mod->chn;
@@ -786,13 +1614,15 @@ JNI_FUNCTION(getPatternRow)(JNIEnv *env, jobject obj, jint pat, jint row,
         }
     }
 
+    unlock();
+
     (*env)->SetByteArrayRegion(env, rowNotes, 0, chn, row_note);
     (*env)->SetByteArrayRegion(env, rowInstruments, 0, chn, row_ins);
     (*env)->SetByteArrayRegion(env, rowFxType, 0, chn, row_fxt);
     (*env)->SetByteArrayRegion(env, rowFxParm, 0, chn, row_fxp);
 }
 
-JNIEXPORT void JNICALL
+static void JNICALL
 JNI_FUNCTION(getSampleData)(JNIEnv *env, jobject obj, jboolean trigger,
                             jint ins, jint key, jint period, jint chn,
                             jint width, jbyteArray buffer) {
@@ -923,30 +1753,514 @@ JNI_FUNCTION(getSampleData)(JNIEnv *env, jobject obj, jboolean trigger,
     unlock();
 }
 
-JNIEXPORT jboolean JNICALL
-JNI_FUNCTION(setSequence)(JNIEnv *env, jobject obj, jint seq) {
+static jint JNICALL
+JNI_FUNCTION(getWaveform)(JNIEnv *env, jobject obj, jint smp, jint start, jint end,
+                          jint width, jshortArray minArray, jshortArray maxArray,
+                          jintArray loopArray) {
+    (void) obj;
+
+    static jshort wf_min[WAVEFORM_MAX_WIDTH];
+    static jshort wf_max[WAVEFORM_MAX_WIDTH];
+    jint loop[2];
+    int ret;
+
+    if (width > WAVEFORM_MAX_WIDTH) {
+        width = WAVEFORM_MAX_WIDTH;
+    }
+
+    if ((*env)->GetArrayLength(env, minArray) < width ||
+        (*env)->GetArrayLength(env, maxArray) < width ||
+        (*env)->GetArrayLength(env, loopArray) < 2) {
+        return -1;
+    }
+
+    lock();
+
+    ret = waveform_query(smp, start, end, width, wf_min, wf_max, loop);
+    if (ret > 0) {
+        (*env)->SetShortArrayRegion(env, minArray, 0, ret, wf_min);
+        (*env)->SetShortArrayRegion(env, maxArray, 0, ret, wf_max);
+        (*env)->SetIntArrayRegion(env, loopArray, 0, 2, loop);
+    }
+
+    unlock();
+
+    return ret;
+}
+
+static jint JNICALL
+JNI_FUNCTION(getWaveformProgress)(JNIEnv *env, jobject obj) {
+    (void) env;
+    (void) obj;
+
+    return waveform_progress();
+}
+
+static jboolean JNICALL
+JNI_FUNCTION(getDowngradeReport)(JNIEnv *env, jobject obj, jlongArray report) {
+    (void) obj;
+
+    jlong values[5];
+
+    if ((*env)->GetArrayLength(env, report) < 5) {
+        return JNI_FALSE;
+    }
+
+    lock();
+
+    values[0] = g_downgrade.mono;
+    values[1] = g_downgrade.eight_bit;
+    values[2] = g_downgrade.halved;
+    values[3] = (jlong) g_downgrade.before;
+    values[4] = (jlong) g_downgrade.after;
+
+    unlock();
+
+    (*env)->SetLongArrayRegion(env, report, 0, 5, values);
+
+    return JNI_TRUE;
+}
+
+static jlong JNICALL
+JNI_FUNCTION(getModuleResidentBytes)(JNIEnv *env, jobject obj) {
+    (void) env;
+    (void) obj;
+
+    jlong bytes = 0;
+
+    lock();
+
+    if (g_mod_is_loaded) {
+        bytes = (jlong) module_footprint(mi.mod);
+    }
+
+    unlock();
+
+    return bytes;
+}
+
+static void JNICALL
+JNI_FUNCTION(setDepackCache)(JNIEnv *env, jobject obj, jstring dir, jlong bytes) {
+    (void) obj;
+
+    const char *path = dir != NULL ? (*env)->GetStringUTFChars(env, dir, NULL) : NULL;
+
+    depack_set_cache(path, (size_t) bytes);
+
+    if (path != NULL) {
+        (*env)->ReleaseStringUTFChars(env, dir, path);
+    }
+}
+
+static void JNICALL
+JNI_FUNCTION(setModuleCacheBudget)(JNIEnv *env, jobject obj, jlong bytes) {
+    (void) env;
+    (void) obj;
+
+    modcache_set_budget((size_t) bytes);
+}
+
+static void JNICALL
+JNI_FUNCTION(trimModuleCache)(JNIEnv *env, jobject obj, jlong bytes) {
+    (void) env;
+    (void) obj;
+
+    modcache_trim((size_t) bytes);
+}
+
+static jlong JNICALL
+JNI_FUNCTION(getModuleCacheSize)(JNIEnv *env, jobject obj) {
+    (void) env;
+    (void) obj;
+
+    return (jlong) modcache_size();
+}
+
+static jobjectArray JNICALL
+JNI_FUNCTION(getProbeLoaders)(JNIEnv *env, jobject obj) {
+    (void) obj;
+
+    jstring s;
+    jclass stringClass;
+    jobjectArray stringArray;
+    struct probe_stat *stats;
+    uint64_t scans, scan_ns;
+    int i, num;
+
+    num = probe_num_loaders();
+    stats = malloc(num * sizeof(struct probe_stat));
+    if (stats == NULL)
+        return NULL;
+
+    num = probe_get_stats(stats, num, &scans, &scan_ns);
+
+    stringClass = (*env)->FindClass(env, "java/lang/String");
+    if (stringClass == NULL) {
+        free(stats);
+        return NULL;
+    }
+
+    stringArray = (*env)->NewObjectArray(env, num, stringClass, NULL);
+    if (stringArray == NULL) {
+        free(stats);
+        return NULL;
+    }
+
+    for (i = 0; i < num; i++) {
+        s = (*env)->NewStringUTF(env, stats[i].name);
+        (*env)->SetObjectArrayElement(env, stringArray, i, s);
+        (*env)->DeleteLocalRef(env, s);
+    }
+
+    free(stats);
+
+    return stringArray;
+}
+
+/*
+ * Full scan count and nanoseconds, then tries, hits, nanoseconds and
+ * full scan hits for each loader in getProbeLoaders order
+ */
+static jboolean JNICALL
+JNI_FUNCTION(getProbeStats)(JNIEnv *env, jobject obj, jlongArray out) {
+    (void) obj;
+
+    struct probe_stat *stats;
+    uint64_t scans, scan_ns;
+    jlong *values;
+    int i, num;
+
+    num = probe_num_loaders();
+    if ((*env)->GetArrayLength(env, out) < 2 + num * 4) {
+        return JNI_FALSE;
+    }
+
+    stats = malloc(num * sizeof(struct probe_stat));
+    values = malloc((2 + num * 4) * sizeof(jlong));
+    if (stats == NULL || values == NULL) {
+        free(stats);
+        free(values);
+        return JNI_FALSE;
+    }
+
+    num = probe_get_stats(stats, num, &scans, &scan_ns);
+
+    values[0] = (jlong) scans;
+    values[1] = (jlong) scan_ns;
+    for (i = 0; i < num; i++) {
+        values[2 + i * 4] = (jlong) stats[i].tries;
+        values[3 + i * 4] = (jlong) stats[i].hits;
+        values[4 + i * 4] = (jlong) stats[i].ns;
+        values[5 + i * 4] = (jlong) stats[i].missed;
+    }
+
+    (*env)->SetLongArrayRegion(env, out, 0, 2 + num * 4, values);
+
+    free(stats);
+    free(values);
+
+    return JNI_TRUE;
+}
+
+static jboolean JNICALL
+JNI_FUNCTION(getLoadReport)(JNIEnv *env, jobject obj, jlongArray out) {
+    (void) obj;
+
+    jlong values[2 + LOAD_PHASES * 4];
+    int i;
+
+    if ((*env)->GetArrayLength(env, out) < 2 + LOAD_PHASES * 4) {
+        return JNI_FALSE;
+    }
+
+    lock();
+
+    values[0] = g_load_report.res;
+    values[1] = g_load_report.cached;
+    for (i = 0; i < LOAD_PHASES; i++) {
+        values[2 + i * 4] = (jlong) g_load_report.phase[i].ns;
+        values[3 + i * 4] = (jlong) g_load_report.phase[i].bytes;
+        values[4 + i * 4] = (jlong) g_load_report.phase[i].faults;
+        values[5 + i * 4] = (jlong) g_load_report.phase[i].alloc;
+    }
+
+    unlock();
+
+    (*env)->SetLongArrayRegion(env, out, 0, 2 + LOAD_PHASES * 4, values);
+
+    return JNI_TRUE;
+}
+
+static void JNICALL
+JNI_FUNCTION(setOutputGain)(JNIEnv *env, jobject obj, jfloat db) {
+    (void) env;
+    (void) obj;
+
+    lock();
+
+    /* Unity gain skips the output stage entirely */
+    g_limiter_on = db != 0.0f;
+    limiter_init(&g_limiter, powf(10.0f, db / 20.0f));
+
+    unlock();
+}
+
+static void JNICALL
+JNI_FUNCTION(setChannelScopes)(JNIEnv *env, jobject obj, jint width) {
+    (void) env;
+    (void) obj;
+
+    lock();
+
+    g_scope_width = width > 0 ? (width < MAX_BUFFER_SIZE ? width : MAX_BUFFER_SIZE) : 0;
+
+    scope_free(g_scope);
+    g_scope = NULL;
+
+    if (g_playing && g_scope_width > 0) {
+        g_scope = scope_new(ctx, g_buffer_num, mi.mod->chn, g_scope_width);
+    }
+
+    unlock();
+}
+
+static jint JNICALL
+JNI_FUNCTION(getChannelScope)(JNIEnv *env, jobject obj, jint chn, jbyteArray buffer) {
+    (void) obj;
+
+    jsize len = (*env)->GetArrayLength(env, buffer);
+    int peak = -1;
+
+    lock();
+
+    if (g_playing && g_scope != NULL) {
+        if (len > MAX_BUFFER_SIZE) {
+            len = MAX_BUFFER_SIZE;
+        }
+
+        peak = scope_get(g_scope, g_before, chn, (int8_t *) g_buffer, len);
+        if (peak >= 0) {
+            (*env)->SetByteArrayRegion(env, buffer, 0, len < g_scope_width ? len : g_scope_width,
+                                       g_buffer);
+        }
+    }
+
+    unlock();
+
+    return peak;
+}
+
+static void JNICALL
+JNI_FUNCTION(setQualityGovernor)(JNIEnv *env, jobject obj, jboolean enabled) {
     (void) env;
     (void) obj;
 
-    if (seq >= mi.num_sequences)
+    lock();
+
+    g_governor_on = enabled;
+    g_governor.enabled = enabled;
+
+    /* Back to full quality if it was stepped down */
+    if (!enabled && g_playing && g_governor.level > 0) {
+        g_governor.level = 0;
+        apply_governor();
+    }
+
+    unlock();
+}
+
+static jint JNICALL
+JNI_FUNCTION(getQualitySteps)(JNIEnv *env, jobject obj, jlongArray out) {
+    (void) obj;
+
+    struct governor_step steps[GOVERNOR_HISTORY];
+    jlong values[3 + GOVERNOR_HISTORY * 3];
+    jsize len = (*env)->GetArrayLength(env, out);
+    int i, num;
+    int max = (len - 3) / 3;
+
+    if (len < 3) {
+        return -1;
+    }
+
+    lock();
+
+    num = governor_get_steps(&g_governor, steps, max < GOVERNOR_HISTORY ? max : GOVERNOR_HISTORY);
+    values[0] = (jlong) g_governor.num_steps;
+    values[1] = g_governor.level;
+    values[2] = (jlong) (g_governor.load * 1000);
+
+    unlock();
+
+    for (i = 0; i < num; i++) {
+        values[3 + i * 3] = (jlong) steps[i].time_ms;
+        values[4 + i * 3] = steps[i].level;
+        values[5 + i * 3] = (jlong) (steps[i].load * 1000);
+    }
+
+    (*env)->SetLongArrayRegion(env, out, 0, 3 + num * 3, values);
+
+    return num;
+}
+
+static jint JNICALL
+JNI_FUNCTION(scanLoudness)(JNIEnv *env, jobject obj, jint fd, jint member, jint seq,
+                           jfloatArray result, jbyteArray md5) {
+    (void) obj;
+
+    struct loudness res;
+    jfloat values[2];
+
+    if ((*env)->GetArrayLength(env, result) < 2 || (*env)->GetArrayLength(env, md5) < 16) {
+        close(fd);
+        return -1;
+    }
+
+    if (loudness_scan(fd, member, seq, &res) < 0) {
+        return -1;
+    }
+
+    values[0] = res.integrated;
+    values[1] = res.true_peak;
+    (*env)->SetFloatArrayRegion(env, result, 0, 2, values);
+    (*env)->SetByteArrayRegion(env, md5, 0, 16, (const jbyte *) res.md5);
+
+    return 0;
+}
+
+static jboolean JNICALL
+JNI_FUNCTION(fingerprintFd)(JNIEnv *env, jobject obj, jint fd, jint member, jlongArray result) {
+    (void) obj;
+
+    struct fingerprint fp;
+    jlong values[2];
+
+    if ((*env)->GetArrayLength(env, result) < 2) {
+        close(fd);
         return JNI_FALSE;
+    }
 
-    if (mi.seq_data[g_sequence].duration <= 0)
+    if (fingerprint_fd(fd, member, &fp) < 0) {
         return JNI_FALSE;
+    }
+
+    values[0] = (jlong) fp.payload;
+    values[1] = (jlong) fp.content;
+    (*env)->SetLongArrayRegion(env, result, 0, 2, values);
+
+    return JNI_TRUE;
+}
+
+static void JNICALL
+JNI_FUNCTION(cancelLoudnessScan)(JNIEnv *env, jobject obj) {
+    (void) env;
+    (void) obj;
+
+    loudness_cancel();
+}
+
+static jint JNICALL
+JNI_FUNCTION(startEnvelope)(JNIEnv *env, jobject obj, jint fd, jint member, jint seq,
+                            jint buckets) {
+    (void) env;
+    (void) obj;
+
+    return envelope_start(fd, member, seq, buckets);
+}
+
+static void JNICALL
+JNI_FUNCTION(stopEnvelope)(JNIEnv *env, jobject obj) {
+    (void) env;
+    (void) obj;
+
+    envelope_stop();
+}
+
+static jint JNICALL
+JNI_FUNCTION(startStems)(JNIEnv *env, jobject obj, jint fd, jint member, jint seq,
+                         jstring dir, jint rate) {
+    (void) obj;
+
+    const char *path = (*env)->GetStringUTFChars(env, dir, NULL);
+    int ret;
+
+    if (path == NULL) {
+        close(fd);
+        return -1;
+    }
+
+    ret = stems_start(fd, member, seq, path, rate, g_defpan);
+    (*env)->ReleaseStringUTFChars(env, dir, path);
+
+    return ret;
+}
+
+static void JNICALL
+JNI_FUNCTION(stopStems)(JNIEnv *env, jobject obj) {
+    (void) env;
+    (void) obj;
+
+    stems_stop();
+}
+
+static jint JNICALL
+JNI_FUNCTION(getStemsProgress)(JNIEnv *env, jobject obj) {
+    (void) env;
+    (void) obj;
+
+    return stems_progress();
+}
+
+static jint JNICALL
+JNI_FUNCTION(getEnvelope)(JNIEnv *env, jobject obj, jshortArray rmsArray, jshortArray peakArray) {
+    (void) obj;
+
+    static jshort env_rms[ENVELOPE_MAX_BUCKETS];
+    static jshort env_peak[ENVELOPE_MAX_BUCKETS];
+    int num, ret;
+
+    num = (*env)->GetArrayLength(env, rmsArray);
+    if ((*env)->GetArrayLength(env, peakArray) < num) {
+        return -1;
+    }
+    if (num > ENVELOPE_MAX_BUCKETS) {
+        num = ENVELOPE_MAX_BUCKETS;
+    }
+
+    ret = envelope_get(env_rms, env_peak, num);
+    if (ret > 0) {
+        (*env)->SetShortArrayRegion(env, rmsArray, 0, ret, env_rms);
+        (*env)->SetShortArrayRegion(env, peakArray, 0, ret, env_peak);
+    }
+
+    return ret;
+}
+
+static jboolean JNICALL
+JNI_FUNCTION(setSequence)(JNIEnv *env, jobject obj, jint seq) {
+    (void) env;
+    (void) obj;
+
+    /* The render thread may be in the middle of a tick */
+    lock();
 
-    if (g_sequence == seq)
+    if (seq >= mi.num_sequences || mi.seq_data[g_sequence].duration <= 0 || g_sequence == seq) {
+        unlock();
         return JNI_FALSE;
+    }
 
     g_sequence = seq;
     g_loop_count = 0;
 
     xmp_set_position(ctx, mi.seq_data[g_sequence].entry_point);
-    xmp_play_buffer(ctx, NULL, 0, 0);
+    ticks_drop();
+
+    unlock();
 
     return JNI_TRUE;
 }
 
-JNIEXPORT jint JNICALL
+static jint JNICALL
 JNI_FUNCTION(getMaxSequences)(JNIEnv *env, jobject obj) {
     (void) env;
     (void) obj;
@@ -954,47 +2268,55 @@ JNI_FUNCTION(getMaxSequences)(JNIEnv *env, jobject obj) {
     return MAX_SEQUENCES;
 }
 
-JNIEXPORT void JNICALL
+static void JNICALL
 JNI_FUNCTION(getSeqVars)(JNIEnv *env, jobject obj, jobject seqVars) {
     (void) obj;
 
+    jint durations[16];
     int num;
 
-    if (!g_mod_is_loaded)
+    lock();
+
+    if (!g_mod_is_loaded) {
+        unlock();
         return;
+    }
 
     num = mi.num_sequences;
     if (num > 16) {
         num = 16;
     }
 
-    // Sanity
-    if (seqVarsIDs.sequenceField == NULL) {
-        cacheSequenceVarsIDs(env);
+    for (int i = 0; i < num; i++) {
+        durations[i] = mi.seq_data[i].duration;
     }
 
+    unlock();
+
     jintArray result = (*env)->NewIntArray(env, num);
     if (result == NULL) {
         return;
     }
 
-    for (int i = 0; i < num; i++) {
-        jint value = mi.seq_data[i].duration;
-        (*env)->SetIntArrayRegion(env, result, i, 1, &value);
-    }
+    (*env)->SetIntArrayRegion(env, result, 0, num, durations);
 
     (*env)->SetObjectField(env, seqVars, seqVarsIDs.sequenceField, result);
 }
 
-JNIEXPORT jint JNICALL
+static jint JNICALL
+CRITICAL_FUNCTION(getVolume)(void) {
+    return get_volume();
+}
+
+static jint JNICALL
 JNI_FUNCTION(getVolume)(JNIEnv *env, jobject obj) {
     (void) env;
     (void) obj;
 
-    return get_volume();
+    return CRITICAL_FUNCTION(getVolume)();
 }
 
-JNIEXPORT jint JNICALL
+static jint JNICALL
 JNI_FUNCTION(setVolume)(JNIEnv *env, jobject obj, jint vol) {
     (void) env;
     (void) obj;
@@ -1003,6 +2325,150 @@ JNI_FUNCTION(setVolume)(JNIEnv *env, jobject obj, jint vol) {
 }
 
 
+#define NATIVE(name, sig) { #name, sig, (void *) JNI_FUNCTION(name) }
+#define CRITICAL(name, sig) { #name, sig, (void *) CRITICAL_FUNCTION(name) }
+
+static const JNINativeMethod natives[] = {
+    NATIVE(init, "(III)Z"),
+    NATIVE(deinit, "()I"),
+    NATIVE(loadModuleFd, "(IIJ)I"),
+    NATIVE(requestModuleFd, "(IIJ)I"),
+    NATIVE(awaitModule, "(II)I"),
+    NATIVE(cancelLoad, "()V"),
+    NATIVE(openArchiveFd, "(I)J"),
+    NATIVE(closeArchive, "(J)V"),
+    NATIVE(getArchiveEntries, "(J)[Ljava/lang/String;"),
+    NATIVE(testArchiveEntry, "(JILorg/helllabs/android/xmp/model/ModInfo;)Z"),
+    NATIVE(testModuleFd, "(ILorg/helllabs/android/xmp/model/ModInfo;)Z"),
+    NATIVE(releaseModule, "()I"),
+    NATIVE(startPlayer, "(I)I"),
+    NATIVE(endPlayer, "()I"),
+    NATIVE(playAudio, "()I"),
+    NATIVE(dropAudio, "()V"),
+    NATIVE(stopAudio, "()Z"),
+    NATIVE(restartAudio, "()Z"),
+    NATIVE(fillBuffer, "(Z)I"),
+    NATIVE(nextPosition, "()I"),
+    NATIVE(prevPosition, "()I"),
+    NATIVE(setPosition, "(I)I"),
+    NATIVE(stopModule, "()I"),
+    NATIVE(restartModule, "()I"),
+    NATIVE(seek, "(I)I"),
+    NATIVE(getTickState, "(J[I[I[I)I"),
+    NATIVE(mute, "(II)I"),
+    NATIVE(getInfo, "(Lorg/helllabs/android/xmp/model/FrameInfo;)V"),
+    NATIVE(waitEvents, "([JI)I"),
+    NATIVE(wakeEvents, "()V"),
+    NATIVE(setPlayer, "(II)V"),
+    NATIVE(getModVars, "(Lorg/helllabs/android/xmp/model/ModVars;)V"),
+    NATIVE(getModMetadata, "()[B"),
+    NATIVE(getTimelineSize, "(I)I"),
+    NATIVE(getTimeline, "(III[I)I"),
+    NATIVE(getVersion, "()Ljava/lang/String;"),
+    NATIVE(getFormats, "()[Ljava/lang/String;"),
+    NATIVE(getModName, "()Ljava/lang/String;"),
+    NATIVE(getModType, "()Ljava/lang/String;"),
+    NATIVE(getComment, "()[B"),
+    NATIVE(getInstruments, "()[Ljava/lang/String;"),
+    NATIVE(getChannelData, "(Lorg/helllabs/android/xmp/model/ChannelInfo;)V"),
+    NATIVE(getPatternRow, "(II[B[B[B[B)V"),
+    NATIVE(getSampleData, "(ZIIIII[B)V"),
+    NATIVE(getWaveform, "(IIII[S[S[I)I"),
+    NATIVE(getWaveformProgress, "()I"),
+    NATIVE(getDowngradeReport, "([J)Z"),
+    NATIVE(getModuleResidentBytes, "()J"),
+    NATIVE(setDepackCache, "(Ljava/lang/String;J)V"),
+    NATIVE(setModuleCacheBudget, "(J)V"),
+    NATIVE(trimModuleCache, "(J)V"),
+    NATIVE(getModuleCacheSize, "()J"),
+    NATIVE(getProbeLoaders, "()[Ljava/lang/String;"),
+    NATIVE(getProbeStats, "([J)Z"),
+    NATIVE(getLoadReport, "([J)Z"),
+    NATIVE(setOutputGain, "(F)V"),
+    NATIVE(setChannelScopes, "(I)V"),
+    NATIVE(getChannelScope, "(I[B)I"),
+    NATIVE(setQualityGovernor, "(Z)V"),
+    NATIVE(getQualitySteps, "([J)I"),
+    NATIVE(waitFreeBuffer, "(I)Z"),
+    NATIVE(setRenderThread, "()I"),
+    NATIVE(getRenderStats, "([J)Z"),
+    NATIVE(setMemoryLock, "(J)V"),
+    NATIVE(scanLoudness, "(III[F[B)I"),
+    NATIVE(fingerprintFd, "(II[J)Z"),
+    NATIVE(cancelLoudnessScan, "()V"),
+    NATIVE(startEnvelope, "(IIII)I"),
+    NATIVE(stopEnvelope, "()V"),
+    NATIVE(startStems, "(IIILjava/lang/String;I)I"),
+    NATIVE(stopStems, "()V"),
+    NATIVE(getStemsProgress, "()I"),
+    NATIVE(getEnvelope, "([S[S)I"),
+    NATIVE(setSequence, "(I)Z"),
+    NATIVE(getMaxSequences, "()I"),
+    NATIVE(getSeqVars, "(Lorg/helllabs/android/xmp/model/SequenceVars;)V"),
+    NATIVE(setVolume, "(I)I"),
+};
+
+/* Android 8 is the first to honour @CriticalNative, earlier ones get the JNI wrappers */
+static const JNINativeMethod critical_natives[] = {
+    CRITICAL(time, "()I"),
+    CRITICAL(getPlayState, "()J"),
+    CRITICAL(hasFreeBuffer, "()Z"),
+    CRITICAL(getLoopCount, "()I"),
+    CRITICAL(getVolume, "()I"),
+    CRITICAL(getPlayer, "(I)I"),
+};
+
+static const JNINativeMethod critical_fallbacks[] = {
+    NATIVE(time, "()I"),
+    NATIVE(getPlayState, "()J"),
+    NATIVE(hasFreeBuffer, "()Z"),
+    NATIVE(getLoopCount, "()I"),
+    NATIVE(getVolume, "()I"),
+    NATIVE(getPlayer, "(I)I"),
+};
+
+JNIEXPORT jint JNICALL
+JNI_OnLoad(JavaVM *vm, void *reserved) {
+    (void) reserved;
+
+    JNIEnv *env;
+    jclass xmp;
+    int res;
+
+    if ((*vm)->GetEnv(vm, (void **) &env, JNI_VERSION_1_6) != JNI_OK) {
+        return JNI_ERR;
+    }
+
+    xmp = (*env)->FindClass(env, "org/helllabs/android/xmp/Xmp");
+    if (xmp == NULL) {
+        return JNI_ERR;
+    }
+
+    res = (*env)->RegisterNatives(env, xmp, natives, sizeof(natives) / sizeof(natives[0]));
+    if (res == JNI_OK) {
+        if (android_get_device_api_level() >= __ANDROID_API_O__) {
+            res = (*env)->RegisterNatives(env, xmp, critical_natives,
+                                          sizeof(critical_natives) / sizeof(critical_natives[0]));
+        } else {
+            res = (*env)->RegisterNatives(env, xmp, critical_fallbacks,
+                                          sizeof(critical_fallbacks) / sizeof(critical_fallbacks[0]));
+        }
+    }
+    (*env)->DeleteLocalRef(env, xmp);
+
+    if (res != JNI_OK) {
+        return JNI_ERR;
+    }
+
+    /* Field ids stay valid as long as the classes, which outlive the library */
+    if (cacheChannelVarsIDs(env) < 0 || cacheFrameInfoIDs(env) < 0 || cacheModInfoIDs(env) < 0 ||
+        cacheModVarsIDs(env) < 0 || cacheSequenceVarsIDs(env) < 0) {
+        return JNI_ERR;
+    }
+
+    return JNI_VERSION_1_6;
+}
+
 //JNIEXPORT jint JNICALL
 //JNI_FUNCTION(loadModule)(JNIEnv *env, jobject obj, jstring name) {
 //    (void) obj;